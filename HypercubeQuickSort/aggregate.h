@@ -0,0 +1,201 @@
+﻿#pragma once
+#include <algorithm>
+#include <vector>
+#include "mpiext.h"
+#include "parallel.h"
+#include "shared_array.h"
+
+namespace mpi {
+	using std::vector;
+
+	///<summary>
+	/// Ключ с числом повторов. Сравнение только по ключу,
+	/// поэтому сортировщик сливает равные, складывая счётчики
+	///</summary>
+	template<typename K> struct counted {
+		K key;
+		long long count;
+
+		bool operator<(const counted& other) const { return key < other.key; }
+	};
+
+	namespace traits {
+		template<typename K>
+		struct mpi_type<counted<K>> : std::true_type {
+			static MPI_Datatype get() {
+				static MPI_Datatype _type = [] {
+					MPI_Datatype type;
+					MPI_Type_contiguous(sizeof(counted<K>), MPI_BYTE, &type);
+					MPI_Type_commit(&type);
+					return type;
+				}();
+				return _type;
+			}
+		};
+	}
+
+	///<summary>
+	/// Агрегация по ключу поверх сортировки. Слайсы отсортированы
+	/// и упорядочены по рангу (как после run_slice): серии равных ключей
+	/// сворачиваются локально, а серии на стыке процессов - по первым
+	/// и последним ключам соседей, собранным одним MPI_Allgather.
+	/// Серия достаётся процессу, на котором начинается
+	///</summary>
+	template<typename K> class aggregate {
+	public:
+		aggregate() = delete;
+		aggregate(const aggregate&) = delete;
+		aggregate& operator=(const aggregate&) = delete;
+
+	public:
+		///<summary>
+		/// Оставляет в слайсах различные ключи (коллективно)
+		///</summary>
+		static void unique(shared_array<K>& keys, MPI_Comm comm = MPI_COMM_WORLD)
+		{
+			auto last = std::unique(std::begin(keys), std::end(keys), same);
+			keys.truncate(static_cast<size_t>(last - std::begin(keys)));
+			if (gather_edges(keys, comm).continues(mpi::getRank(comm)))
+				drop_first(keys);
+		}
+
+		///<summary>
+		/// Сворачивает слайс в различные ключи и возвращает
+		/// число повторов каждого (коллективно)
+		///</summary>
+		static shared_array<long long> count_by_key(shared_array<K>& keys, MPI_Comm comm = MPI_COMM_WORLD)
+		{
+			shared_array<long long> counts(keys.size(), allocation::uninitialized());
+			for (size_t i = 0; i < counts.size(); i++)
+				counts[i] = 1;
+			reduce_by_key(keys, counts, [](long long a, long long b) { return a + b; }, comm);
+			return counts;
+		}
+
+		///<summary>
+		/// Сворачивает серии равных ключей, значения серии объединяются
+		/// op(накопленное, следующее) по порядку (коллективно).
+		/// values[i] относится к keys[i], V - базовый тип MPI
+		///</summary>
+		template<typename V, typename Op>
+		static void reduce_by_key(shared_array<K>& keys, shared_array<V>& values, Op op, MPI_Comm comm = MPI_COMM_WORLD)
+		{
+			// Локальные серии
+			size_t last = 0;
+			for (size_t i = 1; i < keys.size(); i++) {
+				if (same(keys[last], keys[i])) {
+					values[last] = op(values[last], values[i]);
+				} else {
+					keys[++last] = keys[i];
+					values[last] = values[i];
+				}
+			}
+			auto size = keys.size() == 0 ? 0 : last + 1;
+			keys.truncate(size);
+			values.truncate(size);
+
+			// Частичные значения первых серий всех процессов
+			auto rank = mpi::getRank(comm);
+			auto edges = gather_edges(keys, comm);
+			auto firsts = mpi::allgather(values.size() == 0 ? V{} : values[0], comm);
+			auto drop = edges.continues(rank);
+			// Последняя серия своя: к ней добавляются продолжения соседей
+			if (size > 0 && !(drop && size == 1)) {
+				for (auto pe = rank + 1; pe < static_cast<int>(edges.sizes.size()); pe++) {
+					if (edges.sizes[pe] == 0)
+						continue;
+					if (!same(edges.first(pe), keys[size - 1]))
+						break;
+					values[size - 1] = op(values[size - 1], firsts[pe]);
+					if (edges.sizes[pe] > 1)
+						break;
+				}
+			}
+			if (drop) {
+				drop_first(keys);
+				drop_first(values);
+			}
+		}
+
+		///<summary>
+		/// Сортировка с удалением повторов: равные ключи выбрасываются
+		/// до каждого обмена, так что по сети идут только различные
+		///</summary>
+		static void sort_unique(shared_array<K>& keys, sorter<K>& engine = sorter<K>::shared())
+		{
+			engine.collapse([](K&, const K&) { });
+			engine.run_slice(keys);
+			engine.collapse(nullptr);
+			unique(keys);
+		}
+
+		///<summary>
+		/// Сортировка с подсчётом повторов: до каждого обмена равные
+		/// ключи сливаются в один с суммой счётчиков. Возвращает
+		/// различные ключи слайса и число их повторов
+		///</summary>
+		static shared_array<long long> sort_count(shared_array<K>& keys,
+			sorter<counted<K>>& engine = sorter<counted<K>>::shared())
+		{
+			shared_array<counted<K>> items(keys.size(), allocation::uninitialized());
+			for (size_t i = 0; i < keys.size(); i++)
+				items[i] = { keys[i], 1 };
+			engine.collapse([](counted<K>& into, const counted<K>& other) { into.count += other.count; });
+			engine.run_slice(items);
+			engine.collapse(nullptr);
+			keys.fit(items.size());
+			shared_array<long long> counts(items.size(), allocation::uninitialized());
+			for (size_t i = 0; i < items.size(); i++) {
+				keys[i] = items[i].key;
+				counts[i] = items[i].count;
+			}
+			reduce_by_key(keys, counts, [](long long a, long long b) { return a + b; });
+			return counts;
+		}
+
+	private:
+		///<summary>
+		/// Размеры слайсов и их крайние ключи на всех процессах
+		///</summary>
+		struct edges_t {
+			vector<int> sizes;
+			vector<K> keys;  // [2 pe] - первый, [2 pe + 1] - последний
+
+			const K& first(int pe) const { return keys[2 * pe]; }
+			const K& last(int pe) const { return keys[2 * pe + 1]; }
+
+			///<summary>
+			/// Первый ключ процесса продолжает серию предыдущего непустого
+			///</summary>
+			bool continues(int pe) const {
+				if (sizes[pe] == 0)
+					return false;
+				for (auto before = pe - 1; before >= 0; before--)
+					if (sizes[before] > 0)
+						return same(last(before), first(pe));
+				return false;
+			}
+		};
+
+		static edges_t gather_edges(const shared_array<K>& keys, MPI_Comm comm)
+		{
+			edges_t edges{};
+			edges.sizes = mpi::allgather(static_cast<int>(keys.size()), comm);
+			vector<K> mine{ K{}, K{} };
+			if (keys.size() != 0)
+				mine = { keys[0], keys[keys.size() - 1] };
+			edges.keys = mpi::allgather(mine, comm);
+			return edges;
+		}
+
+		static bool same(const K& a, const K& b) {
+			return !(a < b) && !(b < a);
+		}
+
+		template<typename V>
+		static void drop_first(shared_array<V>& values) {
+			std::copy(std::begin(values) + 1, std::end(values), std::begin(values));
+			values.truncate(values.size() - 1);
+		}
+	};
+}
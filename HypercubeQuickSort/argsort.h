@@ -0,0 +1,172 @@
+﻿#pragma once
+#include <vector>
+#include "mpiext.h"
+#include "parallel.h"
+#include "shared_array.h"
+
+namespace mpi {
+	using std::vector;
+
+	///<summary>
+	/// Элемент с меткой происхождения: процесс и индекс
+	/// в исходном слайсе. Метка участвует в сравнении, поэтому
+	/// равные ключи упорядочиваются по месту в исходных данных
+	///</summary>
+	template<typename T> struct tagged {
+		T key;
+		int rank;
+		int index;
+
+		bool operator<(const tagged& other) const {
+			if (key < other.key) return true;
+			if (other.key < key) return false;
+			if (rank != other.rank) return rank < other.rank;
+			return index < other.index;
+		}
+	};
+
+	namespace traits {
+		// Передаём метку как непрерывный блок байт
+		template<typename T>
+		struct mpi_type<tagged<T>> : std::true_type {
+			static MPI_Datatype get() {
+				static MPI_Datatype _type = [] {
+					MPI_Datatype type;
+					MPI_Type_contiguous(sizeof(tagged<T>), MPI_BYTE, &type);
+					MPI_Type_commit(&type);
+					return type;
+				}();
+				return _type;
+			}
+		};
+	}
+
+	///<summary>
+	/// Перестановка, полученная при сортировке. Позволяет переставить
+	/// связанные с ключами столбцы одним MPI_Alltoallv
+	///</summary>
+	struct permutation {
+		shared_array<long long> destination; // Глобальная позиция каждого исходного элемента
+		vector<int> sendcounts;  // Сколько исходных элементов уходит на каждый процесс
+		vector<int> recvcounts;  // Сколько отсортированных элементов пришло с каждого процесса
+		vector<int> order;       // Порядок отправки исходных элементов
+		vector<int> origin;      // Процесс-источник каждого отсортированного элемента
+	};
+
+	template<typename T> class argsorter {
+	public:
+		typedef tagged<T> item;
+
+	public:
+		///<summary>
+		/// Стабильная параллельная сортировка массива данных
+		///</summary>
+		static void sort(shared_array<T>& data) {
+			auto slice = sorter<T>::split(data);
+			auto items = tag(slice);
+			sorter<item>::sort_slice(items);
+			data = sorter<T>::collect(untag(items));
+		}
+
+		///<summary>
+		/// Стабильная сортировка распределенных данных. Слайс заменяется
+		/// частью отсортированных ключей, перестановка возвращается
+		/// процессам, откуда пришли элементы
+		///</summary>
+		static permutation argsort(shared_array<T>& slice) {
+			auto size = mpi::getSize(MPI_COMM_WORLD);
+			auto items = tag(slice);
+			sorter<item>::sort_slice(items);
+
+			permutation perm{};
+			// Глобальная позиция первого элемента слайса
+			long long offset = mpi::exscan(static_cast<long long>(items.size()), MPI_SUM);
+			// Группируем пары {индекс, позиция} по исходным процессам.
+			// Внутри группы позиции идут по возрастанию
+			vector<int> sendcounts(size, 0);
+			perm.origin.resize(items.size());
+			for (size_t j = 0; j < items.size(); j++) {
+				perm.origin[j] = items[j].rank;
+				sendcounts[items[j].rank]++;
+			}
+			vector<int> cursor(size, 0);
+			for (auto pe = 1; pe < size; pe++)
+				cursor[pe] = cursor[pe - 1] + sendcounts[pe - 1];
+			vector<long long> pairs(2 * items.size());
+			for (size_t j = 0; j < items.size(); j++) {
+				auto k = cursor[items[j].rank]++;
+				pairs[2 * k] = items[j].index;
+				pairs[2 * k + 1] = offset + j;
+			}
+			perm.recvcounts = sendcounts;
+			for (auto& count : sendcounts)
+				count *= 2;
+			vector<int> recvcounts;
+			auto received = mpi::alltoallv(pairs, sendcounts, recvcounts);
+			// Исходная сторона: куда уходит каждый элемент и в каком
+			// порядке их отправлять при перестановке столбцов
+			perm.sendcounts.resize(size);
+			for (auto pe = 0; pe < size; pe++)
+				perm.sendcounts[pe] = recvcounts[pe] / 2;
+			perm.destination.reallocate(slice.size());
+			perm.order.resize(received.size() / 2);
+			for (size_t k = 0; k < perm.order.size(); k++) {
+				auto index = static_cast<int>(received[2 * k]);
+				perm.order[k] = index;
+				perm.destination[index] = received[2 * k + 1];
+			}
+			slice = untag(items);
+			return perm;
+		}
+
+		///<summary>
+		/// Переставляет столбец, распределенный так же, как исходные ключи,
+		/// в порядок отсортированных ключей
+		///</summary>
+		template<typename U>
+		static shared_array<U> permute(const shared_array<U>& column, const permutation& perm)
+		{
+			vector<U> outgoing(perm.order.size());
+			for (size_t k = 0; k < perm.order.size(); k++)
+				outgoing[k] = column[perm.order[k]];
+			auto incoming = mpi::alltoallv(outgoing, perm.sendcounts, perm.recvcounts);
+			// Элементы от каждого процесса пришли в порядке позиций
+			vector<int> cursor(perm.recvcounts.size(), 0);
+			for (size_t pe = 1; pe < cursor.size(); pe++)
+				cursor[pe] = cursor[pe - 1] + perm.recvcounts[pe - 1];
+			shared_array<U> result(perm.origin.size(), allocation::uninitialized());
+			for (size_t j = 0; j < perm.origin.size(); j++)
+				result[j] = incoming[cursor[perm.origin[j]]++];
+			return result;
+		}
+
+	private:
+		///<summary>
+		/// Помечает элементы слайса рангом и индексом
+		///</summary>
+		static shared_array<item> tag(const shared_array<T>& slice) {
+			auto rank = mpi::getRank(MPI_COMM_WORLD);
+			shared_array<item> items(slice.size(), allocation::uninitialized());
+			for (size_t i = 0; i < slice.size(); i++)
+				items[i] = item{ slice[i], rank, static_cast<int>(i) };
+			return items;
+		}
+
+		///<summary>
+		/// Снимает метки
+		///</summary>
+		static shared_array<T> untag(const shared_array<item>& items) {
+			shared_array<T> keys(items.size(), allocation::uninitialized());
+			for (size_t i = 0; i < items.size(); i++)
+				keys[i] = items[i].key;
+			return keys;
+		}
+
+	public:
+		// Класс статический
+		argsorter() = delete;
+		argsorter(argsorter&) = delete;
+		argsorter(argsorter&&) = delete;
+		argsorter& operator=(const argsorter&) = delete;
+	};
+}
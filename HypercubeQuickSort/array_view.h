@@ -0,0 +1,60 @@
+﻿#pragma once
+#include <cstddef>
+#include <type_traits>
+#include <vector>
+#include "shared_array.h"
+
+namespace mpi {
+
+	///<summary>
+	/// Непрерывный участок чужой памяти: указатель и длина.
+	/// Не владеет данными, копируется бесплатно. Позволяет отправлять
+	/// и принимать части массивов без промежуточных копий
+	///</summary>
+	template<typename T> class array_view
+	{
+	private:
+		T* _data;
+		size_t _size;
+	public:
+		// Тип значения
+		typedef T value_type;
+
+		array_view() : _data(nullptr), _size(0) { }
+		array_view(T* data, size_t size) : _data(data), _size(size) { }
+		// Весь массив
+		template<typename U, typename = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+		array_view(const shared_array<U>& array) : _data(array.get()), _size(array.size()) { }
+		// Весь вектор
+		template<typename U, typename A, typename = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+		array_view(std::vector<U, A>& vec) : _data(vec.data()), _size(vec.size()) { }
+		template<typename U, typename A, typename = typename std::enable_if<std::is_convertible<const U*, T*>::value>::type>
+		array_view(const std::vector<U, A>& vec) : _data(vec.data()), _size(vec.size()) { }
+		// Участок только для чтения
+		template<typename U, typename = typename std::enable_if<std::is_convertible<U*, T*>::value>::type>
+		array_view(const array_view<U>& other) : _data(other.get()), _size(other.size()) { }
+
+	public:
+		// Указатель на данные
+		T* get() const { return _data; }
+		// Кол-во элементов
+		size_t size() const { return _size; }
+		bool empty() const { return _size == 0; }
+		T& operator[](size_t i) const { return _data[i]; }
+		T* begin() const { return _data; }
+		T* end() const { return _data + _size; }
+
+		// Участок [from, from + count)
+		array_view subview(size_t from, size_t count) const { return array_view(_data + from, count); }
+		// Первые count элементов
+		array_view first(size_t count) const { return array_view(_data, count); }
+		// Элементы начиная с from
+		array_view from(size_t from) const { return array_view(_data + from, _size - from); }
+	};
+
+	// Участок массива
+	template<typename T>
+	array_view<T> view(const shared_array<T>& array, size_t from, size_t count) {
+		return array_view<T>(array.get() + from, count);
+	}
+}
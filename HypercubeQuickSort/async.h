@@ -0,0 +1,290 @@
+﻿#pragma once
+#include <algorithm>
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "mpiext.h"
+#include "parallel.h"
+#include "shared_array.h"
+
+namespace mpi {
+	using std::vector;
+
+	// Кто продвигает асинхронную сортировку
+	enum class progress {
+		caller,  // Вызовы test() и wait()
+		thread   // Отдельный поток; нужен MPI_THREAD_MULTIPLE,
+		         // иначе продвигает вызывающий
+	};
+
+	///<summary>
+	/// Асинхронная сортировка массива корневого процесса.
+	/// Рассылка и сбор идут через MPI_Iscatterv/MPI_Igatherv, опорный
+	/// элемент - через MPI_Ibcast в подкубе, баланс равных - через
+	/// MPI_Iallgather, обмен с соседом - через MPI_Isend/MPI_Irecv.
+	/// Локальные сортировка и слияние выполняются внутри test().
+	/// Пока сортировка не завершена, экземпляр sorter занят ею
+	///</summary>
+	template<typename T> class sort_handle {
+	private:
+		// Этап, чьи запросы сейчас в полёте
+		enum class stage { scatter, pivot, balance, header, data, counts, gather, done };
+
+		struct state {
+			sorter<T>& owner;
+			shared_array<T>& data;
+			stage current;
+			int round;                      // Текущее измерение
+			vector<MPI_Request> requests;
+			T pivot;
+			long long local[3];             // {меньше, равно, размер}
+			vector<long long> counts;       // Тройки всех процессов подкуба
+			int outHead, inHead;            // Размеры отдаваемой и принятой частей
+			size_t split;
+			int sliceCount;
+			vector<int> gathered;           // Размеры слайсов на корне
+			double started;
+			std::mutex lock;
+			std::atomic<bool> finished;
+			std::thread worker;
+
+			state(sorter<T>& owner, shared_array<T>& data)
+				: owner(owner), data(data), current(stage::scatter), round(0), pivot{},
+				  outHead(0), inHead(0), split(0), sliceCount(0), started(MPI_Wtime()), finished(false)
+			{ }
+		};
+
+		std::shared_ptr<state> _state;
+
+	public:
+		///<summary>
+		/// Запуск сортировки (коллективно). Размер data одинаков
+		/// на всех процессах, результат появится в data корневого
+		///</summary>
+		sort_handle(sorter<T>& owner, shared_array<T>& data, progress mode = progress::caller)
+			: _state(std::make_shared<state>(owner, data))
+		{
+			start(*_state);
+			int provided = MPI_THREAD_SINGLE;
+			MPI_Query_thread(&provided);
+			if (mode == progress::thread && provided == MPI_THREAD_MULTIPLE) {
+				auto shared = _state;
+				_state->worker = std::thread([shared] {
+					while (!advance(*shared))
+						std::this_thread::yield();
+				});
+			}
+		}
+
+		sort_handle(sort_handle&&) = default;
+		sort_handle& operator=(sort_handle&&) = default;
+
+		~sort_handle() {
+			if (_state)
+				wait();
+		}
+
+		///<summary>
+		/// Продвигает сортировку, не блокируясь. true - сортировка завершена
+		///</summary>
+		bool test() {
+			if (_state->finished)
+				return true;
+			// Поток прогресса справляется сам
+			if (_state->worker.joinable())
+				return false;
+			return advance(*_state);
+		}
+
+		///<summary>
+		/// Ждёт завершения сортировки
+		///</summary>
+		void wait() {
+			if (_state->worker.joinable()) {
+				_state->worker.join();
+				return;
+			}
+			while (!advance(*_state)) { }
+		}
+
+	private:
+		///<summary>
+		/// Рассылка слайсов
+		///</summary>
+		static void start(state& s) {
+			auto& o = s.owner;
+			auto& data = s.data;
+			o.plan_groups(data);
+			auto& displs = o._collective.displs;
+			displs.assign(o._size, 0);
+			for (auto pe = 1; pe < o._size; pe++)
+				displs[pe] = displs[pe - 1] + o._groups[pe - 1];
+			o.count(o._slice.fit(o._groups[o._rank]));
+			s.requests.assign(1, MPI_REQUEST_NULL);
+			MPI_Iscatterv(data.get(), o._groups.data(), displs.data(), get_mpi_datatype<T>(),
+				o._slice.get(), o._groups[o._rank], get_mpi_datatype<T>(), 0, o._comm, &s.requests[0]);
+		}
+
+		///<summary>
+		/// Проверяет запросы этапа и, если они завершены, выполняет
+		/// локальную работу и запускает следующий этап
+		///</summary>
+		static bool advance(state& s) {
+			std::lock_guard<std::mutex> guard(s.lock);
+			while (!s.finished) {
+				int complete = 1;
+				if (!s.requests.empty())
+					MPI_Testall(static_cast<int>(s.requests.size()), s.requests.data(), &complete, MPI_STATUSES_IGNORE);
+				if (!complete)
+					return false;
+				s.requests.clear();
+				next(s);
+			}
+			return true;
+		}
+
+		static void next(state& s) {
+			auto& o = s.owner;
+			auto& slice = o._slice;
+			auto type = get_mpi_datatype<T>();
+			switch (s.current) {
+			case stage::scatter: {
+				auto computed = MPI_Wtime();
+				simd::sort(slice.get(), slice.get() + slice.size());
+				o.compact(slice);
+				o._stats.compute_seconds += MPI_Wtime() - computed;
+				s.round = o._dim;
+				if (s.round > 0)
+					post_pivot(s);
+				else
+					post_counts(s);
+				break;
+			}
+			case stage::pivot: {
+				// Разбиение по границам равных опорному
+				auto first = std::lower_bound(std::begin(slice), std::end(slice), s.pivot),
+					 last  = std::upper_bound(first, std::end(slice), s.pivot);
+				s.local[0] = first - std::begin(slice);
+				s.local[1] = last - first;
+				s.local[2] = static_cast<long long>(slice.size());
+				auto& r = o._rounds[s.round - 1];
+				s.counts.resize(3 * mpi::getSize(r.subcube));
+				s.requests.assign(1, MPI_REQUEST_NULL);
+				MPI_Iallgather(s.local, 3, MPI_LONG_LONG, s.counts.data(), 3, MPI_LONG_LONG, r.subcube, &s.requests[0]);
+				s.current = stage::balance;
+				break;
+			}
+			case stage::balance: {
+				auto& r = o._rounds[s.round - 1];
+				s.split = static_cast<size_t>(s.local[0]
+					+ sorter<T>::equal_share(s.counts, mpi::getRank(r.subcube), s.local[1], r.lower_share));
+				s.outHead = static_cast<int>(r.lower ? slice.size() - s.split : s.split);
+				s.requests.assign(2, MPI_REQUEST_NULL);
+				MPI_Irecv(&s.inHead, 1, MPI_INT, r.neighbor, 667, o._comm, &s.requests[0]);
+				MPI_Isend(&s.outHead, 1, MPI_INT, r.neighbor, 667, o._comm, &s.requests[1]);
+				s.current = stage::header;
+				break;
+			}
+			case stage::header: {
+				// Принятое ложится прямо в место слияния
+				auto& r = o._rounds[s.round - 1];
+				auto kept = r.lower ? s.split : slice.size() - s.split;
+				o.count(o._merged.fit(kept + s.inHead));
+				const T* outgoing = slice.get() + (r.lower ? s.split : 0);
+				s.requests.assign(2, MPI_REQUEST_NULL);
+				MPI_Irecv(o._merged.get() + (r.lower ? kept : 0), s.inHead, type, r.neighbor, 668, o._comm, &s.requests[0]);
+				MPI_Isend(const_cast<T*>(outgoing), s.outHead, type, r.neighbor, 668, o._comm, &s.requests[1]);
+				s.current = stage::data;
+				break;
+			}
+			case stage::data: {
+				auto& r = o._rounds[s.round - 1];
+				auto computed = MPI_Wtime();
+				array_view<const T> kept = r.lower
+					? array_view<const T>(slice.get(), s.split)
+					: array_view<const T>(slice.get() + s.split, slice.size() - s.split);
+				sorter<T>::merge(kept, o._merged, !r.lower);
+				slice.swap(o._merged);
+				o.compact(slice);
+				o._stats.compute_seconds += MPI_Wtime() - computed;
+				o._stats.last_slice = slice.size();
+				if (--s.round > 0)
+					post_pivot(s);
+				else
+					post_counts(s);
+				break;
+			}
+			case stage::counts: {
+				if (o._rank == 0) {
+					auto& displs = o._collective.displs;
+					displs.assign(o._size, 0);
+					for (auto pe = 1; pe < o._size; pe++)
+						displs[pe] = displs[pe - 1] + s.gathered[pe - 1];
+					o.count(s.data.fit(displs[o._size - 1] + s.gathered[o._size - 1]));
+				}
+				s.requests.assign(1, MPI_REQUEST_NULL);
+				MPI_Igatherv(slice.get(), s.sliceCount, type, s.data.get(), s.gathered.data(),
+					o._collective.displs.data(), type, 0, o._comm, &s.requests[0]);
+				s.current = stage::gather;
+				break;
+			}
+			case stage::gather: {
+				o._stats.calls++;
+				o._stats.total_seconds += MPI_Wtime() - s.started;
+				s.current = stage::done;
+				s.finished = true;
+				break;
+			}
+			default:
+				break;
+			}
+		}
+
+		///<summary>
+		/// Рассылка опорного элемента по подкубу от его первого процесса
+		///</summary>
+		static void post_pivot(state& s) {
+			auto& o = s.owner;
+			auto& r = o._rounds[s.round - 1];
+			if (o._slice.size() != 0)
+				s.pivot = sorter<T>::select_pivot(o._slice, r.lower_share);
+			s.requests.assign(1, MPI_REQUEST_NULL);
+			MPI_Ibcast(&s.pivot, 1, get_mpi_datatype<T>(), 0, r.subcube, &s.requests[0]);
+			s.current = stage::pivot;
+		}
+
+		///<summary>
+		/// Сбор размеров слайсов на корне
+		///</summary>
+		static void post_counts(state& s) {
+			auto& o = s.owner;
+			s.sliceCount = static_cast<int>(o._slice.size());
+			s.gathered.assign(o._size, 0);
+			s.requests.assign(1, MPI_REQUEST_NULL);
+			MPI_Igather(&s.sliceCount, 1, MPI_INT, s.gathered.data(), 1, MPI_INT, 0, o._comm, &s.requests[0]);
+			s.current = stage::counts;
+		}
+
+	public:
+		sort_handle(const sort_handle&) = delete;
+		sort_handle& operator=(const sort_handle&) = delete;
+	};
+
+	///<summary>
+	/// Асинхронная сортировка массива корневого процесса экземпляром owner
+	///</summary>
+	template<typename T>
+	sort_handle<T> sort_async(sorter<T>& owner, shared_array<T>& data, progress mode = progress::caller) {
+		return sort_handle<T>(owner, data, mode);
+	}
+
+	///<summary>
+	/// Асинхронная сортировка массива корневого процесса общим экземпляром
+	///</summary>
+	template<typename T>
+	sort_handle<T> sort_async(shared_array<T>& data, progress mode = progress::caller) {
+		return sort_handle<T>(sorter<T>::shared_mapped(), data, mode);
+	}
+}
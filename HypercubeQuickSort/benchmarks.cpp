@@ -0,0 +1,351 @@
+﻿// Микробенчмарки ядер сортировки: каждое ядро отдельно, по размерам
+// и типам ключей. Отдельная программа со своим main, в основной сборке
+// не участвует:
+//   mpicxx -std=c++14 -O2 benchmarks.cpp random.cpp -o benchmarks
+//   mpiexec -n 2 ./benchmarks [--filter merge] [--repeat 15] [--save base.txt]
+//   mpiexec -n 2 ./benchmarks --baseline base.txt [--threshold 10]
+// Время ядра - медиана повторов (для обменов - по самому медленному
+// процессу), разброс - медианное абсолютное отклонение. Короткие ядра
+// повторяются внутри замера, пока он не займёт min_sample секунд.
+// С --baseline ядро считается замедлившимся, если медиана выросла больше
+// чем на threshold процентов и больше чем на два разброса; тогда код
+// возврата 1. Счётчики процессора печатаются, если доступен perf_event.
+// Локальные ядра меряются на процессе 0, обмены - на всех
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "parallel.h"
+#include "counters.h"
+#include "random.h"
+#include "simd.h"
+
+namespace mpi {
+	///<summary>
+	/// Доступ к закрытым ядрам сортировщика
+	///</summary>
+	class kernels {
+	public:
+		template<typename T>
+		static T select_pivot(const shared_array<T>& data) {
+			return sorter<T>::select_pivot(data);
+		}
+
+		template<typename T>
+		static size_t partition(T pivot, const shared_array<T>& data, MPI_Comm subcube) {
+			return sorter<T>::partition(pivot, data, subcube);
+		}
+
+		template<typename T>
+		static void merge(array_view<const T> kept, shared_array<T>& result, bool received_first) {
+			sorter<T>::merge(kept, result, received_first);
+		}
+
+		kernels() = delete;
+		kernels(const kernels&) = delete;
+	};
+}
+
+namespace {
+	using mpi::counters;
+
+	// Наименьшая длительность одного замера, с
+	const double min_sample = 2e-4;
+
+	struct options {
+		std::string filter, save, baseline;
+		int repeat = 11;
+		double threshold = 10;
+	};
+
+	struct sample {
+		std::string name;
+		double median, spread;   // Секунд на вызов
+		size_t items;            // Элементов за вызов
+		long long count[counters::kinds];
+		bool counted;
+	};
+
+	std::vector<sample> results;
+	// Результат, который компилятор не может выбросить
+	volatile long long sink = 0;
+
+	double median(std::vector<double> values) {
+		std::sort(values.begin(), values.end());
+		auto n = values.size();
+		return n % 2 ? values[n / 2] : (values[n / 2 - 1] + values[n / 2]) / 2;
+	}
+
+	template<typename T> const char* type_name();
+	template<> const char* type_name<int>() { return "int"; }
+	template<> const char* type_name<long long>() { return "int64"; }
+	template<> const char* type_name<double>() { return "double"; }
+
+	std::string label(const char* kernel, const char* type, size_t n) {
+		return std::string(kernel) + "/" + type + "/" + std::to_string(n);
+	}
+
+	///<summary>
+	/// Замер ядра body на процессах comm. setup готовит данные вне замера.
+	/// repeatable - ядро можно вызывать подряд без setup, тогда короткие
+	/// вызовы повторяются внутри замера
+	///</summary>
+	template<typename Setup, typename Body>
+	void measure(const options& o, const std::string& name, size_t items, MPI_Comm comm,
+		bool repeatable, Setup setup, Body body)
+	{
+		if (!o.filter.empty() && name.find(o.filter) == std::string::npos)
+			return;
+		counters cpu;
+		std::vector<double> times{};
+		std::vector<counters::values> counts{};
+		long long inner = 1;
+		// Нулевой повтор - прогрев и подбор числа вызовов
+		for (auto r = -1; r < o.repeat; r++) {
+			setup();
+			MPI_Barrier(comm);
+			cpu.start();
+			auto start = MPI_Wtime();
+			for (long long i = 0; i < inner; i++)
+				body();
+			auto elapsed = MPI_Wtime() - start;
+			auto c = cpu.stop();
+			// Обмен длится до самого медленного процесса
+			elapsed = mpi::allreduce(std::vector<double>{ elapsed }, MPI_MAX, comm)[0];
+			if (r < 0) {
+				if (repeatable && elapsed < min_sample)
+					inner = static_cast<long long>(std::ceil(min_sample / std::max(elapsed, 1e-9)));
+				continue;
+			}
+			times.push_back(elapsed / inner);
+			counts.push_back(c);
+		}
+		if (mpi::getRank(comm) != 0)
+			return;
+		sample s{};
+		s.name = name;
+		s.items = items;
+		s.median = median(times);
+		std::vector<double> deviations{};
+		for (auto t : times)
+			deviations.push_back(std::abs(t - s.median));
+		s.spread = median(deviations);
+		s.counted = !counts.empty() && counts[0].valid;
+		for (auto k = 0; k < counters::kinds && s.counted; k++) {
+			std::vector<double> values{};
+			for (const auto& c : counts)
+				values.push_back(static_cast<double>(c.count[k]) / inner);
+			s.count[k] = static_cast<long long>(median(values));
+		}
+		results.push_back(s);
+	}
+
+	///<summary>
+	/// Локальные ядра одного типа ключей: сортировка, опорный элемент,
+	/// разбиение, слияние, выделение массива
+	///</summary>
+	template<typename T>
+	void local_kernels(const options& o, size_t n)
+	{
+		auto type = type_name<T>();
+		mpi::shared_array<T> source(n), work(n), sorted(n);
+		for (size_t i = 0; i < n; i++)
+			source[i] = static_cast<T>(mpi::random::integer());
+		std::copy(std::begin(source), std::end(source), std::begin(sorted));
+		std::sort(std::begin(sorted), std::end(sorted));
+
+		measure(o, label("sort", type, n), n, MPI_COMM_SELF, false,
+			[&] { std::copy(std::begin(source), std::end(source), std::begin(work)); },
+			[&] { mpi::simd::sort(work.get(), work.get() + n); });
+
+		measure(o, label("select_pivot", type, n), 1, MPI_COMM_SELF, true, [] {},
+			[&] { sink += static_cast<long long>(mpi::kernels::select_pivot(sorted)); });
+
+		// Подкуб из одного процесса: меряется поиск границ без обмена
+		auto pivot = source[n / 3];
+		measure(o, label("partition", type, n), 1, MPI_COMM_SELF, true, [] {},
+			[&] { sink += static_cast<long long>(mpi::kernels::partition(pivot, sorted, MPI_COMM_SELF)); });
+
+		// Оставленная половина - чётные элементы, принятая - нечётные
+		std::vector<T> kept(n / 2), received(n - n / 2);
+		for (size_t i = 0; i < n; i++)
+			(i % 2 ? received[i / 2] : kept[i / 2]) = sorted[i];
+		mpi::shared_array<T> merged(n);
+		measure(o, label("merge", type, n), n, MPI_COMM_SELF, false,
+			[&] { std::copy(received.begin(), received.end(), merged.get() + kept.size()); },
+			[&] { mpi::kernels::merge(mpi::array_view<const T>(kept), merged, false); });
+
+		measure(o, label("alloc", type, n), n, MPI_COMM_SELF, true, [] {},
+			[&] {
+				mpi::shared_array<T> fresh(n);
+				sink += static_cast<long long>(fresh[n - 1]);
+			});
+	}
+
+	///<summary>
+	/// Обёртки обменов mpiext.h на всех процессах
+	///</summary>
+	template<typename T>
+	void exchange_kernels(const options& o, size_t n)
+	{
+		auto type = type_name<T>();
+		auto rank = mpi::getRank(MPI_COMM_WORLD),
+			 size = mpi::getSize(MPI_COMM_WORLD);
+		mpi::shared_array<T> slice(n), into{};
+		for (size_t i = 0; i < n; i++)
+			slice[i] = static_cast<T>(mpi::random::integer());
+
+		// Пары соседей, как на итерации гиперкуба
+		auto partner = rank ^ 1;
+		if (size % 2 == 0) {
+			mpi::exchange_buffers buffers{};
+			measure(o, label("sendreceive", type, n), n, MPI_COMM_WORLD, true, [] {},
+				[&] { mpi::sendreceive(slice.get(), static_cast<int>(n), into, partner, partner, 700,
+						mpi::wire_mode::raw, buffers); });
+		}
+
+		mpi::collective_buffers buffers{};
+		mpi::shared_array<T> whole(rank == 0 ? n * size : 0);
+		std::vector<int> counts(size, static_cast<int>(n));
+		measure(o, label("scatter", type, n), n * size, MPI_COMM_WORLD, true, [] {},
+			[&] { mpi::scatter(whole.get(), whole.size(), counts, into, 0, buffers); });
+		measure(o, label("gather", type, n), n * size, MPI_COMM_WORLD, true, [] {},
+			[&] { mpi::gather(slice.get(), static_cast<int>(n), whole, 0, buffers); });
+	}
+
+	template<typename T>
+	void run_type(const options& o, const std::vector<size_t>& sizes)
+	{
+		for (auto n : sizes) {
+			if (mpi::getRank(MPI_COMM_WORLD) == 0)
+				local_kernels<T>(o, n);
+			MPI_Barrier(MPI_COMM_WORLD);
+			exchange_kernels<T>(o, n);
+		}
+	}
+
+	///<summary>
+	/// Базовые медианы: строка "ядро медиана разброс"
+	///</summary>
+	std::map<std::string, std::pair<double, double>> load(const std::string& path)
+	{
+		std::map<std::string, std::pair<double, double>> base{};
+		std::ifstream in(path);
+		std::string line;
+		while (std::getline(in, line)) {
+			std::istringstream fields(line);
+			std::string name;
+			double value = 0, spread = 0;
+			if (line.empty() || line[0] == '#' || !(fields >> name >> value >> spread))
+				continue;
+			base[name] = { value, spread };
+		}
+		return base;
+	}
+
+	void save(const std::string& path)
+	{
+		std::ofstream out(path);
+		out << "# kernel median_seconds spread_seconds\n";
+		char line[256];
+		for (const auto& s : results) {
+			std::snprintf(line, sizeof(line), "%s %.9e %.9e\n", s.name.c_str(), s.median, s.spread);
+			out << line;
+		}
+	}
+
+	///<summary>
+	/// Таблица результатов и сравнение с базой.
+	/// Возвращает число замедлившихся ядер
+	///</summary>
+	int report(const options& o)
+	{
+		auto base = o.baseline.empty() ? std::map<std::string, std::pair<double, double>>{} : load(o.baseline);
+		auto counted = std::any_of(results.begin(), results.end(), [](const sample& s) { return s.counted; });
+		std::printf("%-28s %12s %8s %10s", "kernel", "median, us", "spread", "Mitems/s");
+		if (counted)
+			std::printf(" %6s %11s %11s", "ipc", "cmiss/item", "bmiss/item");
+		if (!base.empty())
+			std::printf(" %9s", "vs base");
+		std::printf("\n");
+		auto regressions = 0;
+		for (const auto& s : results) {
+			std::printf("%-28s %12.3f %7.1f%% %10.1f", s.name.c_str(), s.median * 1e6,
+				s.median > 0 ? 100 * s.spread / s.median : 0.0, s.median > 0 ? s.items / s.median / 1e6 : 0.0);
+			if (counted && s.counted) {
+				auto items = static_cast<double>(std::max<size_t>(s.items, 1));
+				std::printf(" %6.2f %11.4f %11.4f",
+					s.count[counters::cycles] ? static_cast<double>(s.count[counters::instructions]) / s.count[counters::cycles] : 0.0,
+					s.count[counters::cache_misses] / items, s.count[counters::branch_misses] / items);
+			} else if (counted) {
+				std::printf(" %6s %11s %11s", "-", "-", "-");
+			}
+			auto found = base.find(s.name);
+			if (found != base.end() && found->second.first > 0) {
+				auto before = found->second.first,
+					 change = 100 * (s.median / before - 1);
+				// Порог и шум: разброс текущего и базового замеров
+				auto noise = 2 * std::max(s.spread, found->second.second);
+				auto slower = change > o.threshold && s.median - before > noise;
+				std::printf(" %+8.1f%%%s", change, slower ? "  REGRESSION" : "");
+				regressions += slower;
+			}
+			std::printf("\n");
+		}
+		if (!counted)
+			std::printf("(CPU counters unavailable: perf_event is not accessible)\n");
+		if (!base.empty())
+			std::printf("%d regression(s) above %.1f%% against %s\n", regressions, o.threshold, o.baseline.c_str());
+		return regressions;
+	}
+
+	options parse(int argc, char** argv)
+	{
+		options o{};
+		for (auto i = 1; i < argc; i++) {
+			std::string arg = argv[i];
+			auto value = [&]() { return i + 1 < argc ? std::string(argv[++i]) : std::string(); };
+			if (arg == "--filter")
+				o.filter = value();
+			else if (arg == "--repeat")
+				o.repeat = std::max(1, std::atoi(value().c_str()));
+			else if (arg == "--save")
+				o.save = value();
+			else if (arg == "--baseline")
+				o.baseline = value();
+			else if (arg == "--threshold")
+				o.threshold = std::atof(value().c_str());
+		}
+		return o;
+	}
+}
+
+int main(int argc, char** argv)
+{
+	mpi::init(&argc, &argv);
+	auto rank = mpi::getRank(MPI_COMM_WORLD);
+	auto o = parse(argc, argv);
+	std::vector<size_t> sizes{ 1 << 10, 1 << 14, 1 << 18 };
+
+	run_type<int>(o, sizes);
+	run_type<long long>(o, sizes);
+	run_type<double>(o, sizes);
+
+	int regressions = 0;
+	if (rank == 0) {
+		std::printf("%d process(es), %d repetitions, simd %s\n", mpi::getSize(MPI_COMM_WORLD), o.repeat,
+			mpi::simd::enabled() ? "on" : "off");
+		regressions = report(o);
+		if (!o.save.empty())
+			save(o.save);
+	}
+	MPI_Bcast(&regressions, 1, MPI_INT, 0, MPI_COMM_WORLD);
+	mpi::finalize();
+	return regressions > 0 ? 1 : 0;
+}
@@ -0,0 +1,314 @@
+﻿#pragma once
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+namespace mpi {
+namespace codec {
+
+	///<summary>
+	/// Преобразование значения в беззнаковый ключ
+	/// с сохранением порядка сравнения
+	///</summary>
+	template<typename T, typename Enable = void>
+	struct ordered_key {
+		static constexpr bool supported = false;
+	};
+
+	// Целые числа: у знаковых инвертируем старший бит
+	template<typename T>
+	struct ordered_key<T, typename std::enable_if<std::is_integral<T>::value && !std::is_same<T, bool>::value>::type> {
+		static constexpr bool supported = true;
+		typedef typename std::make_unsigned<T>::type type;
+		static constexpr type sign = std::is_signed<T>::value
+			? static_cast<type>(type(1) << (sizeof(type) * 8 - 1)) : type(0);
+
+		static type encode(T value) { return static_cast<type>(value) ^ sign; }
+		static T decode(type key) { return static_cast<T>(key ^ sign); }
+	};
+
+	// Числа с плавающей точкой: у отрицательных инвертируем
+	// все биты, у положительных - только знаковый
+	template<typename T>
+	struct ordered_key<T, typename std::enable_if<std::is_floating_point<T>::value && (sizeof(T) == 4 || sizeof(T) == 8)>::type> {
+		static constexpr bool supported = true;
+		typedef typename std::conditional<sizeof(T) == 4, std::uint32_t, std::uint64_t>::type type;
+		static constexpr type sign = static_cast<type>(type(1) << (sizeof(type) * 8 - 1));
+
+		static type encode(T value) {
+			type bits;
+			std::memcpy(&bits, &value, sizeof(T));
+			return (bits & sign) ? ~bits : (bits | sign);
+		}
+		static T decode(type key) {
+			type bits = (key & sign) ? (key ^ sign) : ~key;
+			T value;
+			std::memcpy(&value, &bits, sizeof(T));
+			return value;
+		}
+	};
+
+	///<summary>
+	/// Запись значений переменной ширины в байтовый поток
+	///</summary>
+	class bit_writer {
+	private:
+		unsigned char* _out;
+		std::uint64_t _acc;
+		unsigned _filled;
+	public:
+		explicit bit_writer(unsigned char* out) : _out(out), _acc(0), _filled(0) { }
+		// Указатель на следующий свободный байт
+		unsigned char* position() const { return _out; }
+		// Записывает младшие width бит значения
+		void put(std::uint64_t value, unsigned width) {
+			if (width == 0)
+				return;
+			if (width > 32) {
+				put(value & 0xffffffffu, 32);
+				put(value >> 32, width - 32);
+				return;
+			}
+			_acc |= value << _filled;
+			_filled += width;
+			while (_filled >= 8) {
+				*_out++ = static_cast<unsigned char>(_acc);
+				_acc >>= 8;
+				_filled -= 8;
+			}
+		}
+		// Дописывает неполный байт
+		void flush() {
+			if (_filled > 0)
+				*_out++ = static_cast<unsigned char>(_acc);
+			_acc = 0;
+			_filled = 0;
+		}
+	};
+
+	///<summary>
+	/// Чтение значений переменной ширины из байтового потока
+	///</summary>
+	class bit_reader {
+	private:
+		const unsigned char* _in;
+		std::uint64_t _acc;
+		unsigned _avail;
+	public:
+		explicit bit_reader(const unsigned char* in) : _in(in), _acc(0), _avail(0) { }
+		// Читает width бит
+		std::uint64_t get(unsigned width) {
+			if (width == 0)
+				return 0;
+			if (width > 32) {
+				auto low = get(32);
+				return low | (get(width - 32) << 32);
+			}
+			while (_avail < width) {
+				_acc |= static_cast<std::uint64_t>(*_in++) << _avail;
+				_avail += 8;
+			}
+			auto value = _acc & ((std::uint64_t(1) << width) - 1);
+			_acc >>= width;
+			_avail -= width;
+			return value;
+		}
+	};
+
+	///<summary>
+	/// Дельта-кодирование с упаковкой бит блоками.
+	/// Формат: первый ключ как есть, затем для каждого блока
+	/// заголовок из одного байта (ширина в битах) и упакованные
+	/// zigzag-разности соседних ключей, в конце - padding нулевых
+	/// байт, чтобы распаковка могла читать 64-битными словами.
+	/// Для отсортированных данных разности малы и ширина блока невелика
+	///</summary>
+	template<typename T, bool Supported = ordered_key<T>::supported>
+	class delta_codec {
+	public:
+		static constexpr bool supported = false;
+		static size_t max_size(size_t) { return 0; }
+		static size_t encoded_size(const T*, size_t) { return 0; }
+		static size_t estimate_size(const T*, size_t) { return 0; }
+		static std::vector<unsigned char> encode(const T*, size_t) { return {}; }
+		static void encode(const T*, size_t, std::vector<unsigned char>&) { }
+		static void decode(const unsigned char*, size_t, T*) { }
+	};
+
+	template<typename T>
+	class delta_codec<T, true> {
+	private:
+		typedef ordered_key<T> key;
+		typedef typename key::type U;
+		static constexpr unsigned bits = sizeof(U) * 8;
+	public:
+		static constexpr bool supported = true;
+		// Кол-во элементов в блоке с общей шириной
+		static constexpr size_t block = 128;
+		// Нулевые байты в конце потока
+		static constexpr size_t padding = 8;
+
+	private:
+		static U zigzag(U delta) {
+			return static_cast<U>((delta << 1) ^ (0 - (delta >> (bits - 1))));
+		}
+		static U unzigzag(U value) {
+			return static_cast<U>((value >> 1) ^ (0 - (value & 1)));
+		}
+		static unsigned width(U value) {
+			unsigned w = 0;
+			while (value) { w++; value >>= 1; }
+			return w;
+		}
+		static size_t block_bytes(unsigned w, size_t len) {
+			return (w * len + 7) / 8;
+		}
+
+		///<summary>
+		/// Разности блока длины len, начиная с from. Три прохода
+		/// (ключи, разности, ширина) не зависят от предыдущих итераций
+		/// и векторизуются компилятором
+		///</summary>
+		static U deltas(const T* data, size_t from, size_t len, U* keys, U* out) {
+			for (size_t i = 0; i < len; i++)
+				keys[i] = key::encode(data[from + i]);
+			U prev = key::encode(data[from == 0 ? 0 : from - 1]);
+			out[0] = zigzag(static_cast<U>(keys[0] - prev));
+			for (size_t i = 1; i < len; i++)
+				out[i] = zigzag(static_cast<U>(keys[i] - keys[i - 1]));
+			U acc = 0;
+			for (size_t i = 0; i < len; i++)
+				acc |= out[i];
+			return acc;
+		}
+
+		///<summary>
+		/// Распаковка блока фиксированной ширины w <= 56. Каждое значение
+		/// читается своим 64-битным словом независимо от соседних,
+		/// без ветвлений внутри цикла
+		///</summary>
+		static void unpack(const unsigned char* in, unsigned w, size_t len, U* out) {
+			const std::uint64_t mask = (std::uint64_t(1) << w) - 1;
+			for (size_t i = 0; i < len; i++) {
+				size_t bit = i * w;
+				std::uint64_t word;
+				std::memcpy(&word, in + (bit >> 3), sizeof(word));
+				out[i] = static_cast<U>((word >> (bit & 7)) & mask);
+			}
+		}
+
+	public:
+		///<summary>
+		/// Максимальный размер кодированных данных
+		///</summary>
+		static size_t max_size(size_t count) {
+			if (count == 0)
+				return 0;
+			auto blocks = (count + block - 1) / block;
+			return sizeof(U) + blocks + block_bytes(bits, count) + blocks + padding;
+		}
+
+		///<summary>
+		/// Точный размер закодированных данных в байтах
+		///</summary>
+		static size_t encoded_size(const T* data, size_t count) {
+			if (count == 0)
+				return 0;
+			U keys[block], out[block];
+			size_t total = sizeof(U) + padding;
+			for (size_t from = 0; from < count; from += block) {
+				size_t len = count - from < block ? count - from : block;
+				auto w = width(deltas(data, from, len, keys, out));
+				total += 1 + block_bytes(w, len);
+			}
+			return total;
+		}
+
+		///<summary>
+		/// Оценка размера по нескольким равномерно взятым блокам.
+		/// Стоит не больше samples блоков независимо от объёма данных
+		///</summary>
+		static size_t estimate_size(const T* data, size_t count, size_t samples = 8) {
+			auto blocks = (count + block - 1) / block;
+			if (blocks <= samples)
+				return encoded_size(data, count);
+			U keys[block], out[block];
+			size_t sampled = 0;
+			for (size_t k = 0; k < samples; k++) {
+				auto from = (blocks * k / samples) * block;
+				size_t len = count - from < block ? count - from : block;
+				auto w = width(deltas(data, from, len, keys, out));
+				sampled += 1 + block_bytes(w, block);
+			}
+			return sizeof(U) + padding + sampled * blocks / samples;
+		}
+
+		///<summary>
+		/// Кодирование count элементов
+		///</summary>
+		static std::vector<unsigned char> encode(const T* data, size_t count) {
+			std::vector<unsigned char> result;
+			encode(data, count, result);
+			return result;
+		}
+
+		///<summary>
+		/// Кодирование count элементов в переданный буфер за один проход.
+		/// Буфер берётся по максимальному размеру и затем укорачивается
+		///</summary>
+		static void encode(const T* data, size_t count, std::vector<unsigned char>& result) {
+			result.resize(max_size(count));
+			if (count == 0)
+				return;
+			U first = key::encode(data[0]);
+			std::memcpy(result.data(), &first, sizeof(U));
+			U keys[block], out[block];
+			bit_writer writer(result.data() + sizeof(U));
+			for (size_t from = 0; from < count; from += block) {
+				size_t len = count - from < block ? count - from : block;
+				auto w = width(deltas(data, from, len, keys, out));
+				writer.put(w, 8);
+				for (size_t i = 0; i < len; i++)
+					writer.put(out[i], w);
+				writer.flush();
+			}
+			auto end = writer.position();
+			std::memset(end, 0, padding);
+			result.resize(end - result.data() + padding);
+		}
+
+		///<summary>
+		/// Декодирование count элементов в result. Префиксная сумма
+		/// разностей последовательна и остаётся скалярной
+		///</summary>
+		static void decode(const unsigned char* in, size_t count, T* result) {
+			if (count == 0)
+				return;
+			U prev;
+			std::memcpy(&prev, in, sizeof(U));
+			U keys[block];
+			in += sizeof(U);
+			for (size_t from = 0; from < count; from += block) {
+				size_t len = count - from < block ? count - from : block;
+				unsigned w = *in++;
+				if (w <= 56) {
+					unpack(in, w, len, keys);
+				} else {
+					bit_reader reader(in);
+					for (size_t i = 0; i < len; i++)
+						keys[i] = static_cast<U>(reader.get(w));
+				}
+				in += block_bytes(w, len);
+				for (size_t i = 0; i < len; i++)
+					keys[i] = unzigzag(keys[i]);
+				// Префиксная сумма разностей
+				for (size_t i = 0; i < len; i++)
+					keys[i] = prev = static_cast<U>(prev + keys[i]);
+				for (size_t i = 0; i < len; i++)
+					result[from + i] = key::decode(keys[i]);
+			}
+		}
+	};
+}
+}
@@ -0,0 +1,117 @@
+﻿#pragma once
+#include <cstring>
+#include <cstdint>
+#ifdef __linux__
+	#include <linux/perf_event.h>
+	#include <sys/ioctl.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+#endif
+
+namespace mpi {
+
+	///<summary>
+	/// Аппаратные счётчики процессора текущего потока (perf_event в Linux).
+	/// Счётчики открываются одной группой и читаются разом. Если perf_event
+	/// недоступен (другая ОС, perf_event_paranoid, виртуальная машина),
+	/// available() ложно, а замеры возвращают нули
+	///</summary>
+	class counters
+	{
+	public:
+		enum kind { cycles, instructions, cache_misses, branch_misses, kinds };
+
+		struct values {
+			long long count[kinds];
+			bool valid;
+		};
+
+		static const char* name(int k) {
+			static const char* names[kinds] = { "cycles", "instructions", "cache-misses", "branch-misses" };
+			return names[k];
+		}
+
+	private:
+		int _fd[kinds];
+
+	public:
+		counters() {
+			for (auto k = 0; k < kinds; k++)
+				_fd[k] = -1;
+#ifdef __linux__
+			static const unsigned long long configs[kinds] = {
+				PERF_COUNT_HW_CPU_CYCLES, PERF_COUNT_HW_INSTRUCTIONS,
+				PERF_COUNT_HW_CACHE_MISSES, PERF_COUNT_HW_BRANCH_MISSES
+			};
+			for (auto k = 0; k < kinds; k++) {
+				perf_event_attr attr;
+				std::memset(&attr, 0, sizeof(attr));
+				attr.size = sizeof(attr);
+				attr.type = PERF_TYPE_HARDWARE;
+				attr.config = configs[k];
+				attr.read_format = PERF_FORMAT_GROUP;
+				// Только пользовательский режим: доступно при perf_event_paranoid <= 2
+				attr.exclude_kernel = 1;
+				attr.exclude_hv = 1;
+				attr.disabled = k == 0;
+				_fd[k] = static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, k == 0 ? -1 : _fd[0], 0));
+				if (_fd[k] < 0) {
+					close_all();
+					return;
+				}
+			}
+#endif
+		}
+
+		~counters() { close_all(); }
+
+		bool available() const { return _fd[0] >= 0; }
+
+		///<summary>
+		/// Обнуление и запуск группы
+		///</summary>
+		void start() {
+#ifdef __linux__
+			if (!available())
+				return;
+			ioctl(_fd[0], PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+			ioctl(_fd[0], PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+#endif
+		}
+
+		///<summary>
+		/// Остановка группы и значения с последнего start()
+		///</summary>
+		values stop() {
+			values result{};
+#ifdef __linux__
+			if (!available())
+				return result;
+			ioctl(_fd[0], PERF_EVENT_IOC_DISABLE, PERF_IOC_FLAG_GROUP);
+			// Формат группы: число счётчиков, затем значения по порядку открытия
+			uint64_t buffer[1 + kinds];
+			if (read(_fd[0], buffer, sizeof(buffer)) != static_cast<ssize_t>(sizeof(buffer)) || buffer[0] != kinds)
+				return result;
+			for (auto k = 0; k < kinds; k++)
+				result.count[k] = static_cast<long long>(buffer[1 + k]);
+			result.valid = true;
+#endif
+			return result;
+		}
+
+	private:
+		void close_all() {
+#ifdef __linux__
+			for (auto k = kinds - 1; k >= 0; k--) {
+				if (_fd[k] >= 0)
+					close(_fd[k]);
+				_fd[k] = -1;
+			}
+#endif
+		}
+
+	public:
+		counters(const counters&) = delete;
+		counters& operator=(const counters&) = delete;
+	};
+}
@@ -0,0 +1,177 @@
+﻿#pragma once
+#include <algorithm>
+#include <memory>
+#include <vector>
+#include "mpiext.h"
+#include "parallel.h"
+#include "shared_array.h"
+#include "topology.h"
+
+namespace mpi {
+	using std::vector;
+
+	///<summary>
+	/// Окно разделяемой памяти узла (MPI_Win_allocate_shared).
+	/// Каждый процесс узла владеет своим сегментом, но читает
+	/// и пишет сегменты соседей напрямую, без пересылок
+	///</summary>
+	template<typename T> class shared_window {
+	private:
+		MPI_Win _win;
+		MPI_Comm _node;
+		vector<T*> _segments;
+		vector<size_t> _sizes;
+
+	public:
+		///<summary>
+		/// Коллективно для всех процессов узла
+		///</summary>
+		shared_window(size_t count, MPI_Comm node) : _node(node) {
+			T* base = nullptr;
+			MPI_Win_allocate_shared(count * sizeof(T), sizeof(T), MPI_INFO_NULL, node, &base, &_win);
+			// Пассивная эпоха на всё время жизни окна, синхронизация через sync()
+			MPI_Win_lock_all(MPI_MODE_NOCHECK, _win);
+			auto size = mpi::getSize(node);
+			_segments.resize(size);
+			_sizes.resize(size);
+			for (auto pe = 0; pe < size; pe++) {
+				MPI_Aint bytes;
+				int unit;
+				MPI_Win_shared_query(_win, pe, &bytes, &unit, &_segments[pe]);
+				_sizes[pe] = bytes / sizeof(T);
+			}
+		}
+
+		~shared_window() {
+			MPI_Win_unlock_all(_win);
+			MPI_Win_free(&_win);
+		}
+
+		// Сегмент процесса узла
+		T* segment(int pe) const { return _segments[pe]; }
+		// Размер сегмента процесса узла
+		size_t size(int pe) const { return _sizes[pe]; }
+
+		///<summary>
+		/// Делает записи каждого процесса видимыми остальным
+		///</summary>
+		void sync() {
+			MPI_Win_sync(_win);
+			MPI_Barrier(_node);
+			MPI_Win_sync(_win);
+		}
+
+		shared_window(const shared_window&) = delete;
+		shared_window& operator=(const shared_window&) = delete;
+	};
+
+	///<summary>
+	/// Иерархическая сортировка: процессы одного узла обмениваются
+	/// данными через разделяемую память, а раунды гиперкуба
+	/// выполняют только лидеры узлов. Кол-во узлов - степень двойки.
+	/// Итоговые слайсы упорядочены по (рангу лидера, рангу в узле)
+	///</summary>
+	template<typename T> class hierarchical_sorter {
+	private:
+		MPI_Comm _node, _leaders;
+		int _nodeRank, _nodeSize;
+		// Гиперкуб лидеров, есть только у лидеров
+		std::unique_ptr<sorter<T>> _cube;
+
+	public:
+		///<summary>
+		/// ranksPerNode > 0 делит настоящий узел на виртуальные узлы
+		/// по ranksPerNode процессов, чтобы проверить режим на одной машине
+		///</summary>
+		explicit hierarchical_sorter(MPI_Comm comm = MPI_COMM_WORLD, int ranksPerNode = 0)
+		{
+			auto rank = mpi::getRank(comm);
+			_node = topology::node_comm(comm, ranksPerNode);
+			_nodeRank = mpi::getRank(_node);
+			_nodeSize = mpi::getSize(_node);
+			_leaders = mpi::splitComm(comm, _nodeRank == 0 ? 0 : MPI_UNDEFINED, rank);
+			if (_nodeRank == 0)
+				_cube.reset(new sorter<T>(_leaders));
+		}
+
+		~hierarchical_sorter() {
+			int finalized = 0;
+			MPI_Finalized(&finalized);
+			if (finalized)
+				return;
+			_cube.reset();
+			mpi::freeComm(_leaders);
+			mpi::freeComm(_node);
+		}
+
+		///<summary>
+		/// Сортировка распределенных данных
+		///</summary>
+		void run_slice(shared_array<T>& slice)
+		{
+			// Локальная сортировка идёт на всех процессах узла параллельно
+			simd::sort(slice.get(), slice.get() + slice.size());
+			shared_array<T> merged{};
+			{
+				// Слайсы узла в разделяемой памяти
+				shared_window<T> input(slice.size(), _node);
+				std::copy(std::begin(slice), std::end(slice), input.segment(_nodeRank));
+				input.sync();
+				// Лидер сливает отсортированные сегменты соседей, читая их напрямую
+				if (_nodeRank == 0)
+					merged = merge_segments(input);
+				input.sync();
+			}
+			// Раунды гиперкуба только между узлами
+			if (_nodeRank == 0)
+				_cube->run_slice(merged);
+			// Лидер выкладывает результат узла, процессы забирают свою часть
+			long long total = merged.size();
+			MPI_Bcast(&total, 1, MPI_LONG_LONG, 0, _node);
+			shared_window<T> output(_nodeRank == 0 ? total : 0, _node);
+			if (_nodeRank == 0)
+				std::copy(std::begin(merged), std::end(merged), output.segment(0));
+			output.sync();
+			auto from = total * _nodeRank / _nodeSize,
+				 to   = total * (_nodeRank + 1) / _nodeSize;
+			slice.fit(to - from);
+			std::copy(output.segment(0) + from, output.segment(0) + to, std::begin(slice));
+			output.sync();
+		}
+
+		// Коммуникатор процессов узла
+		MPI_Comm node() const { return _node; }
+		// Коммуникатор лидеров (MPI_COMM_NULL не у лидеров)
+		MPI_Comm leaders() const { return _leaders; }
+
+	private:
+		///<summary>
+		/// Попарное слияние отсортированных сегментов узла
+		///</summary>
+		shared_array<T> merge_segments(const shared_window<T>& input)
+		{
+			vector<vector<T>> runs{};
+			for (auto pe = 0; pe < _nodeSize; pe++)
+				runs.emplace_back(input.segment(pe), input.segment(pe) + input.size(pe));
+			while (runs.size() > 1) {
+				vector<vector<T>> next{};
+				for (size_t k = 0; k + 1 < runs.size(); k += 2) {
+					vector<T> run(runs[k].size() + runs[k + 1].size());
+					simd::merge(runs[k].data(), runs[k].size(), runs[k + 1].data(), runs[k + 1].size(), run.data());
+					next.push_back(std::move(run));
+				}
+				if (runs.size() % 2)
+					next.push_back(std::move(runs.back()));
+				runs.swap(next);
+			}
+			shared_array<T> result(runs.empty() ? 0 : runs[0].size(), allocation::uninitialized());
+			if (!runs.empty())
+				std::copy(runs[0].begin(), runs[0].end(), std::begin(result));
+			return result;
+		}
+
+	public:
+		hierarchical_sorter(const hierarchical_sorter&) = delete;
+		hierarchical_sorter& operator=(const hierarchical_sorter&) = delete;
+	};
+}
@@ -3,6 +3,7 @@
 #include "parallel.h"
 #include "pretty.hpp"
 #include <iostream>
+#include <string>
 #include "timer.h"
 #include "random.h"
 
@@ -29,14 +30,23 @@ void main(int argc, char** argv)
 			std::cout << "\nStarting sequential sort (std::sort)\n";
 	}
 
+	// --weighted: доли процессов по замеренной производительности
+	auto weighted = argc > 1 && std::string(argv[1]) == "--weighted";
 	if (size > 1) {
+		if (weighted)
+			mpi::sorter<int>::shared_mapped().calibrate();
 		with(mpi::mpi_timer<microseconds> timer(0))
 			mpi::sorter<int>::sort(data);
+		mpi::sorter<int>::shared_mapped().report(0);
+		if (weighted)
+			mpi::sorter<int>::shared_mapped().report_balance(0);
 	} else {
 		with(mpi_timer<microseconds> timer(0))
 			std::sort(std::begin(data), std::end(data));
 	}
 
+	mpi::wire::report(0);
+
 	if (rank == 0) {
 		std::cout << "[10 START]Sorted data: " << std::vector<int>(std::begin(data), std::begin(data) + 10) << std::endl;
 		std::cout << "[10 END] Sorted data: " << std::vector<int>(std::end(data) - 10, std::end(data)) << std::endl;
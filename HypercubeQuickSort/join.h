@@ -0,0 +1,289 @@
+﻿#pragma once
+#include <algorithm>
+#include <numeric>
+#include <vector>
+#include "mpiext.h"
+#include "shared_array.h"
+
+namespace mpi {
+	using std::vector;
+
+	///<summary>
+	/// Запись с ключом соединения. Сравнение только по ключу
+	///</summary>
+	template<typename K, typename V> struct keyed {
+		K key;
+		V value;
+
+		bool operator<(const keyed& other) const { return key < other.key; }
+	};
+
+	///<summary>
+	/// Строка результата соединения
+	///</summary>
+	template<typename K, typename A, typename B> struct joined {
+		K key;
+		A left;
+		B right;
+	};
+
+	namespace traits {
+		// Записи передаются непрерывным блоком байт
+		template<typename K, typename V>
+		struct mpi_type<keyed<K, V>> : std::true_type {
+			static MPI_Datatype get() {
+				static MPI_Datatype _type = [] {
+					MPI_Datatype type;
+					MPI_Type_contiguous(sizeof(keyed<K, V>), MPI_BYTE, &type);
+					MPI_Type_commit(&type);
+					return type;
+				}();
+				return _type;
+			}
+		};
+	}
+
+	///<summary>
+	/// Распределённое соединение слиянием двух наборов по ключу.
+	/// Разделители общие для обоих наборов: регулярная выборка
+	/// из отсортированных слайсов левого и правого наборов, один
+	/// MPI_Allgather, взвешенные квантили. Записи обоих наборов
+	/// уходят по одним и тем же разделителям (MPI_Alltoallv), так что
+	/// равные ключи оказываются на одном процессе, там - соединение слиянием.
+	/// Тяжёлый ключ (занимает несколько разделителей подряд) получает
+	/// несколько процессов: записи большей по выборке стороны делятся
+	/// между ними по кругу, меньшей - копируются каждому.
+	/// Результат остаётся распределённым и упорядоченным по ключу
+	///</summary>
+	template<typename K, typename A, typename B> class joiner {
+	public:
+		typedef keyed<K, A> left_type;
+		typedef keyed<K, B> right_type;
+		typedef joined<K, A, B> row;
+
+		struct statistics {
+			unsigned long long calls = 0;
+			unsigned long long sent_bytes = 0;    // Отправлено другим процессам
+			unsigned long long rows = 0;          // Строк результата на процессе
+			unsigned long long heavy_keys = 0;    // Тяжёлых ключей за последний вызов
+			double total_seconds = 0;
+			double transfer_seconds = 0;
+			double compute_seconds = 0;
+		};
+
+		// Выборка на процесс результата с каждого процесса и стороны
+		static const int oversampling = 16;
+
+	private:
+		// Процессы ключа: [first, first + width), split - сторона,
+		// записи которой делятся (0 - левая, 1 - правая)
+		struct route {
+			int first, width, split;
+		};
+
+		MPI_Comm _comm;
+		int _rank, _size;
+		vector<K> _splitters;
+		// Тяжёлые ключи и делимая сторона каждого
+		vector<K> _heavy;
+		vector<int> _heavySplit;
+		statistics _stats;
+
+	public:
+		explicit joiner(MPI_Comm comm = MPI_COMM_WORLD)
+			: _comm(comm), _rank(mpi::getRank(comm)), _size(mpi::getSize(comm))
+		{ }
+
+		const statistics& stats() const { return _stats; }
+
+		///<summary>
+		/// Внутреннее соединение (коллективно). Слайсы left и right
+		/// переупорядочиваются. Возвращает строки для ключей
+		/// диапазона текущего процесса
+		///</summary>
+		shared_array<row> run(shared_array<left_type>& left, shared_array<right_type>& right)
+		{
+			auto start = MPI_Wtime();
+			auto computed = MPI_Wtime();
+			std::sort(std::begin(left), std::end(left));
+			std::sort(std::begin(right), std::end(right));
+			_stats.compute_seconds += MPI_Wtime() - computed;
+
+			auto moved = MPI_Wtime();
+			select_splitters(left, right);
+			auto mineLeft = exchange(left, 0),
+				 mineRight = exchange(right, 1);
+			_stats.transfer_seconds += MPI_Wtime() - moved;
+
+			computed = MPI_Wtime();
+			std::sort(mineLeft.begin(), mineLeft.end());
+			std::sort(mineRight.begin(), mineRight.end());
+			auto rows = merge_join(mineLeft, mineRight);
+			_stats.compute_seconds += MPI_Wtime() - computed;
+
+			_stats.rows = rows.size();
+			_stats.calls++;
+			_stats.total_seconds += MPI_Wtime() - start;
+			return rows;
+		}
+
+	private:
+		///<summary>
+		/// Регулярная выборка отсортированного слайса: oversampling * p
+		/// ключей и вес "записей на ключ"
+		///</summary>
+		template<typename V>
+		vector<K> sample(const shared_array<keyed<K, V>>& data, double& weight) const
+		{
+			auto samples = oversampling * _size;
+			vector<K> keys(samples);
+			for (auto i = 0; i < samples && data.size() != 0; i++)
+				keys[i] = data[data.size() * (2 * i + 1) / (2 * samples)].key;
+			weight = static_cast<double>(data.size()) / samples;
+			return keys;
+		}
+
+		///<summary>
+		/// p - 1 общих разделителей по взвешенной выборке обоих
+		/// наборов и стороны деления тяжёлых ключей
+		///</summary>
+		void select_splitters(const shared_array<left_type>& left, const shared_array<right_type>& right)
+		{
+			auto samples = oversampling * _size;
+			double weights[2];
+			auto mine = sample(left, weights[0]);
+			auto other = sample(right, weights[1]);
+			mine.insert(mine.end(), other.begin(), other.end());
+			auto all = mpi::allgather(mine, _comm);
+			auto allWeights = mpi::allgather(vector<double>{ weights[0], weights[1] }, _comm);
+			// Образец i: процесс i / (2 s), сторона (i / s) % 2
+			auto weight = [&](size_t i) { return allWeights[2 * (i / (2 * samples)) + (i / samples) % 2]; };
+
+			vector<size_t> order(all.size());
+			std::iota(order.begin(), order.end(), 0);
+			std::sort(order.begin(), order.end(), [&all](size_t a, size_t b) { return all[a] < all[b]; });
+			double total = 0;
+			for (size_t i = 0; i < all.size(); i++)
+				total += weight(i);
+
+			_splitters.clear();
+			double seen = 0;
+			for (auto index : order) {
+				seen += weight(index);
+				while (static_cast<int>(_splitters.size()) < _size - 1 && seen >= total * (_splitters.size() + 1) / _size)
+					_splitters.push_back(all[index]);
+			}
+			while (static_cast<int>(_splitters.size()) < _size - 1)
+				_splitters.push_back(all.empty() ? K{} : all[order.back()]);
+
+			// Тяжёлые: ключ повторяется среди разделителей. Делится
+			// сторона, у которой в выборке больше записей с этим ключом
+			_heavy.clear();
+			_heavySplit.clear();
+			for (size_t j = 0; j + 1 < _splitters.size(); j++) {
+				auto& key = _splitters[j];
+				if (!same(key, _splitters[j + 1]) || (!_heavy.empty() && same(_heavy.back(), key)))
+					continue;
+				double sides[2] = { 0, 0 };
+				for (size_t i = 0; i < all.size(); i++)
+					if (same(all[i], key))
+						sides[(i / samples) % 2] += weight(i);
+				_heavy.push_back(key);
+				_heavySplit.push_back(sides[1] > sides[0] ? 1 : 0);
+			}
+			_stats.heavy_keys = _heavy.size();
+		}
+
+		///<summary>
+		/// Процессы, которым принадлежит ключ
+		///</summary>
+		route locate(const K& key) const
+		{
+			auto lo = static_cast<int>(std::lower_bound(_splitters.begin(), _splitters.end(), key) - _splitters.begin()),
+				 hi = static_cast<int>(std::upper_bound(_splitters.begin(), _splitters.end(), key) - _splitters.begin());
+			if (hi - lo < 2)
+				return { lo, 1, 0 };
+			auto heavy = std::lower_bound(_heavy.begin(), _heavy.end(), key) - _heavy.begin();
+			return { lo, hi - lo, _heavySplit[heavy] };
+		}
+
+		///<summary>
+		/// Процессы, которым уходит запись i стороны side с ключом key.
+		/// Деление тяжёлого ключа по кругу начинается со своего ранга,
+		/// чтобы процессы не нагружали одного получателя
+		///</summary>
+		template<typename F>
+		void destinations(const K& key, size_t i, int side, F&& to) const
+		{
+			auto r = locate(key);
+			if (r.width == 1)
+				to(r.first);
+			else if (r.split != side)
+				for (auto pe = r.first; pe < r.first + r.width; pe++)
+					to(pe);
+			else
+				to(r.first + static_cast<int>((i + _rank) % r.width));
+		}
+
+		///<summary>
+		/// Отправка записей стороны side процессам их ключей
+		///</summary>
+		template<typename V>
+		vector<keyed<K, V>> exchange(const shared_array<keyed<K, V>>& data, int side)
+		{
+			// Первый проход - счётчики, второй - раскладка по получателям
+			vector<int> sendcounts(_size, 0), recvcounts{};
+			for (size_t i = 0; i < data.size(); i++)
+				destinations(data[i].key, i, side, [&](int pe) { sendcounts[pe]++; });
+			vector<int> cursor(_size, 0);
+			for (auto pe = 1; pe < _size; pe++)
+				cursor[pe] = cursor[pe - 1] + sendcounts[pe - 1];
+			vector<keyed<K, V>> outgoing(cursor[_size - 1] + sendcounts[_size - 1]);
+			for (size_t i = 0; i < data.size(); i++)
+				destinations(data[i].key, i, side, [&](int pe) { outgoing[cursor[pe]++] = data[i]; });
+			for (auto pe = 0; pe < _size; pe++)
+				if (pe != _rank)
+					_stats.sent_bytes += sendcounts[pe] * sizeof(keyed<K, V>);
+			return mpi::alltoallv(outgoing, sendcounts, recvcounts, _comm);
+		}
+
+		///<summary>
+		/// Соединение слиянием отсортированных наборов:
+		/// для каждого общего ключа - все пары записей
+		///</summary>
+		shared_array<row> merge_join(const vector<left_type>& left, const vector<right_type>& right) const
+		{
+			vector<row> rows{};
+			size_t i = 0, j = 0;
+			while (i < left.size() && j < right.size()) {
+				if (left[i].key < right[j].key) {
+					i++;
+				} else if (right[j].key < left[i].key) {
+					j++;
+				} else {
+					auto leftEnd = i, rightEnd = j;
+					while (leftEnd < left.size() && same(left[leftEnd].key, left[i].key))
+						leftEnd++;
+					while (rightEnd < right.size() && same(right[rightEnd].key, right[j].key))
+						rightEnd++;
+					for (auto a = i; a < leftEnd; a++)
+						for (auto b = j; b < rightEnd; b++)
+							rows.push_back({ left[a].key, left[a].value, right[b].value });
+					i = leftEnd;
+					j = rightEnd;
+				}
+			}
+			shared_array<row> result(rows.size(), allocation::uninitialized());
+			std::copy(rows.begin(), rows.end(), std::begin(result));
+			return result;
+		}
+
+		static bool same(const K& a, const K& b) {
+			return !(a < b) && !(b < a);
+		}
+
+	public:
+		joiner(const joiner&) = delete;
+		joiner& operator=(const joiner&) = delete;
+	};
+}
@@ -0,0 +1,16 @@
+﻿#pragma once
+
+// Выбор реализации MPI. По умолчанию - библиотека MPI (<mpi.h>),
+// с MPIEXT_THREADS - ранги-потоки одного процесса (thread_mpi.h).
+// MPIEXT_RANK_LOCAL помечает статические данные, которые у каждого
+// ранга свои: при рангах-потоках они становятся thread_local
+#ifdef MPIEXT_THREADS
+#ifdef MPIEXT_TRACE
+#error "MPIEXT_TRACE needs separate processes and does not work with MPIEXT_THREADS"
+#endif
+#include "thread_mpi.h"
+#define MPIEXT_RANK_LOCAL thread_local
+#else
+#include <mpi.h>
+#define MPIEXT_RANK_LOCAL
+#endif
@@ -1,11 +1,15 @@
 ﻿#pragma once
 
 #include <type_traits>
-#include <mpi.h>
+#include "mpi_backend.h"
 #include <vector>
 #include <numeric>
 #include <iostream>
+#include <algorithm>
 #include "shared_array.h"
+#include "array_view.h"
+#include "codec.h"
+#include "trace.h"
 
 #define MPI_THROW(message, comm)         \
 		do {                             \
@@ -29,6 +33,16 @@ namespace mpi {
 		struct is_shared_array : std::false_type {};
 		template<typename T>
 		struct is_shared_array<mpi::shared_array<T>> : std::true_type {};
+		template<typename T>
+		struct is_array_view : std::false_type {};
+		template<typename T>
+		struct is_array_view<mpi::array_view<T>> : std::true_type {};
+		// Составной тип со своим MPI_Datatype.
+		// Специализация должна определить static MPI_Datatype get()
+		template<typename T>
+		struct mpi_type : std::false_type {};
+		template<typename T>
+		struct is_scalar : std::integral_constant<bool, std::is_fundamental<T>::value || mpi_type<T>::value> {};
 	}
 
 	#define GET_VALUE_TYPE(T)        typename T::value_type
@@ -36,9 +50,12 @@ namespace mpi {
 	#define ENABLE_IF_CLASS(T)  typename std::enable_if<std::is_class<T>::value, int>::type* = nullptr
 	#define ENABLE_IF_VECTOR(T) typename std::enable_if<mpi::traits::is_vector<T>::value, int>::type* = nullptr
 	#define ENABLE_IF_SARRAY(T) typename std::enable_if<mpi::traits::is_shared_array<T>::value, int>::type* = nullptr
+	#define ENABLE_IF_VIEW(T)   typename std::enable_if<mpi::traits::is_array_view<T>::value, int>::type* = nullptr
+	#define ENABLE_IF_CUSTOM(T) typename std::enable_if<mpi::traits::mpi_type<T>::value, int>::type* = nullptr
+	#define ENABLE_IF_SCALAR(T) typename std::enable_if<mpi::traits::is_scalar<T>::value, int>::type* = nullptr
 
 	// Определяет тип 
-	template<typename T>
+	template<typename T, ENABLE_IF_FUNDAMENTAL(T)>
 	MPI_Datatype get_mpi_datatype()
 	{
 		static_assert(std::is_fundamental<T>::value, "Error");
@@ -63,24 +80,41 @@ namespace mpi {
 		if (std::is_same<T, long>::value) {
 			return MPI_LONG;
 		}
+		if (std::is_same<T, long long>::value) {
+			return MPI_LONG_LONG;
+		}
 		return MPI_DATATYPE_NULL;
 	}
 
+	// Определяет тип для составных типов
+	template<typename T, ENABLE_IF_CUSTOM(T)>
+	MPI_Datatype get_mpi_datatype()
+	{
+		return traits::mpi_type<T>::get();
+	}
+
 	// MPI_Init alias
 	inline void init(int* argc, char*** argv)
 	{
 		MPI_Init(argc, argv);
+#ifdef MPIEXT_TRACE
+		trace::align();
+#endif
 	}
 
 	// MPI_Finalize alias
 	inline void finalize()
 	{
+#ifdef MPIEXT_TRACE
+		trace::flush();
+#endif
 		MPI_Finalize();
 	}
 
 	// MPI_Barrier alias
 	inline void barrier(MPI_Comm comm = MPI_COMM_WORLD)
 	{
+		MPIEXT_TRACE_SCOPE("barrier", -1, -1, 0, comm);
 		MPI_Barrier(comm);
 	}
 
@@ -100,16 +134,41 @@ namespace mpi {
 		return _rank;
 	}
 
+	// MPI_Comm_split alias
+	inline MPI_Comm splitComm(MPI_Comm comm, int color, int key)
+	{
+		MPI_Comm _newcomm;
+		MPI_Comm_split(comm, color, key, &_newcomm);
+		return _newcomm;
+	}
+
+	// MPI_Comm_split_type(MPI_COMM_TYPE_SHARED) alias: процессы одного узла
+	inline MPI_Comm splitShared(MPI_Comm comm, int key)
+	{
+		MPI_Comm _newcomm;
+		MPI_Comm_split_type(comm, MPI_COMM_TYPE_SHARED, key, MPI_INFO_NULL, &_newcomm);
+		return _newcomm;
+	}
+
+	// MPI_Comm_free alias
+	inline void freeComm(MPI_Comm& comm)
+	{
+		if (comm != MPI_COMM_NULL)
+			MPI_Comm_free(&comm);
+	}
+
 	// Отправляет базовый тип указанному получателю
-	template<typename T, ENABLE_IF_FUNDAMENTAL(T)>
+	template<typename T, ENABLE_IF_SCALAR(T)>
 	void send(const T what, int dest, int tag, MPI_Comm comm = MPI_COMM_WORLD) {
+		MPIEXT_TRACE_SCOPE("send", dest, tag, sizeof(T), comm);
 		auto type = get_mpi_datatype<T>();
 		MPI_Send(&what, 1, type, dest, tag, comm);
 	}
 
 	// Принимает базовый тип от указанного отправителя
-	template<typename T, ENABLE_IF_FUNDAMENTAL(T)>
+	template<typename T, ENABLE_IF_SCALAR(T)>
 	T receive(int source, int tag, MPI_Comm comm = MPI_COMM_WORLD) {
+		MPIEXT_TRACE_SCOPE("receive", source, tag, sizeof(T), comm);
 		T what;
 		auto type = get_mpi_datatype<T>();
 		MPI_Recv(&what, 1, type, source, tag, comm, MPI_STATUS_IGNORE);
@@ -120,6 +179,7 @@ namespace mpi {
 	template<typename T, ENABLE_IF_VECTOR(T)>
 	void send(const T& what, int dest, int tag, MPI_Comm comm = MPI_COMM_WORLD)
 	{
+		MPIEXT_TRACE_SCOPE("send", dest, tag, what.size() * sizeof(typename T::value_type), comm);
 		auto type = get_mpi_datatype<typename T::value_type>();
 		int len = what.size();
 		MPI_Send(&len, 1, MPI_INT, dest, tag, MPI_COMM_WORLD);
@@ -131,8 +191,10 @@ namespace mpi {
 	template<typename T, ENABLE_IF_VECTOR(T)>
 	T receive(int source, int tag, MPI_Comm comm = MPI_COMM_WORLD)
 	{
+		MPIEXT_TRACE_SCOPE("receive", source, tag, 0, comm);
 		int len; 
 		MPI_Recv(&len, 1, MPI_INT, source, tag, comm, MPI_STATUS_IGNORE);
+		MPIEXT_TRACE_BYTES(len * static_cast<long long>(sizeof(typename T::value_type)));
 		if (len < 1)
 			return T{};
 		T vec(len);
@@ -141,10 +203,38 @@ namespace mpi {
 		return vec;		
 	}
 
+	// Отправляет участок массива без копирования
+	template<typename T, ENABLE_IF_VIEW(T)>
+	void send(const T what, int dest, int tag, MPI_Comm comm = MPI_COMM_WORLD)
+	{
+		MPIEXT_TRACE_SCOPE("send", dest, tag, what.size() * sizeof(typename T::value_type), comm);
+		auto type = get_mpi_datatype<typename std::remove_const<typename T::value_type>::type>();
+		int len = what.size();
+		MPI_Send(&len, 1, MPI_INT, dest, tag, comm);
+		if (len > 0)
+			MPI_Send(what.get(), len, type, dest, tag, comm);
+	}
+
+	// Принимает в участок массива, возвращает кол-во принятых элементов
+	template<typename T, ENABLE_IF_VIEW(T)>
+	int receive(const T into, int source, int tag, MPI_Comm comm = MPI_COMM_WORLD)
+	{
+		MPIEXT_TRACE_SCOPE("receive", source, tag, 0, comm);
+		int len;
+		MPI_Recv(&len, 1, MPI_INT, source, tag, comm, MPI_STATUS_IGNORE);
+		MPIEXT_TRACE_BYTES(len * static_cast<long long>(sizeof(typename T::value_type)));
+		if (len > static_cast<int>(into.size()))
+			MPI_THROW("Receive view has less items than was sent", comm);
+		if (len > 0)
+			MPI_Recv(into.get(), len, get_mpi_datatype<typename T::value_type>(), source, tag, comm, MPI_STATUS_IGNORE);
+		return len;
+	}
+
 	// Операция отправки и приема в одной
 	template<typename T, ENABLE_IF_VECTOR(T)>
 	T sendreceive(const T& what, int dest, int source, int tag, MPI_Comm comm = MPI_COMM_WORLD)
 	{
+		MPIEXT_TRACE_SCOPE("sendreceive", dest, tag, what.size() * sizeof(typename T::value_type), comm);
 		int newLen = 0, oldLen = what.size();
 		MPI_Sendrecv(&oldLen, 1, MPI_INT, dest, tag, &newLen, 1, MPI_INT, source, tag, comm, MPI_STATUS_IGNORE);
 		if (newLen < 1)
@@ -159,20 +249,261 @@ namespace mpi {
 	template<typename T, ENABLE_IF_SARRAY(T)>
 	T sendreceive(const T& what, int dest, int source, int tag, MPI_Comm comm = MPI_COMM_WORLD)
 	{
+		MPIEXT_TRACE_SCOPE("sendreceive", dest, tag, what.size() * sizeof(typename T::value_type), comm);
 		int newLen = 0, oldLen = what.size();
 		MPI_Sendrecv(&oldLen, 1, MPI_INT, dest, tag, &newLen, 1, MPI_INT, source, tag, comm, MPI_STATUS_IGNORE);
 		//if (newLen < 1 || oldLen < 1)
 		//	return T{};
-		T newArr(newLen);
+		T newArr(newLen, allocation::uninitialized());
 		auto type = get_mpi_datatype<typename T::value_type>();
 		MPI_Sendrecv(what.get(), oldLen, type, dest, tag, newArr.get(), newLen, type, source, tag, comm, MPI_STATUS_IGNORE);
 		return newArr;
 	}
 
+	// Режим кодирования данных при обмене
+	enum class wire_mode { raw, packed, automatic };
+
+	///<summary>
+	/// Настройки и статистика кодирования данных при обмене.
+	/// Скорость канала и кодека оцениваются по уже выполненным обменам
+	///</summary>
+	class wire
+	{
+	public:
+		struct statistics {
+			unsigned long long raw_bytes = 0;       // Объём данных без кодирования
+			unsigned long long wire_bytes = 0;      // Реально отправлено
+			unsigned long long packed_messages = 0;
+			unsigned long long raw_messages = 0;
+		};
+
+	public:
+		// Текущий режим (по умолчанию кодирование включается само)
+		static wire_mode& mode() { static wire_mode _mode = wire_mode::automatic; return _mode; }
+		// Статистика текущего процесса
+		static statistics& stats() { static MPIEXT_RANK_LOCAL statistics _stats; return _stats; }
+		// Оценка скорости канала в одну сторону, байт/с
+		static double& link_bandwidth() { static MPIEXT_RANK_LOCAL double _bw = 1e9; return _bw; }
+		// Оценка скорости кодирования, байт исходных данных/с
+		static double& encode_bandwidth() { static MPIEXT_RANK_LOCAL double _bw = 1e9; return _bw; }
+		// Оценка скорости декодирования, байт исходных данных/с
+		static double& decode_bandwidth() { static MPIEXT_RANK_LOCAL double _bw = 1e9; return _bw; }
+
+		///<summary>
+		/// Учитывает замер передачи. Короткие сообщения
+		/// упираются в латентность и скорость не отражают
+		///</summary>
+		static void observe_link(size_t bytes, double seconds) {
+			if (bytes >= (64 << 10) && seconds > 0)
+				link_bandwidth() = 0.75 * link_bandwidth() + 0.25 * (bytes / seconds);
+		}
+
+		///<summary>
+		/// Учитывает замер кодирования
+		///</summary>
+		static void observe_encode(size_t bytes, double seconds) {
+			if (bytes >= (64 << 10) && seconds > 0)
+				encode_bandwidth() = 0.75 * encode_bandwidth() + 0.25 * (bytes / seconds);
+		}
+
+		///<summary>
+		/// Учитывает замер декодирования
+		///</summary>
+		static void observe_decode(size_t bytes, double seconds) {
+			if (bytes >= (64 << 10) && seconds > 0)
+				decode_bandwidth() = 0.75 * decode_bandwidth() + 0.25 * (bytes / seconds);
+		}
+
+		///<summary>
+		/// Однократный замер кодека на синтетических отсортированных
+		/// данных типа V, чтобы решение не зависело от стартовых оценок
+		///</summary>
+		template<typename V>
+		static void calibrate() {
+			calibrate<V>(std::integral_constant<bool, codec::delta_codec<V>::supported>{});
+		}
+
+	private:
+		template<typename V>
+		static void calibrate(std::false_type) { }
+
+		template<typename V>
+		static void calibrate(std::true_type) {
+			typedef codec::delta_codec<V> codec_t;
+			const size_t count = 1 << 16;
+			std::vector<V> sample(count), decoded(count);
+			for (size_t i = 0; i < count; i++)
+				sample[i] = static_cast<V>(i % 128);
+			std::sort(sample.begin(), sample.end());
+			std::vector<unsigned char> packed;
+			auto start = MPI_Wtime();
+			codec_t::encode(sample.data(), count, packed);
+			auto middle = MPI_Wtime();
+			codec_t::decode(packed.data(), count, decoded.data());
+			auto end = MPI_Wtime();
+			if (middle > start)
+				encode_bandwidth() = count * sizeof(V) / (middle - start);
+			if (end > middle)
+				decode_bandwidth() = count * sizeof(V) / (end - middle);
+		}
+
+	public:
+
+		///<summary>
+		/// Окупается ли кодирование: экономия времени передачи
+		/// должна превышать время кодирования и декодирования
+		///</summary>
+		static bool pays_off(size_t rawBytes, size_t packedBytes) {
+			if (packedBytes >= rawBytes)
+				return false;
+			auto saved = (rawBytes - packedBytes) / link_bandwidth();
+			auto spent = rawBytes / encode_bandwidth() + rawBytes / decode_bandwidth();
+			return saved > spent;
+		}
+
+		///<summary>
+		/// Сводная статистика по всем процессам на root
+		///</summary>
+		static void report(int root, MPI_Comm comm = MPI_COMM_WORLD) {
+			auto& s = stats();
+			unsigned long long local[4] = { s.raw_bytes, s.wire_bytes, s.packed_messages, s.raw_messages },
+							   total[4] = { 0, 0, 0, 0 };
+			MPI_Reduce(local, total, 4, MPI_UNSIGNED_LONG_LONG, MPI_SUM, root, comm);
+			int rank;
+			MPI_Comm_rank(comm, &rank);
+			if (rank != root)
+				return;
+			auto saved = total[0] - total[1];
+			std::cout << "[Wire] Payload " << total[0] << " bytes, sent " << total[1]
+					  << " bytes, saved " << saved << " bytes ("
+					  << (total[0] ? 100.0 * saved / total[0] : 0.0) << "%), packed messages "
+					  << total[2] << " of " << total[2] + total[3] << std::endl;
+		}
+	};
+
+	///<summary>
+	/// Буферы обмена, которые можно переиспользовать между вызовами.
+	/// Если задан header, заголовки передаются постоянными запросами
+	/// (приём, затем отправка), связанными с inHead/outHead
+	///</summary>
+	struct exchange_buffers {
+		int outHead[2] = { 0, 0 };
+		int inHead[2] = { 0, 0 };
+		std::vector<unsigned char> packed, incoming;
+		MPI_Request* header = nullptr;
+	};
+
+	///<summary>
+	/// Обмен с кодированием данных. Перед данными стороны обмениваются
+	/// заголовком {кол-во элементов, размер кодированных данных},
+	/// нулевой размер означает передачу без кодирования.
+	/// Каждая сторона решает за свою отправку сама.
+	/// Отправка идёт прямо из памяти what. Место для приёма
+	/// выдаёт prepare(кол-во элементов) -> V*, когда размер уже известен,
+	/// так что принимать можно сразу в итоговый буфер.
+	/// Возвращает кол-во принятых элементов
+	///</summary>
+	template<typename W, typename Prepare>
+	int sendreceive(array_view<W> what, Prepare&& prepare, int dest, int source, int tag,
+		wire_mode mode, exchange_buffers& buffers, MPI_Comm comm = MPI_COMM_WORLD)
+	{
+		typedef typename std::remove_const<W>::type V;
+		typedef codec::delta_codec<V> codec_t;
+		const V* data = what.get();
+		int count = static_cast<int>(what.size());
+		auto oldHead = buffers.outHead,
+			 newHead = buffers.inHead;
+		oldHead[0] = count;
+		oldHead[1] = 0;
+		size_t rawBytes = count * sizeof(V);
+		if (codec_t::supported && mode != wire_mode::raw && count > 0) {
+			// Решение принимается по оценке на выборке блоков,
+			// кодирование выполняется не более одного прохода
+			auto pack = mode == wire_mode::packed;
+			if (!pack) {
+				static MPIEXT_RANK_LOCAL bool calibrated = (wire::calibrate<V>(), true);
+				(void)calibrated;
+				pack = wire::pays_off(rawBytes, codec_t::estimate_size(data, count));
+			}
+			if (pack) {
+				auto start = MPI_Wtime();
+				codec_t::encode(data, count, buffers.packed);
+				wire::observe_encode(rawBytes, MPI_Wtime() - start);
+				// Оценка могла ошибиться: несжимаемое отправляем как есть
+				if (mode == wire_mode::packed || buffers.packed.size() < rawBytes)
+					oldHead[1] = static_cast<int>(buffers.packed.size());
+			}
+		}
+		// Обмен заголовками синхронизирует стороны: приём завершается,
+		// только когда сосед закончил свою локальную работу
+		{
+			MPIEXT_TRACE_SCOPE("sendreceive.header", dest, tag, 2 * sizeof(int), comm);
+			if (buffers.header) {
+				MPI_Startall(2, buffers.header);
+				MPI_Waitall(2, buffers.header, MPI_STATUSES_IGNORE);
+			} else {
+				MPI_Sendrecv(oldHead, 2, MPI_INT, dest, tag, newHead, 2, MPI_INT, source, tag, comm, MPI_STATUS_IGNORE);
+			}
+		}
+		V* into = prepare(newHead[0]);
+		MPIEXT_TRACE_SCOPE("sendreceive.data", dest, tag, oldHead[1] ? oldHead[1] : static_cast<long long>(rawBytes), comm);
+		buffers.incoming.resize(newHead[1]);
+		auto type = get_mpi_datatype<V>();
+		// Замеряется только передача данных после синхронизации
+		auto start = MPI_Wtime();
+		MPI_Sendrecv(oldHead[1] ? (void*)buffers.packed.data() : (void*)data,
+					 oldHead[1] ? oldHead[1] : oldHead[0], oldHead[1] ? MPI_BYTE : type, dest, tag,
+					 newHead[1] ? (void*)buffers.incoming.data() : (void*)into,
+					 newHead[1] ? newHead[1] : newHead[0], newHead[1] ? MPI_BYTE : type, source, tag,
+					 comm, MPI_STATUS_IGNORE);
+		size_t sentBytes = oldHead[1] ? oldHead[1] : rawBytes,
+			   recvBytes = newHead[1] ? newHead[1] : newHead[0] * sizeof(V);
+		// Канал дуплексный: скорость считаем по большему из направлений
+		wire::observe_link(std::max(sentBytes, recvBytes), MPI_Wtime() - start);
+		if (newHead[1]) {
+			auto decoded = MPI_Wtime();
+			codec_t::decode(buffers.incoming.data(), newHead[0], into);
+			wire::observe_decode(newHead[0] * sizeof(V), MPI_Wtime() - decoded);
+		}
+		// Статистика по отправленным данным
+		auto& stats = wire::stats();
+		stats.raw_bytes += rawBytes;
+		stats.wire_bytes += sentBytes;
+		(oldHead[1] ? stats.packed_messages : stats.raw_messages)++;
+		return newHead[0];
+	}
+
+	///<summary>
+	/// Обмен с кодированием данных в массив into.
+	/// Возвращает true, если into перевыделен
+	///</summary>
+	template<typename V>
+	bool sendreceive(const V* what, int count, shared_array<V>& into, int dest, int source, int tag,
+		wire_mode mode, exchange_buffers& buffers, MPI_Comm comm = MPI_COMM_WORLD)
+	{
+		auto allocated = false;
+		sendreceive(array_view<const V>(what, count), [&](int received) {
+			allocated = into.fit(received);
+			return into.get();
+		}, dest, source, tag, mode, buffers, comm);
+		return allocated;
+	}
+
+	// Обмен с кодированием данных в новый массив
+	template<typename T, ENABLE_IF_SARRAY(T)>
+	T sendreceive(const T& what, int dest, int source, int tag, wire_mode mode, MPI_Comm comm = MPI_COMM_WORLD)
+	{
+		T newArr{};
+		exchange_buffers buffers{};
+		sendreceive(what.get(), static_cast<int>(what.size()), newArr, dest, source, tag, mode, buffers, comm);
+		return newArr;
+	}
+
 	// Широковещательная операция для базовых типов
 	template<typename T, ENABLE_IF_FUNDAMENTAL(T)>
 	void broadcast(T* value, int root, MPI_Comm comm = MPI_COMM_WORLD)
 	{
+		MPIEXT_TRACE_SCOPE("broadcast", root, -1, sizeof(T), comm);
 		auto type = get_mpi_datatype<T>();
 		MPI_Bcast(value, 1, type, root, comm);
 	}
@@ -181,11 +512,13 @@ namespace mpi {
 	template<typename T, ENABLE_IF_VECTOR(T)>
 	void broadcast(T* value, int root, MPI_Comm comm = MPI_COMM_WORLD)
 	{
+		MPIEXT_TRACE_SCOPE("broadcast", root, -1, 0, comm);
 		int rank, len;
 		MPI_Comm_rank(comm, &rank);
 		if (rank == root)
 			len = value->size();
 		MPI_Bcast(&len, 1, MPI_INT, root, comm);
+		MPIEXT_TRACE_BYTES(len * static_cast<long long>(sizeof(typename T::value_type)));
 		if (len > 0) {
 			value->resize(len);
 			auto type = get_mpi_datatype<typename T::value_type>();
@@ -194,6 +527,92 @@ namespace mpi {
 	}
 
 
+	// Поэлементная редукция вектора базовых типов на всех процессах
+	template<typename T, ENABLE_IF_VECTOR(T)>
+	T allreduce(const T& values, MPI_Op op, MPI_Comm comm = MPI_COMM_WORLD)
+	{
+		MPIEXT_TRACE_SCOPE("allreduce", -1, -1, values.size() * sizeof(typename T::value_type), comm);
+		T result(values.size());
+		if (values.empty())
+			return result;
+		auto type = get_mpi_datatype<typename T::value_type>();
+		MPI_Allreduce(&values[0], &result[0], values.size(), type, op, comm);
+		return result;
+	}
+
+	// Исключающий префикс для базового типа.
+	// На первом процессе коммуникатора возвращает T{}
+	template<typename T, ENABLE_IF_FUNDAMENTAL(T)>
+	T exscan(const T value, MPI_Op op, MPI_Comm comm = MPI_COMM_WORLD)
+	{
+		MPIEXT_TRACE_SCOPE("exscan", -1, -1, sizeof(T), comm);
+		T result{};
+		auto type = get_mpi_datatype<T>();
+		MPI_Exscan(&value, &result, 1, type, op, comm);
+		if (getRank(comm) == 0)
+			result = T{};
+		return result;
+	}
+
+	// Собирает по одному значению базового типа со всех процессов на всех
+	template<typename T, ENABLE_IF_FUNDAMENTAL(T)>
+	std::vector<T> allgather(const T& value, MPI_Comm comm = MPI_COMM_WORLD)
+	{
+		MPIEXT_TRACE_SCOPE("allgather", -1, -1, sizeof(T), comm);
+		std::vector<T> result(getSize(comm));
+		auto type = get_mpi_datatype<T>();
+		MPI_Allgather(&value, 1, type, &result[0], 1, type, comm);
+		return result;
+	}
+
+	// Собирает со всех процессов векторы одинаковой длины на всех.
+	// Результат упорядочен по рангу
+	template<typename T, ENABLE_IF_VECTOR(T)>
+	T allgather(const T& values, MPI_Comm comm = MPI_COMM_WORLD)
+	{
+		MPIEXT_TRACE_SCOPE("allgather", -1, -1, values.size() * sizeof(typename T::value_type), comm);
+		T result(values.size() * getSize(comm));
+		if (values.empty())
+			return result;
+		auto type = get_mpi_datatype<typename T::value_type>();
+		MPI_Allgather(&values[0], values.size(), type, &result[0], values.size(), type, comm);
+		return result;
+	}
+
+	// Обмен всех со всеми, когда кол-во принимаемых элементов известно.
+	// values упорядочен по процессам-получателям
+	template<typename T, ENABLE_IF_VECTOR(T)>
+	T alltoallv(const T& values, const std::vector<int>& sendcounts, const std::vector<int>& recvcounts,
+		MPI_Comm comm = MPI_COMM_WORLD)
+	{
+		MPIEXT_TRACE_SCOPE("alltoallv", -1, -1, values.size() * sizeof(typename T::value_type), comm);
+		auto size = sendcounts.size();
+		std::vector<int> sdispls(size, 0), rdispls(size, 0);
+		for (size_t pe = 1; pe < size; pe++) {
+			sdispls[pe] = sdispls[pe - 1] + sendcounts[pe - 1];
+			rdispls[pe] = rdispls[pe - 1] + recvcounts[pe - 1];
+		}
+		T result(rdispls[size - 1] + recvcounts[size - 1]);
+		auto type = get_mpi_datatype<typename T::value_type>();
+		MPI_Alltoallv(values.data(), &sendcounts[0], &sdispls[0], type,
+			result.data(), &recvcounts[0], &rdispls[0], type, comm);
+		return result;
+	}
+
+	// Обмен всех со всеми. Кол-во принимаемых элементов
+	// узнаётся предварительным MPI_Alltoall и возвращается в recvcounts
+	template<typename T, ENABLE_IF_VECTOR(T)>
+	T alltoallv(const T& values, const std::vector<int>& sendcounts, std::vector<int>& recvcounts,
+		MPI_Comm comm = MPI_COMM_WORLD)
+	{
+		recvcounts.assign(sendcounts.size(), 0);
+		{
+			MPIEXT_TRACE_SCOPE("alltoall", -1, -1, sendcounts.size() * sizeof(int), comm);
+			MPI_Alltoall(&sendcounts[0], 1, MPI_INT, &recvcounts[0], 1, MPI_INT, comm);
+		}
+		return alltoallv(values, sendcounts, static_cast<const std::vector<int>&>(recvcounts), comm);
+	}
+
 	// Рассылка по одному элементу базового типа на каждый из процессов
 	template<typename T, ENABLE_IF_VECTOR(T)>
 	auto scatter(const T& values, int root, MPI_Comm comm = MPI_COMM_WORLD)
@@ -206,6 +625,7 @@ namespace mpi {
 		//MPI_Bcast(&len, 1, MPI_INT, root, comm);
 		//values.resize(len);
 		typedef typename T::value_type value_type;
+		MPIEXT_TRACE_SCOPE("scatter", root, -1, sizeof(value_type), comm);
 		value_type value{};
 		auto type = get_mpi_datatype<value_type>();
 		MPI_Scatter(&values[0], 1, type, &value, 1, type, root, comm);
@@ -237,6 +657,7 @@ namespace mpi {
 			for (auto pe = 1; pe < size; pe++)
 				displs[pe] = displs[pe - 1] + counts[pe - 1];
 		}
+		MPIEXT_TRACE_SCOPE("scatter", root, -1, counts[rank] * static_cast<long long>(sizeof(inner)), comm);
 		auto type = get_mpi_datatype<inner>();
 		MPI_Scatterv(&values[0], &counts[0], displs, type, &vec[0], counts[rank], type, root, comm);
 		if (rank == root)
@@ -244,35 +665,52 @@ namespace mpi {
 		return vec;
 	}
 
-	// ....
-	template<typename T, ENABLE_IF_SARRAY(T)>
-	T scatter(const T& values, const std::vector<int>& counts, int root, MPI_Comm comm = MPI_COMM_WORLD)
+	///<summary>
+	/// Счётчики и смещения коллективных операций,
+	/// которые можно переиспользовать между вызовами
+	///</summary>
+	struct collective_buffers {
+		std::vector<int> counts, displs;
+	};
+
+	// Рассылает i-му процессу counts[i] элементов в массив into.
+	// Возвращает true, если into перевыделен
+	template<typename V>
+	bool scatter(const V* values, size_t total, const std::vector<int>& counts, shared_array<V>& into, int root,
+		collective_buffers& buffers, MPI_Comm comm = MPI_COMM_WORLD)
 	{
-		typedef typename T::value_type inner;
-		int rank, size, *displs = nullptr;
+		int rank, size;
 		MPI_Comm_rank(comm, &rank);
 		MPI_Comm_size(comm, &size);
 		// Проверяем на соответствие кол-ва запрошенных
 		// элементов и кол-ва элементо всего
 		if (rank == root) {
 			int sum = std::accumulate(counts.begin(), counts.end(), 0);
-			if (sum > values.size())
+			if (sum > total)
 				MPI_THROW("Values array has less items than was requested", comm);
 		}
-		// Массив для возврата
-		T arr{};
-		arr.reallocate(counts[rank]);
+		auto allocated = into.fit(counts[rank]);
 		// Считаем смещения в начальном векторе данных
 		if (rank == root) {
-			displs = new int[size];
-			displs[0] = 0;
+			buffers.displs.resize(size);
+			buffers.displs[0] = 0;
 			for (auto pe = 1; pe < size; pe++)
-				displs[pe] = displs[pe - 1] + counts[pe - 1];
+				buffers.displs[pe] = buffers.displs[pe - 1] + counts[pe - 1];
 		}
-		auto type = get_mpi_datatype<inner>();
-		MPI_Scatterv(values.get(), &counts[0], displs, type, arr.get(), counts[rank], type, root, comm);
-		if (rank == root)
-			delete[] displs;
+		MPIEXT_TRACE_SCOPE("scatter", root, -1, counts[rank] * static_cast<long long>(sizeof(V)), comm);
+		auto type = get_mpi_datatype<V>();
+		MPI_Scatterv(values, &counts[0], rank == root ? &buffers.displs[0] : nullptr, type,
+			into.get(), counts[rank], type, root, comm);
+		return allocated;
+	}
+
+	// ....
+	template<typename T, ENABLE_IF_SARRAY(T)>
+	T scatter(const T& values, const std::vector<int>& counts, int root, MPI_Comm comm = MPI_COMM_WORLD)
+	{
+		T arr{};
+		collective_buffers buffers{};
+		scatter(values.get(), values.size(), counts, arr, root, buffers, comm);
 		return arr;
 	}
 
@@ -287,6 +725,7 @@ namespace mpi {
 		if (rank == root) {
 			recvbuf = new T[size];
 		}
+		MPIEXT_TRACE_SCOPE("gather", root, -1, sizeof(T), comm);
 		auto type = get_mpi_datatype<T>();
 		MPI_Gather(&value, 1, type, recvbuf, 1, type, root, comm);
 		std::vector<T> result{};
@@ -308,6 +747,7 @@ namespace mpi {
 		MPI_Comm_size(comm, &size);
 		// Получаем размер слайса текущего процесса
 		int sliceLen = slice.size();
+		MPIEXT_TRACE_SCOPE("gather", root, -1, sliceLen * static_cast<long long>(sizeof(inner)), comm);
 		// Инициализация промежуточных буферов 
 		if (rank == root) {
 			recvcounts = new int[size];
@@ -344,52 +784,48 @@ namespace mpi {
 		return result;
 	}
 
-	// ...
-	template<typename T, ENABLE_IF_SARRAY(T)>
-	T gather(const T& slice, int root, MPI_Comm comm = MPI_COMM_WORLD)
+	// Собирает слайсы всех процессов в массив into на root.
+	// Возвращает true, если into перевыделен
+	template<typename V>
+	bool gather(const V* slice, int sliceLen, shared_array<V>& into, int root,
+		collective_buffers& buffers, MPI_Comm comm = MPI_COMM_WORLD)
 	{
-		typedef typename T::value_type inner;
-		int rank, size,
-			recvbufSize = 0,
-			*displs = nullptr,  // Смещения в буфере данных для i-го фрагмента
-			*recvcounts = nullptr;  // Кол-во элементов, которые необходимо получить от процессов
+		MPIEXT_TRACE_SCOPE("gather", root, -1, sliceLen * static_cast<long long>(sizeof(V)), comm);
+		int rank, size;
 		MPI_Comm_rank(comm, &rank);
 		MPI_Comm_size(comm, &size);
-		// Получаем размер слайса текущего процесса
-		int sliceLen = slice.size();
 		// Инициализация промежуточных буферов 
 		if (rank == root) {
-			recvcounts = new int[size];
-			displs = new int[size];
+			buffers.counts.resize(size);
+			buffers.displs.resize(size);
 		}
 		// Собираем данные о длине каждого слайса
-		MPI_Gather(&sliceLen, 1, MPI_INT, recvcounts, 1, MPI_INT, root, comm);
-		// Буффер для сбора данных
-		inner *recvbuf = nullptr;
+		MPI_Gather(&sliceLen, 1, MPI_INT, rank == root ? &buffers.counts[0] : nullptr, 1, MPI_INT, root, comm);
+		auto allocated = false;
 		// Рассчитываем смещения для данных
 		if (rank == root) {
-			displs[0] = 0;
+			buffers.displs[0] = 0;
 			for (auto p = 1; p < size; p++) {
-				displs[p] = displs[p - 1] + recvcounts[p - 1];
+				buffers.displs[p] = buffers.displs[p - 1] + buffers.counts[p - 1];
 			}
-			// Надеюсь я правильно это посчитал
-			recvbufSize = displs[size - 1] + recvcounts[size - 1];
-			recvbuf = new inner[recvbufSize];
+			allocated = into.fit(buffers.displs[size - 1] + buffers.counts[size - 1]);
 		}
-		// ...
-		auto type = get_mpi_datatype<inner>();
+		auto type = get_mpi_datatype<V>();
 		// Собираем данные в выходной буфер
-		MPI_Gatherv(slice.get(), sliceLen, type, recvbuf, recvcounts, displs, type,
+		MPI_Gatherv(slice, sliceLen, type, rank == root ? into.get() : nullptr,
+			rank == root ? &buffers.counts[0] : nullptr, rank == root ? &buffers.displs[0] : nullptr, type,
 			root, comm);
+		return allocated;
+	}
 
+	// ...
+	template<typename T, ENABLE_IF_SARRAY(T)>
+	T gather(const T& slice, int root, MPI_Comm comm = MPI_COMM_WORLD)
+	{
 		// Итоговый массив
 		T result{};
-		// Copy & CleanUp
-		if (rank == root) {
-			result.assign(recvbuf, recvbufSize);
-			delete[] displs;
-			delete[] recvcounts;
-		}
+		collective_buffers buffers{};
+		gather(slice.get(), static_cast<int>(slice.size()), result, root, buffers, comm);
 		return result;
 	}
 }
@@ -0,0 +1,284 @@
+﻿#pragma once
+#include <algorithm>
+#include <cmath>
+#include <numeric>
+#include <vector>
+#include "mpiext.h"
+#include "shared_array.h"
+#include "array_view.h"
+#include "simd.h"
+
+namespace mpi {
+	using std::vector;
+
+	///<summary>
+	/// k-арная быстрая сортировка на гиперкубе. Ранг делится на цифры
+	/// по log2(k) бит, итерация идёт по цифре от старшей: k - 1 опорных
+	/// элементов по выборке подкуба, разбиение слайса на k корзин за один
+	/// проход, корзина j уходит процессу с цифрой j (MPI_Alltoallv среди
+	/// k процессов, отличающихся только этой цифрой), k-путевое слияние.
+	/// Итераций log_k(p) вместо log2(p), каждая отдаёт (k - 1) / k данных.
+	/// Число процессов и k - степени двойки, младшая цифра может быть короче
+	///</summary>
+	template<typename T> class multiway_sorter {
+	public:
+		struct statistics {
+			unsigned long long calls = 0;
+			unsigned long long rounds = 0;
+			unsigned long long sent_bytes = 0;   // Отправлено другим процессам
+			double total_seconds = 0;
+			double transfer_seconds = 0;
+			double compute_seconds = 0;
+		};
+
+		// Выборка на корзину с каждого процесса
+		static const int oversampling = 16;
+
+	private:
+		struct round {
+			int ways;          // Число корзин (процессов с разной цифрой)
+			int digit;         // Цифра текущего процесса
+			MPI_Comm subcube;  // Процессы с теми же старшими цифрами
+			MPI_Comm digits;   // Процессы, отличающиеся только этой цифрой
+		};
+
+		MPI_Comm _comm;
+		int _rank, _size, _ways;
+		vector<round> _rounds;
+		shared_array<T> _slice, _merged;
+		collective_buffers _collective;
+		// Счётчики и смещения обмена
+		vector<int> _sendcounts, _recvcounts, _sdispls, _rdispls;
+		statistics _stats;
+
+	public:
+		///<summary>
+		/// Коллективно. ways - число корзин итерации (k)
+		///</summary>
+		explicit multiway_sorter(MPI_Comm comm = MPI_COMM_WORLD, int ways = 4)
+			: _comm(comm), _rank(mpi::getRank(comm)), _size(mpi::getSize(comm)), _ways(2)
+		{
+			while (_ways * 2 <= std::max(ways, 2))
+				_ways *= 2;
+			auto dim = static_cast<int>(log2(_size)),
+				 width = static_cast<int>(log2(_ways));
+			// Цифры от старшей; последняя берёт оставшиеся биты
+			for (auto high = dim; high > 0; high -= width) {
+				auto low = std::max(high - width, 0);
+				round r{};
+				r.ways = 0x1 << (high - low);
+				r.digit = (_rank >> low) & (r.ways - 1);
+				r.subcube = mpi::splitComm(_comm, _rank >> high, _rank);
+				r.digits = mpi::splitComm(_comm, _rank & ~((r.ways - 1) << low), r.digit);
+				_rounds.push_back(r);
+			}
+		}
+
+		~multiway_sorter() {
+			int finalized = 0;
+			MPI_Finalized(&finalized);
+			if (finalized)
+				return;
+			for (auto& r : _rounds) {
+				mpi::freeComm(r.subcube);
+				mpi::freeComm(r.digits);
+			}
+		}
+
+		const statistics& stats() const { return _stats; }
+		// Число корзин на итерации (кроме, может быть, последней)
+		int ways() const { return _ways; }
+		int rounds() const { return static_cast<int>(_rounds.size()); }
+
+		///<summary>
+		/// Сортировка массива корневого процесса. Размер data
+		/// одинаков на всех процессах, результат в data корневого
+		///</summary>
+		void run(shared_array<T>& data) {
+			auto start = MPI_Wtime();
+			vector<int> counts(_size);
+			for (auto pe = 0; pe < _size; pe++)
+				counts[pe] = static_cast<int>(data.size() * (pe + 1) / _size - data.size() * pe / _size);
+			auto moved = MPI_Wtime();
+			mpi::scatter(data.get(), data.size(), counts, _slice, 0, _collective, _comm);
+			_stats.transfer_seconds += MPI_Wtime() - moved;
+			sort(_slice);
+			moved = MPI_Wtime();
+			mpi::gather(_slice.get(), static_cast<int>(_slice.size()), data, 0, _collective, _comm);
+			_stats.transfer_seconds += MPI_Wtime() - moved;
+			_stats.calls++;
+			_stats.total_seconds += MPI_Wtime() - start;
+		}
+
+		///<summary>
+		/// Сортировка распределенных данных.
+		/// После вызова слайсы упорядочены по рангу
+		///</summary>
+		void run_slice(shared_array<T>& slice) {
+			auto start = MPI_Wtime();
+			sort(slice);
+			_stats.calls++;
+			_stats.total_seconds += MPI_Wtime() - start;
+		}
+
+	private:
+		void sort(shared_array<T>& slice)
+		{
+			auto computed = MPI_Wtime();
+			simd::sort(slice.get(), slice.get() + slice.size());
+			_stats.compute_seconds += MPI_Wtime() - computed;
+			for (auto& r : _rounds) {
+				auto moved = MPI_Wtime();
+				auto pivots = select_pivots(slice, r);
+				auto splits = partition(slice, pivots, r);
+				_stats.transfer_seconds += MPI_Wtime() - moved;
+
+				moved = MPI_Wtime();
+				exchange(slice, splits, r);
+				_stats.transfer_seconds += MPI_Wtime() - moved;
+
+				computed = MPI_Wtime();
+				merge(r.ways, slice);
+				_stats.compute_seconds += MPI_Wtime() - computed;
+				_stats.rounds++;
+			}
+		}
+
+		///<summary>
+		/// k - 1 опорных элементов по регулярной выборке подкуба:
+		/// каждый процесс даёт одинаковое число образцов с весом
+		/// "элементов на образец", опорные - взвешенные квантили
+		///</summary>
+		vector<T> select_pivots(const shared_array<T>& slice, const round& r)
+		{
+			auto samples = r.ways * oversampling;
+			vector<T> mine(samples);
+			for (auto i = 0; i < samples && slice.size() != 0; i++)
+				mine[i] = slice[slice.size() * (2 * i + 1) / (2 * samples)];
+			auto all = mpi::allgather(mine, r.subcube);
+			auto weights = mpi::allgather(static_cast<double>(slice.size()) / samples, r.subcube);
+
+			vector<int> order(all.size());
+			std::iota(order.begin(), order.end(), 0);
+			std::sort(order.begin(), order.end(), [&all](int a, int b) { return all[a] < all[b]; });
+			double total = std::accumulate(weights.begin(), weights.end(), 0.0) * samples,
+				   seen = 0;
+			vector<T> pivots{};
+			pivots.reserve(r.ways - 1);
+			for (auto index : order) {
+				seen += weights[index / samples];
+				while (static_cast<int>(pivots.size()) < r.ways - 1 && seen >= total * (pivots.size() + 1) / r.ways)
+					pivots.push_back(all[index]);
+			}
+			while (static_cast<int>(pivots.size()) < r.ways - 1)
+				pivots.push_back(all.empty() ? T{} : all[order.back()]);
+			return pivots;
+		}
+
+		///<summary>
+		/// Границы корзин отсортированного слайса: splits[j] - начало
+		/// корзины j, splits[k] - конец слайса. Равные опорному делятся
+		/// между соседними корзинами так, чтобы по подкубу каждая граница
+		/// пришлась на свою долю данных (один MPI_Allgather на все границы)
+		///</summary>
+		vector<size_t> partition(const shared_array<T>& slice, const vector<T>& pivots, const round& r)
+		{
+			auto bounds = r.ways - 1;
+			// {меньше, равно} для каждой границы и размер слайса
+			vector<long long> local(2 * bounds + 1);
+			for (auto j = 0; j < bounds; j++) {
+				auto first = std::lower_bound(std::begin(slice), std::end(slice), pivots[j]),
+					 last  = std::upper_bound(first, std::end(slice), pivots[j]);
+				local[2 * j] = first - std::begin(slice);
+				local[2 * j + 1] = last - first;
+			}
+			local[2 * bounds] = static_cast<long long>(slice.size());
+			auto counts = mpi::allgather(local, r.subcube);
+			auto rank = mpi::getRank(r.subcube),
+				 size = mpi::getSize(r.subcube);
+			long long total = 0;
+			for (auto pe = 0; pe < size; pe++)
+				total += counts[pe * local.size() + 2 * bounds];
+
+			vector<size_t> splits(r.ways + 1, 0);
+			for (auto j = 0; j < bounds; j++) {
+				long long less = 0, equal = 0, before = 0;
+				for (auto pe = 0; pe < size; pe++) {
+					less += counts[pe * local.size() + 2 * j];
+					equal += counts[pe * local.size() + 2 * j + 1];
+					if (pe < rank)
+						before += counts[pe * local.size() + 2 * j + 1];
+				}
+				// Сколько равных нужно корзинам до границы j по всему подкубу
+				auto wanted = std::min(std::max(total * (j + 1) / r.ways - less, 0LL), equal);
+				auto share = std::min(std::max(wanted - before, 0LL), local[2 * j + 1]);
+				splits[j + 1] = static_cast<size_t>(local[2 * j] + share);
+			}
+			splits[r.ways] = slice.size();
+			return splits;
+		}
+
+		///<summary>
+		/// Корзина j - процессу с цифрой j. Принятые корзины лежат
+		/// в _merged подряд по цифре отправителя, каждая отсортирована
+		///</summary>
+		void exchange(const shared_array<T>& slice, const vector<size_t>& splits, const round& r)
+		{
+			_sendcounts.resize(r.ways);
+			_recvcounts.resize(r.ways);
+			_sdispls.resize(r.ways);
+			_rdispls.resize(r.ways + 1);
+			for (auto j = 0; j < r.ways; j++) {
+				_sendcounts[j] = static_cast<int>(splits[j + 1] - splits[j]);
+				_sdispls[j] = static_cast<int>(splits[j]);
+				if (j != r.digit)
+					_stats.sent_bytes += _sendcounts[j] * sizeof(T);
+			}
+			MPI_Alltoall(_sendcounts.data(), 1, MPI_INT, _recvcounts.data(), 1, MPI_INT, r.digits);
+			_rdispls[0] = 0;
+			for (auto j = 0; j < r.ways; j++)
+				_rdispls[j + 1] = _rdispls[j] + _recvcounts[j];
+			_merged.fit(_rdispls[r.ways]);
+			auto type = get_mpi_datatype<T>();
+			MPI_Alltoallv(slice.get(), _sendcounts.data(), _sdispls.data(), type,
+				_merged.get(), _recvcounts.data(), _rdispls.data(), type, r.digits);
+		}
+
+		///<summary>
+		/// Слияние принятых корзин попарно за log2(k) проходов,
+		/// буферы _merged и slice чередуются; результат в slice
+		///</summary>
+		void merge(int ways, shared_array<T>& slice)
+		{
+			vector<int> bounds(_rdispls.begin(), _rdispls.begin() + ways + 1);
+			auto total = static_cast<size_t>(bounds.back());
+			slice.fit(total);
+			T* from = _merged.get();
+			T* into = slice.get();
+			auto inSlice = false;
+			while (bounds.size() > 2) {
+				vector<int> next{ 0 };
+				for (size_t i = 0; i + 1 < bounds.size(); i += 2) {
+					if (i + 2 < bounds.size()) {
+						simd::merge(from + bounds[i], bounds[i + 1] - bounds[i],
+							from + bounds[i + 1], bounds[i + 2] - bounds[i + 1], into + bounds[i]);
+						next.push_back(bounds[i + 2]);
+					} else {
+						std::copy(from + bounds[i], from + bounds[i + 1], into + bounds[i]);
+						next.push_back(bounds[i + 1]);
+					}
+				}
+				bounds.swap(next);
+				std::swap(from, into);
+				inSlice = !inSlice;
+			}
+			// Результат остался в _merged: меняем буферы местами
+			if (!inSlice)
+				slice.swap(_merged);
+		}
+
+	public:
+		multiway_sorter(const multiway_sorter&) = delete;
+		multiway_sorter& operator=(const multiway_sorter&) = delete;
+	};
+}
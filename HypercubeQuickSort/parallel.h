@@ -1,11 +1,18 @@
 ﻿#pragma once
 #include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <numeric>
+#include <random>
 #include <vector>
 #include <memory>
 #include <functional>
 #include <bitset>
 #include "mpiext.h"
 #include "shared_array.h"
+#include "array_view.h"
+#include "topology.h"
+#include "simd.h"
 
 #define with(decl) \
 for (bool __f = true; __f; ) \
@@ -16,152 +23,550 @@ namespace mpi {
 	using std::shared_ptr;
 	using std::pair;
 
-	template<typename T> class sorter {
+	// Соответствие рангов вершинам гиперкуба
+	enum class mapping {
+		identity,  // Вершина = ранг процесса
+		topology   // Старшие измерения внутри узла (см. topology::virtual_ranks)
+	};
+
+	template<typename T> class sort_handle;
+	class string_sorter;
+	class kernels;
+
+	///<summary>
+	/// Параллельная сортировка на гиперкубе. Экземпляр хранит
+	/// коммуникаторы подкубов, соседей, постоянные запросы
+	/// и буферы между вызовами, так что повторные сортировки
+	/// данных близкого размера почти не выделяют память.
+	/// Compare - порядок элементов; std::less идёт векторным путём simd
+	///</summary>
+	template<typename T, typename Compare = std::less<T>> class sorter {
+		// Асинхронная сортировка идёт по тем же итерациям
+		friend class sort_handle<T>;
+		// Сортировка строк делит равные опорной так же
+		friend class string_sorter;
+		// Микробенчмарки ядер (benchmarks.cpp)
+		friend class kernels;
 
 	private:
 		static std::bitset<3> bin(T num){ return std::bitset<3>(num); }
 
 	public:
+		///<summary>
+		/// Статистика вызовов экземпляра
+		///</summary>
+		struct statistics {
+			unsigned long long calls = 0;
+			unsigned long long allocations = 0;  // Перевыделения буферов
+			double total_seconds = 0;            // Всё время внутри вызовов
+			double transfer_seconds = 0;         // Обмены и коллективные операции
+			double compute_seconds = 0;          // Локальные сортировка, разбиение и слияние
+			vector<unsigned long long> round_bytes;  // Отправлено на итерации измерения i: [i - 1]
+			// Отправлено по классам близости партнёра (индекс - locality)
+			unsigned long long locality_bytes[topology::classes] = { 0, 0, 0 };
+			unsigned long long last_slice = 0;  // Размер слайса после последней сортировки
+			unsigned long long collapsed = 0;   // Равных элементов слито до обменов
+			// Накладные расходы сверх передачи и вычислений
+			double overhead_seconds() const { return total_seconds - transfer_seconds - compute_seconds; }
+		};
+
+	private:
+		// Шаг рассылки опорного элемента
+		struct diffusion_step {
+			int peer;
+			bool send;
+		};
+
+		// Всё, что известно об итерации заранее
+		struct round {
+			int neighbor;                      // Сосед по текущему измерению
+			bool lower;                        // Процесс в младшей половине подкуба
+			locality where;                    // Близость соседа
+			MPI_Comm subcube;                  // Подкуб текущей итерации
+			vector<diffusion_step> diffusion;  // Шаги рассылки опорного элемента
+			exchange_buffers buffers;          // Буферы обмена с соседом
+			MPI_Request header[2];             // Постоянные запросы обмена заголовками
+			double lower_share;                // Доля данных подкуба для младшей половины
+		};
+
+	private:
+		MPI_Comm _comm;
+		// Коммуникатор создан экземпляром (переставленные ранги)
+		bool _owned;
+		int _rank, _size, _dim;
+		// Итерации по убыванию измерения: _rounds[i - 1] для измерения i
+		vector<round> _rounds;
+		// Рабочие массивы: слайс корневых данных и место слияния
+		shared_array<T> _slice, _merged;
+		collective_buffers _collective;
+		// Размеры слайсов для последнего размера данных
+		vector<int> _groups;
+		size_t _groupsFor;
+		// Производительность процессов (пусто - одинаковая)
+		vector<double> _capacities;
+		// Слияние равных элементов до обменов (пусто - не сливаются)
+		std::function<void(T&, const T&)> _combine;
+		Compare _less;
+		statistics _stats;
+
+	public:
+		///<summary>
+		/// Подготовка топологии гиперкуба для коммуникатора.
+		/// При mapping::topology вершины гиперкуба переставляются так,
+		/// чтобы первые итерации шли внутри узла; run() по-прежнему
+		/// возвращает массив в исходном порядке, а слайсы run_slice
+		/// упорядочены по vertex(). ranksPerNode > 0 задаёт виртуальные узлы
+		///</summary>
+		explicit sorter(MPI_Comm comm = MPI_COMM_WORLD, mapping map = mapping::identity, int ranksPerNode = 0,
+			Compare less = Compare())
+			: _comm(map == mapping::topology ? topology::hypercube_comm(comm, ranksPerNode) : comm),
+			  _owned(map == mapping::topology), _rank(mpi::getRank(_comm)), _size(mpi::getSize(_comm)),
+			  _dim(static_cast<int>(log2(_size))), _rounds(_dim), _groupsFor(0), _less(less)
+		{
+			_stats.round_bytes.resize(_dim);
+			vector<int> neighbors(_dim);
+			for (auto i = _dim; i > 0; i--)
+				neighbors[i - 1] = _rank ^ (0x1 << (i - 1));
+			// Виртуальные узлы задаются рангами исходного коммуникатора
+			auto where = topology::classify(comm, topology::translate(_comm, neighbors, comm), ranksPerNode);
+			for (auto i = _dim; i > 0; i--) {
+				auto& r = _rounds[i - 1];
+				r.neighbor = neighbors[i - 1];
+				r.where = where[i - 1];
+				r.lower = !(_rank >> (i - 1) & 0x1);
+				r.subcube = mpi::splitComm(_comm, _rank >> i, _rank);
+				r.diffusion = diffusion_steps(i);
+				r.lower_share = 0.5;
+				// Заголовки всегда идут одному соседу в одни и те же буферы
+				MPI_Recv_init(r.buffers.inHead, 2, MPI_INT, r.neighbor, 666, _comm, &r.header[0]);
+				MPI_Send_init(r.buffers.outHead, 2, MPI_INT, r.neighbor, 666, _comm, &r.header[1]);
+				r.buffers.header = r.header;
+			}
+		}
+
+		///<summary>
+		/// Освобождение ресурсов MPI. Экземпляр должен
+		/// разрушаться до MPI_Finalize
+		///</summary>
+		~sorter() {
+			int finalized = 0;
+			MPI_Finalized(&finalized);
+			if (finalized)
+				return;
+			for (auto& r : _rounds) {
+				MPI_Request_free(&r.header[0]);
+				MPI_Request_free(&r.header[1]);
+				mpi::freeComm(r.subcube);
+			}
+			if (_owned)
+				mpi::freeComm(_comm);
+		}
+
+		///<summary>
+		/// Параллельная сортировка массива данных корневого процесса.
+		/// Размер data должен быть одинаков на всех процессах,
+		/// на остальных процессах data не меняется
+		///</summary>
+		void run(shared_array<T>& data) {
+			auto start = MPI_Wtime();
+			plan_groups(data);
+			auto moved = MPI_Wtime();
+			count(mpi::scatter(data.get(), data.size(), _groups, _slice, 0, _collective, _comm));
+			_stats.transfer_seconds += MPI_Wtime() - moved;
+			qsortpart(_slice);
+			moved = MPI_Wtime();
+			count(mpi::gather(_slice.get(), static_cast<int>(_slice.size()), data, 0, _collective, _comm));
+			_stats.transfer_seconds += MPI_Wtime() - moved;
+			_stats.calls++;
+			_stats.total_seconds += MPI_Wtime() - start;
+		}
+
+		///<summary>
+		/// Параллельная сортировка уже распределенных данных.
+		/// После вызова слайсы процессов упорядочены по рангу
+		///</summary>
+		void run_slice(shared_array<T>& slice) {
+			auto start = MPI_Wtime();
+			qsortpart(slice);
+			_stats.calls++;
+			_stats.total_seconds += MPI_Wtime() - start;
+		}
+
+		///<summary>
+		/// Статистика вызовов
+		///</summary>
+		const statistics& stats() const { return _stats; }
+
+		///<summary>
+		/// Вершина гиперкуба текущего процесса: порядок слайсов после run_slice
+		///</summary>
+		int vertex() const { return _rank; }
+
+		///<summary>
+		/// Слияние равных элементов перед каждым обменом: из серии
+		/// равных остаётся первый, остальные передаются в combine(first, other)
+		/// и выбрасываются. Слайсы после сортировки без локальных повторов,
+		/// повторы между процессами убирает aggregate. nullptr выключает
+		///</summary>
+		void collapse(std::function<void(T&, const T&)> combine) {
+			_combine = std::move(combine);
+		}
+
+		///<summary>
+		/// Производительность текущего процесса (коллективно).
+		/// Доли данных процессов после сортировки пропорциональны
+		/// производительности: опорный элемент итерации - квантиль
+		/// доли младшей половины подкуба, а не медиана.
+		/// Неположительное значение у всех возвращает равные доли
+		///</summary>
+		void capacities(double capacity) {
+			auto all = mpi::allgather(std::max(capacity, 0.0), _comm);
+			auto total = std::accumulate(all.begin(), all.end(), 0.0);
+			_capacities = total > 0 ? all : vector<double>{};
+			_groups.clear();
+			for (auto i = _dim; i > 0; i--) {
+				auto& r = _rounds[i - 1];
+				r.lower_share = 0.5;
+				if (_capacities.empty())
+					continue;
+				// Подкуб - процессы с теми же битами старше i - 1
+				double lower = 0, whole = 0;
+				auto first = (_rank >> i) << i;
+				for (auto pe = first; pe < first + (0x1 << i); pe++) {
+					whole += _capacities[pe];
+					if (!(pe >> (i - 1) & 0x1))
+						lower += _capacities[pe];
+				}
+				if (whole > 0)
+					r.lower_share = lower / whole;
+			}
+		}
+
+		///<summary>
+		/// Замер производительности локальной сортировкой elements
+		/// случайных чисел (коллективно). Возвращает элементы/с
+		/// текущего процесса и передаёт замер в capacities()
+		///</summary>
+		double calibrate(size_t elements = 1 << 18) {
+			std::vector<int> sample(elements);
+			std::mt19937 generator(static_cast<unsigned>(_rank) + 1);
+			double best = 0;
+			// Лучший из трёх замеров отсекает случайные задержки
+			for (auto attempt = 0; attempt < 3; attempt++) {
+				for (auto& v : sample)
+					v = static_cast<int>(generator());
+				auto start = MPI_Wtime();
+				std::sort(sample.begin(), sample.end());
+				auto seconds = MPI_Wtime() - start;
+				if (seconds > 0)
+					best = std::max(best, elements / seconds);
+			}
+			capacities(best);
+			return best;
+		}
+
+		///<summary>
+		/// Достигнутый баланс (коллективно): доля данных каждого процесса
+		/// после последней сортировки против доли его производительности,
+		/// на root печатается таблица и наибольшее отклонение
+		///</summary>
+		void report_balance(int root) const {
+			auto sizes = mpi::gather(static_cast<long long>(_stats.last_slice), root, _comm);
+			if (_rank != root)
+				return;
+			auto total = std::accumulate(sizes.begin(), sizes.end(), 0LL);
+			auto capacity = std::accumulate(_capacities.begin(), _capacities.end(), 0.0);
+			double worst = 0;
+			for (auto pe = 0; pe < _size; pe++) {
+				auto share = total > 0 ? static_cast<double>(sizes[pe]) / total : 0.0;
+				auto target = _capacities.empty() ? 1.0 / _size : _capacities[pe] / capacity;
+				worst = std::max(worst, target > 0 ? std::abs(share / target - 1) : share);
+				std::cout << "[Balance] Rank " << pe << ": " << sizes[pe] << " items, share " << 100 * share
+						  << "%, target " << 100 * target << "%" << std::endl;
+			}
+			std::cout << "[Balance] Worst deviation from target: " << 100 * worst << "%" << std::endl;
+		}
+
+		///<summary>
+		/// Отправленные байты по итерациям и классам близости,
+		/// сумма по всем процессам на root (коллективно)
+		///</summary>
+		void report(int root) const {
+			vector<unsigned long long> local(_stats.round_bytes);
+			local.insert(local.end(), std::begin(_stats.locality_bytes), std::end(_stats.locality_bytes));
+			vector<unsigned long long> total(local.size());
+			MPI_Reduce(local.data(), total.data(), static_cast<int>(local.size()), MPI_UNSIGNED_LONG_LONG, MPI_SUM, root, _comm);
+			// Класс близости итерации одинаков на всех процессах
+			// только при регулярном размещении, собираем его отдельно
+			vector<int> classes(_dim), worst(_dim);
+			for (auto i = 0; i < _dim; i++)
+				classes[i] = static_cast<int>(_rounds[i].where);
+			MPI_Reduce(classes.data(), worst.data(), _dim, MPI_INT, MPI_MAX, root, _comm);
+			if (_rank != root)
+				return;
+			for (auto i = _dim; i > 0; i--)
+				std::cout << "[Topology] Round " << i << " (" << topology::name(static_cast<locality>(worst[i - 1]))
+						  << "): " << total[i - 1] << " bytes" << std::endl;
+			for (auto k = 0; k < topology::classes; k++)
+				std::cout << "[Topology] " << topology::name(static_cast<locality>(k)) << ": "
+						  << total[_dim + k] << " bytes" << std::endl;
+		}
+
+		///<summary>
+		/// Общий экземпляр для MPI_COMM_WORLD. Создаётся при первом
+		/// вызове (коллективно), ресурсы переиспользуются всеми
+		/// последующими статическими вызовами
+		///</summary>
+		static sorter& shared() {
+			static MPIEXT_RANK_LOCAL sorter _instance{};
+			return _instance;
+		}
+
+		///<summary>
+		/// Общий экземпляр с учётом топологии: порядок слайсов
+		/// у него свой, поэтому он только для данных корневого процесса
+		///</summary>
+		static sorter& shared_mapped() {
+			static MPIEXT_RANK_LOCAL sorter _instance{ MPI_COMM_WORLD, mapping::topology };
+			return _instance;
+		}
+
 		///<summary>
 		/// Параллельная сортировка массива данных
 		///</summary>
 		static void sort(shared_array<T>& data) {
-			auto slice = split(data);
-			qsortpart(slice);
-			data = collect(slice);
+			shared_mapped().run(data);
+		}
+
+		///<summary>
+		/// Параллельная сортировка уже распределенных данных.
+		/// После вызова слайсы процессов упорядочены по рангу
+		///</summary>
+		static void sort_slice(shared_array<T>& slice) {
+			shared().run_slice(slice);
 		}
 	private:
 
 		///<summary>
-		/// Выбор опорной точки
+		/// Выбор опорной точки: медиана отсортированного слайса
 		///</summary>
-		static T select_pivot(shared_array<T>& data) {
-			std::sort(std::begin(data), std::end(data));
-			return data[data.size() / 2];
+		static T select_pivot(const shared_array<T>& data, double share = 0.5) {
+			auto index = static_cast<size_t>(data.size() * share);
+			return data[std::min(index, data.size() - 1)];
 		}
 
 		///<summary>
-		/// Слияние двух массивов в один
+		/// Слияние оставленной части (память слайса) с принятой,
+		/// которая уже лежит в result: в начале, если принятые элементы
+		/// младше (received_first), иначе в конце. Слияние идёт от
+		/// конца, где лежит принятое, к другому концу, поэтому запись
+		/// никогда не обгоняет чтение и второй буфер не нужен
 		///</summary>
-		static void merge(shared_array<T>& result, const shared_array<T>& one, const shared_array<T>& two)
+		static void merge(array_view<const T> kept, shared_array<T>& result, bool received_first,
+			Compare less = Compare())
 		{
-			// Аллокация новой памяти как общий размер двух массивов
-			result.reallocate(one.size() + two.size());
-			// Счетчик для перемещения по оригинальному массива
-			size_t k = 0;
-			// Получаем данные из первого массив
-			for(size_t i = 0; i < one.size(); i++)
-				result[k++] = one[i];
-			// Получаем данные из второго массива
-			for(size_t i = 0; i < two.size(); i++)
-				result[k++] = two[i];
-			// Сортировка полученного массива
-			std::sort(std::begin(result), std::end(result));
-		}
-
-		///<summary>
-		/// Разделение массива на две части 
-		/// highpart - элементы больше опорного
-		/// lowpart  - элементы меньше опорного
-		///</summary>
-		static void partition(const T pivot, const shared_array<T>& data,
-			 shared_array<T>& lowPart, shared_array<T>& highPart)
+			MPIEXT_TRACE_SCOPE("sorter.merge", -1, -1, result.size() * sizeof(T), MPI_COMM_NULL);
+			auto out = result.get();
+			auto n = result.size(), m = kept.size();
+			// Принятое в [m, n) - пишем с начала, в [0, n - m) - с конца
+			if (!received_first)
+				simd::merge(kept.get(), m, out + m, n - m, out, less);
+			else
+				simd::merge_backward(kept.get(), m, out, n - m, out + n, less);
+		}
+
+		///<summary>
+		/// Разделение отсортированного массива на две части: возвращает
+		/// кол-во элементов младшей части, остальные - старшая.
+		/// Элементы, равные опорному, делятся между частями так,
+		/// чтобы суммарно по подкубу половины получились равными
+		///</summary>
+		static size_t partition(const T pivot, const shared_array<T>& data, MPI_Comm subcube, double share = 0.5,
+			Compare order = Compare())
 		{
-			auto high = 0,
-				 low  = 0;
-			// Считаем размеры для массивов low / high
-			for(auto i = 0; i < data.size(); i++)
-				(data[i] < pivot) ? low++ : high++;
-			// Заново инициализируем массивы
-			lowPart.reallocate(low);
-			highPart.reallocate(high);
-			// Записываем значения в массивы
-			for(auto i = 0, h = 0, l = 0; i < data.size(); i++)
-				(data[i] < pivot) 
-					? lowPart[l++]  = data[i]
-					: highPart[h++] = data[i];
+			MPIEXT_TRACE_SCOPE("sorter.partition", -1, -1, 0, subcube);
+			// Равные опорному лежат подряд между двумя границами
+			auto first = std::lower_bound(std::begin(data), std::end(data), pivot, order),
+				 last  = std::upper_bound(first, std::end(data), pivot, order);
+			long long less  = first - std::begin(data),
+					  equal = last - first;
+			// Сколько равных опорному элементов остается в младшей части
+			auto equalLow = balance_equal(less, equal, data.size(), subcube, share);
+			return static_cast<size_t>(less + equalLow);
 		}
 
 		///<summary>
-		/// Обмен данными с соседним процессом не текущей итерации
+		/// Кол-во равных опорному элементов, которые текущий процесс
+		/// отдает в младшую половину подкуба. Равные элементы упорядочены
+		/// по рангу процесса и индексу, младшим достаются первые из них
+		/// в объёме, которого не хватает младшей половине до середины.
+		/// Суммы и префикс считаются по одному MPI_Allgather
 		///</summary>
-		static void exchange(shared_array<T>& data, const int iteration, const bool isHighPart)
+		static long long balance_equal(long long less, long long equal, size_t size, MPI_Comm subcube, double share = 0.5)
 		{
-			// Определяем ранг текущего процесса и соседа
-			// для отправки данных
-			int rank = mpi::getRank(MPI_COMM_WORLD),
-				neighbor = rank ^ (0x1 << iteration - 1),
-				size = data.size(), nsize = 0;
-			// Обмен массивами
-			data = mpi::sendreceive(data, neighbor, neighbor, 666);
+			auto counts = mpi::allgather(vector<long long>{ less, equal, static_cast<long long>(size) }, subcube);
+			return equal_share(counts, mpi::getRank(subcube), equal, share);
 		}
 
 		///<summary>
-		/// Отправка и получение опорного элемента
+		/// Доля равных опорному элементов процесса rank по собранным
+		/// тройкам {меньше, равно, размер} всех процессов подкуба
 		///</summary>
-		static void diffusion(T& pivot, int iteration)
+		static long long equal_share(const vector<long long>& counts, int rank, long long equal, double share = 0.5)
 		{
-			int rank = mpi::getRank(MPI_COMM_WORLD),
-				size = mpi::getSize(MPI_COMM_WORLD);
-			int root = (iteration == log2(size))
-				? 0 : ((rank >> iteration) << iteration);
-			int relative = rank - root;
+			long long total[3] = { 0, 0, 0 },
+					  before   = 0;
+			for (size_t pe = 0; pe < counts.size() / 3; pe++) {
+				for (auto k = 0; k < 3; k++)
+					total[k] += counts[3 * pe + k];
+				if (static_cast<int>(pe) < rank)
+					before += counts[3 * pe + 1];
+			}
+			// Сколько равных элементов нужно младшей половине всего подкуба
+			auto wanted = std::min(std::max(static_cast<long long>(total[2] * share) - total[0], 0LL), total[1]);
+			return std::min(std::max(wanted - before, 0LL), equal);
+		}
 
+		///<summary>
+		/// Обмен данными с соседним процессом не текущей итерации.
+		/// Отдаваемая часть уходит прямо из памяти слайса, принятое
+		/// пишется в result рядом с местом для оставленной части kept
+		///</summary>
+		void exchange(round& r, array_view<const T> outgoing, size_t kept, shared_array<T>& result)
+		{
+			// Отправляемая часть отсортирована,
+			// так что её выгодно передавать в дельта-кодировании
+			auto sent = mpi::wire::stats().wire_bytes;
+			mpi::sendreceive(outgoing, [&](int received) {
+				count(result.fit(kept + received));
+				// Младшая половина принимает старшие элементы в конец
+				return result.get() + (r.lower ? kept : 0);
+			}, r.neighbor, r.neighbor, 666, mpi::wire::mode(), r.buffers, _comm);
+			sent = mpi::wire::stats().wire_bytes - sent;
+			_stats.round_bytes[&r - _rounds.data()] += sent;
+			_stats.locality_bytes[static_cast<int>(r.where)] += sent;
+		}
+
+		///<summary>
+		/// Шаги рассылки опорного элемента на итерации
+		///</summary>
+		vector<diffusion_step> diffusion_steps(int iteration) const
+		{
+			int root = (iteration == _dim)
+				? 0 : ((_rank >> iteration) << iteration);
+			int relative = _rank - root;
+
+			vector<diffusion_step> steps{};
 			for(auto k = 0; k < iteration; k++) {
 				if (relative < (0x1 << k)) {
 					// Отправка опорного элемента
-					mpi::send(pivot, rank + (0x1 << k), 666);
+					steps.push_back({ _rank + (0x1 << k), true });
 				}
 				else if (relative < (0x1 << (k + 1))) {
 					// Получение опорного элемента
-					pivot = mpi::receive<T>(rank - (0x1 << k), 666);
+					steps.push_back({ _rank - (0x1 << k), false });
 				}
 			}
+			return steps;
 		}
 
 		///<summary>
-		/// Итеративная часть алгоритма параллельной сортировки
+		/// Отправка и получение опорного элемента
 		///</summary>
-		static void qsortpart(shared_array<T>& slice)
+		void diffusion(T& pivot, const round& r)
 		{
-			auto rank = mpi::getRank(MPI_COMM_WORLD),
-				 size = mpi::getSize(MPI_COMM_WORLD);
+			MPIEXT_TRACE_SCOPE("sorter.diffusion", -1, 666, sizeof(T), _comm);
+			for (const auto& step : r.diffusion) {
+				if (step.send)
+					mpi::send(pivot, step.peer, 666, _comm);
+				else
+					pivot = mpi::receive<T>(step.peer, 666, _comm);
+			}
+		}
 
-			// Размерность гиперкуба
-			int dim  = log2(size),
-				slen = slice.size();
+		///<summary>
+		/// Итеративная часть алгоритма параллельной сортировки
+		///</summary>
+		void qsortpart(shared_array<T>& slice)
+		{
 			// Опорная точка
-			T pivot = 0;
-			// Массивы значений > и < чем опорный
-			shared_array<T> highPart{}, lowPart{};
+			T pivot{};
+			// Слайс сортируется один раз, дальше слияние
+			// сохраняет порядок. На одном процессе итераций нет
+			auto computed = MPI_Wtime();
+			simd::sort(slice.get(), slice.get() + slice.size(), _less);
+			compact(slice);
+			_stats.compute_seconds += MPI_Wtime() - computed;
 			//
-			for(auto i = dim; i > 0; i--) {
+			for(auto i = _dim; i > 0; i--) {
+				auto& r = _rounds[i - 1];
 
 				// Выбираем опорную точку
-				if (slen != 0) {
-					pivot = select_pivot(slice);
+				computed = MPI_Wtime();
+				if (slice.size() != 0) {
+					pivot = select_pivot(slice, r.lower_share);
 				}
+				_stats.compute_seconds += MPI_Wtime() - computed;
 
 				// Рассылаем её соседним процессам
 				// на текущей итерации
-				diffusion(pivot, i);
+				auto moved = MPI_Wtime();
+				diffusion(pivot, r);
+				_stats.transfer_seconds += MPI_Wtime() - moved;
 
-				// Разбиваем исходный массив на части
-				// больше и меньше опорного элемента
-				partition(pivot, slice, lowPart, highPart);
+				// Разбиваем массив на части меньше и больше
+				// опорного элемента без копирования.
+				// Подкуб текущей итерации нужен для баланса равных элементов
+				computed = MPI_Wtime();
+				auto split = partition(pivot, slice, r.subcube, r.lower_share, _less);
+				array_view<const T> low(slice.get(), split),
+									high(slice.get() + split, slice.size() - split);
+				auto kept = r.lower ? low : high;
+				_stats.compute_seconds += MPI_Wtime() - computed;
 
 				// Обмен частями массива с соседними
-				// элементами
-				if (!(rank >> (i - 1) & 0x1)) {
-					exchange(highPart, i, true);
-				} else {
-					exchange(lowPart, i, false);
-				}
-				// Слияние частей в новый массив 
-				merge(slice, highPart, lowPart);
+				// элементами: принятое сразу ложится в место слияния
+				moved = MPI_Wtime();
+				exchange(r, r.lower ? high : low, kept.size(), _merged);
+				_stats.transfer_seconds += MPI_Wtime() - moved;
+
+				// Слияние оставленной и полученной частей,
+				// новый слайс меняется местами со старым
+				computed = MPI_Wtime();
+				merge(kept, _merged, !r.lower, _less);
+				slice.swap(_merged);
+				compact(slice);
+				_stats.compute_seconds += MPI_Wtime() - computed;
 			}
+			_stats.last_slice = slice.size();
 		}
 
+		///<summary>
+		/// Слияние серий равных в отсортированном слайсе (см. collapse)
+		///</summary>
+		void compact(shared_array<T>& slice) {
+			if (!_combine || slice.size() < 2)
+				return;
+			size_t last = 0;
+			for (size_t i = 1; i < slice.size(); i++) {
+				if (_less(slice[last], slice[i]))
+					slice[++last] = slice[i];
+				else
+					_combine(slice[last], slice[i]);
+			}
+			_stats.collapsed += slice.size() - (last + 1);
+			slice.truncate(last + 1);
+		}
+
+		///<summary>
+		/// Учёт перевыделения буфера
+		///</summary>
+		void count(bool allocated) {
+			if (allocated)
+				_stats.allocations++;
+		}
+
+	public:
 		///<summary>
 		/// Сбор собственных частей массива в корневой процесс
 		///</summary>
@@ -182,6 +587,42 @@ namespace mpi {
 			return mpi::scatter(data, groups, 0);
 		}
 
+	private:
+		///<summary>
+		/// Размеры частей массива для рассылки процессам
+		/// (пересчитываются при смене размера или производительности)
+		///</summary>
+		void plan_groups(shared_array<T>& data)
+		{
+			if (_groupsFor == data.size() && !_groups.empty())
+				return;
+			T* raw = data.get();
+			_groups = _capacities.empty()
+				? distance(slice(raw, raw + data.size(), _size))
+				: weighted_groups(data.size());
+			_groupsFor = data.size();
+		}
+
+		///<summary>
+		/// Размеры частей массива из size элементов,
+		/// пропорциональные производительности процессов
+		///</summary>
+		vector<int> weighted_groups(size_t size) const
+		{
+			auto total = std::accumulate(_capacities.begin(), _capacities.end(), 0.0);
+			vector<int> groups(_size);
+			double before = 0;
+			size_t from = 0;
+			for (auto pe = 0; pe < _size; pe++) {
+				before += _capacities[pe];
+				auto to = pe + 1 == _size ? size : static_cast<size_t>(size * (before / total));
+				to = std::max(std::min(to, size), from);
+				groups[pe] = static_cast<int>(to - from);
+				from = to;
+			}
+			return groups;
+		}
+
 		/// <summary>
 		/// Разрезает массив на N групп
 		/// </summary>
@@ -217,7 +658,7 @@ namespace mpi {
 		/// размеру i-го слайса
 		/// </summary>
 		template<typename It>
-		static vector<int> distance(vector<pair<It, It>>& slices)
+		static vector<int> distance(const vector<pair<It, It>>& slices)
 		{
 			vector<int> distances{};
 			distances.reserve(slices.size());
@@ -227,8 +668,7 @@ namespace mpi {
 		}
 
 	public:
-		// Класс статический, так что удаляем это всё
-		sorter() = delete;
+		// Экземпляр владеет ресурсами MPI, копировать его нельзя
 		sorter(sorter&) = delete;
 		sorter(sorter&&) = delete;
 		sorter& operator=(const sorter&) = delete;
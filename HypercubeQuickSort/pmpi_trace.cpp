@@ -0,0 +1,140 @@
+﻿// Перехват вызовов MPI через профилирующий интерфейс (PMPI).
+// Записывает в журнал mpi::trace вызовы, сделанные в обход
+// обёрток mpiext.h, в том числе в сторонних библиотеках.
+// В основной сборке не участвует, подключается компоновкой:
+//   mpicxx -std=c++14 -O2 hypercubesort.cpp random.cpp pmpi_trace.cpp -o hypercubesort
+// Журнал пишется в MPIEXT_TRACE_FILE (по умолчанию trace.json) при MPI_Finalize.
+// Вместе с MPIEXT_TRACE вызовы внутри обёрток видны вложенными в них
+
+#include <mpi.h>
+#include "trace.h"
+
+namespace {
+	///<summary>
+	/// Объём count элементов типа type в байтах
+	///</summary>
+	long long bytes(int count, MPI_Datatype type)
+	{
+		int size = 0;
+		PMPI_Type_size(type, &size);
+		return static_cast<long long>(count) * size;
+	}
+
+	///<summary>
+	/// Замер вызова MPI до конца блока
+	///</summary>
+	struct call : mpi::trace_scope {
+		call(const char* name, int peer, int tag, long long bytes, MPI_Comm comm)
+			: mpi::trace_scope("mpi", name, peer, tag, bytes, comm)
+		{ }
+	};
+}
+
+extern "C" {
+
+int MPI_Init(int* argc, char*** argv)
+{
+	auto result = PMPI_Init(argc, argv);
+	mpi::trace::align();
+	return result;
+}
+
+int MPI_Init_thread(int* argc, char*** argv, int required, int* provided)
+{
+	auto result = PMPI_Init_thread(argc, argv, required, provided);
+	mpi::trace::align();
+	return result;
+}
+
+int MPI_Finalize()
+{
+	mpi::trace::flush();
+	return PMPI_Finalize();
+}
+
+int MPI_Send(const void* buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm)
+{
+	call scope("MPI_Send", dest, tag, bytes(count, type), comm);
+	return PMPI_Send(buf, count, type, dest, tag, comm);
+}
+
+int MPI_Recv(void* buf, int count, MPI_Datatype type, int source, int tag, MPI_Comm comm, MPI_Status* status)
+{
+	call scope("MPI_Recv", source, tag, bytes(count, type), comm);
+	return PMPI_Recv(buf, count, type, source, tag, comm, status);
+}
+
+int MPI_Sendrecv(const void* sendbuf, int sendcount, MPI_Datatype sendtype, int dest, int sendtag,
+	void* recvbuf, int recvcount, MPI_Datatype recvtype, int source, int recvtag, MPI_Comm comm, MPI_Status* status)
+{
+	call scope("MPI_Sendrecv", dest, sendtag, bytes(sendcount, sendtype), comm);
+	return PMPI_Sendrecv(sendbuf, sendcount, sendtype, dest, sendtag,
+		recvbuf, recvcount, recvtype, source, recvtag, comm, status);
+}
+
+int MPI_Wait(MPI_Request* request, MPI_Status* status)
+{
+	call scope("MPI_Wait", -1, -1, 0, MPI_COMM_NULL);
+	return PMPI_Wait(request, status);
+}
+
+int MPI_Waitall(int count, MPI_Request requests[], MPI_Status statuses[])
+{
+	call scope("MPI_Waitall", -1, -1, 0, MPI_COMM_NULL);
+	return PMPI_Waitall(count, requests, statuses);
+}
+
+int MPI_Barrier(MPI_Comm comm)
+{
+	call scope("MPI_Barrier", -1, -1, 0, comm);
+	return PMPI_Barrier(comm);
+}
+
+int MPI_Bcast(void* buffer, int count, MPI_Datatype type, int root, MPI_Comm comm)
+{
+	call scope("MPI_Bcast", root, -1, bytes(count, type), comm);
+	return PMPI_Bcast(buffer, count, type, root, comm);
+}
+
+int MPI_Allreduce(const void* sendbuf, void* recvbuf, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm)
+{
+	call scope("MPI_Allreduce", -1, -1, bytes(count, type), comm);
+	return PMPI_Allreduce(sendbuf, recvbuf, count, type, op, comm);
+}
+
+int MPI_Allgather(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+	void* recvbuf, int recvcount, MPI_Datatype recvtype, MPI_Comm comm)
+{
+	call scope("MPI_Allgather", -1, -1, bytes(sendcount, sendtype), comm);
+	return PMPI_Allgather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm);
+}
+
+int MPI_Gather(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+	void* recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm)
+{
+	call scope("MPI_Gather", root, -1, bytes(sendcount, sendtype), comm);
+	return PMPI_Gather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm);
+}
+
+int MPI_Gatherv(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+	void* recvbuf, const int recvcounts[], const int displs[], MPI_Datatype recvtype, int root, MPI_Comm comm)
+{
+	call scope("MPI_Gatherv", root, -1, bytes(sendcount, sendtype), comm);
+	return PMPI_Gatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype, root, comm);
+}
+
+int MPI_Scatterv(const void* sendbuf, const int sendcounts[], const int displs[], MPI_Datatype sendtype,
+	void* recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm)
+{
+	call scope("MPI_Scatterv", root, -1, bytes(recvcount, recvtype), comm);
+	return PMPI_Scatterv(sendbuf, sendcounts, displs, sendtype, recvbuf, recvcount, recvtype, root, comm);
+}
+
+int MPI_Alltoallv(const void* sendbuf, const int sendcounts[], const int sdispls[], MPI_Datatype sendtype,
+	void* recvbuf, const int recvcounts[], const int rdispls[], MPI_Datatype recvtype, MPI_Comm comm)
+{
+	call scope("MPI_Alltoallv", -1, -1, 0, comm);
+	return PMPI_Alltoallv(sendbuf, sendcounts, sdispls, sendtype, recvbuf, recvcounts, rdispls, recvtype, comm);
+}
+
+}
@@ -2,6 +2,6 @@
 
 namespace mpi
 {
-	bool random::_initialized = false;
-	std::mt19937 random::_rnd = std::mt19937();
+	MPIEXT_RANK_LOCAL bool random::_initialized = false;
+	MPIEXT_RANK_LOCAL std::mt19937 random::_rnd = std::mt19937();
 }
\ No newline at end of file
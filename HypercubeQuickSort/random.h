@@ -1,6 +1,7 @@
 ﻿#pragma once
 #include <random>
 #include <algorithm>
+#include "mpi_backend.h"
 
 namespace mpi
 {
@@ -25,8 +26,8 @@ namespace mpi
 			random & operator=(const random&) = delete;
 
 		private:
-			static engine _rnd;
-			static bool _initialized;
+			static MPIEXT_RANK_LOCAL engine _rnd;
+			static MPIEXT_RANK_LOCAL bool _initialized;
 			static void init() {
 				if (_initialized) return;
 				_rnd.seed(std::random_device()());
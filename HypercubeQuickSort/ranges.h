@@ -0,0 +1,249 @@
+﻿#pragma once
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <type_traits>
+#include <vector>
+#include "mpiext.h"
+#include "parallel.h"
+#include "shared_array.h"
+#include "array_view.h"
+
+namespace mpi {
+	using std::vector;
+
+	///<summary>
+	/// Сравнение по проекции: less(proj(a), proj(b))
+	///</summary>
+	template<typename Proj, typename Compare> struct projected {
+		Proj proj;
+		Compare less;
+
+		template<typename T>
+		bool operator()(const T& a, const T& b) const { return less(proj(a), proj(b)); }
+	};
+
+	template<typename Proj, typename Compare = std::less<>>
+	projected<Proj, Compare> by(Proj proj, Compare less = Compare()) {
+		return { proj, less };
+	}
+
+	namespace traits {
+		// Отображение ключей, после которого порядок Compare - возрастание.
+		// Такие порядки сортирует общий sorter<T> с векторными ядрами
+		template<typename T, typename Compare, typename = void>
+		struct order_map : std::false_type {};
+
+		template<typename T>
+		struct order_map<T, std::less<T>> : std::true_type {
+			static T encode(const T& value) { return value; }
+			static T decode(const T& value) { return value; }
+		};
+
+		// Целые по убыванию: ~x переворачивает порядок без переполнения
+		template<typename T>
+		struct order_map<T, std::greater<T>, typename std::enable_if<std::is_integral<T>::value>::type> : std::true_type {
+			static T encode(const T& value) { return ~value; }
+			static T decode(const T& value) { return ~value; }
+		};
+
+		// Вещественные по убыванию: смена знака
+		template<typename T>
+		struct order_map<T, std::greater<T>, typename std::enable_if<std::is_floating_point<T>::value>::type> : std::true_type {
+			static T encode(const T& value) { return -value; }
+			static T decode(const T& value) { return -value; }
+		};
+
+		template<typename T>
+		struct order_map<T, std::less<>> : order_map<T, std::less<T>> {};
+		template<typename T>
+		struct order_map<T, std::greater<>> : order_map<T, std::greater<T>> {};
+	}
+
+	///<summary>
+	/// Вспомогательные операции сортировки чужих диапазонов
+	///</summary>
+	class ranges {
+	public:
+		ranges() = delete;
+		ranges(const ranges&) = delete;
+		ranges& operator=(const ranges&) = delete;
+
+	public:
+		///<summary>
+		/// Размер диапазона корня на всех процессах (коллективно)
+		///</summary>
+		static size_t root_size(size_t size, MPI_Comm comm = MPI_COMM_WORLD) {
+			long long count = static_cast<long long>(size);
+			MPI_Bcast(&count, 1, MPI_LONG_LONG, 0, comm);
+			return static_cast<size_t>(count);
+		}
+
+		///<summary>
+		/// Перераспределение упорядоченных по рангу слайсов так, чтобы
+		/// у процесса стало target элементов, порядок сохраняется (коллективно).
+		/// Сумма target по процессам равна сумме размеров слайсов
+		///</summary>
+		template<typename T>
+		static shared_array<T> rebalance(const shared_array<T>& sorted, size_t target, MPI_Comm comm = MPI_COMM_WORLD)
+		{
+			auto rank = mpi::getRank(comm), size = mpi::getSize(comm);
+			auto have = mpi::allgather(static_cast<long long>(sorted.size()), comm),
+				 want = mpi::allgather(static_cast<long long>(target), comm);
+			// Начала слайсов в общем порядке до и после
+			vector<long long> haveStart(size + 1, 0), wantStart(size + 1, 0);
+			for (auto pe = 0; pe < size; pe++) {
+				haveStart[pe + 1] = haveStart[pe] + have[pe];
+				wantStart[pe + 1] = wantStart[pe] + want[pe];
+			}
+			auto overlap = [](long long from, long long to, long long otherFrom, long long otherTo) {
+				return static_cast<int>(std::max(0LL, std::min(to, otherTo) - std::max(from, otherFrom)));
+			};
+			vector<int> sendcounts(size), recvcounts(size), sdispls(size, 0), rdispls(size, 0);
+			for (auto pe = 0; pe < size; pe++) {
+				sendcounts[pe] = overlap(haveStart[rank], haveStart[rank + 1], wantStart[pe], wantStart[pe + 1]);
+				recvcounts[pe] = overlap(wantStart[rank], wantStart[rank + 1], haveStart[pe], haveStart[pe + 1]);
+				if (pe > 0) {
+					sdispls[pe] = sdispls[pe - 1] + sendcounts[pe - 1];
+					rdispls[pe] = rdispls[pe - 1] + recvcounts[pe - 1];
+				}
+			}
+			shared_array<T> result(target, allocation::uninitialized());
+			auto type = get_mpi_datatype<T>();
+			MPI_Alltoallv(sorted.get(), sendcounts.data(), sdispls.data(), type,
+				result.get(), recvcounts.data(), rdispls.data(), type, comm);
+			return result;
+		}
+	};
+
+	template<typename T, typename Compare, bool Mapped = traits::order_map<T, Compare>::value>
+	class range_sort;
+
+	///<summary>
+	/// Порядок сводится к возрастанию: ключи отображаются,
+	/// сортируются общими экземплярами sorter<T> и возвращаются
+	///</summary>
+	template<typename T, typename Compare>
+	class range_sort<T, Compare, true> {
+		typedef traits::order_map<T, Compare> map;
+	public:
+		static void root(array_view<T> range, Compare) {
+			auto rank = mpi::getRank(MPI_COMM_WORLD);
+			shared_array<T> data(ranges::root_size(range.size()), allocation::uninitialized());
+			if (rank == 0)
+				std::transform(range.begin(), range.end(), std::begin(data), map::encode);
+			sorter<T>::shared_mapped().run(data);
+			if (rank == 0)
+				std::transform(std::begin(data), std::end(data), range.begin(), map::decode);
+		}
+
+		static void slices(array_view<T> range, Compare) {
+			shared_array<T> data(range.size(), allocation::uninitialized());
+			std::transform(range.begin(), range.end(), std::begin(data), map::encode);
+			sorter<T>::shared().run_slice(data);
+			data = ranges::rebalance(data, range.size());
+			std::transform(std::begin(data), std::end(data), range.begin(), map::decode);
+		}
+
+	public:
+		range_sort() = delete;
+	};
+
+	///<summary>
+	/// Произвольный порядок: sorter<T, Compare>. Для сравнений без
+	/// состояния экземпляры общие, иначе создаются на вызов
+	///</summary>
+	template<typename T, typename Compare>
+	class range_sort<T, Compare, false> {
+		typedef sorter<T, Compare> engine;
+	public:
+		static void root(array_view<T> range, Compare less) {
+			apply(less, mapping::topology, std::is_empty<Compare>(), [range](engine& e) {
+				auto rank = mpi::getRank(MPI_COMM_WORLD);
+				shared_array<T> data(ranges::root_size(range.size()), allocation::uninitialized());
+				if (rank == 0)
+					std::copy(range.begin(), range.end(), std::begin(data));
+				e.run(data);
+				if (rank == 0)
+					std::copy(std::begin(data), std::end(data), range.begin());
+			});
+		}
+
+		static void slices(array_view<T> range, Compare less) {
+			apply(less, mapping::identity, std::is_empty<Compare>(), [range](engine& e) {
+				shared_array<T> data(range.size(), allocation::uninitialized());
+				std::copy(range.begin(), range.end(), std::begin(data));
+				e.run_slice(data);
+				data = ranges::rebalance(data, range.size());
+				std::copy(std::begin(data), std::end(data), range.begin());
+			});
+		}
+
+	private:
+		template<typename F>
+		static void apply(Compare less, mapping map, std::true_type, F body) {
+			body(map == mapping::topology ? cached_mapped(less) : cached(less));
+		}
+
+		template<typename F>
+		static void apply(Compare less, mapping map, std::false_type, F body) {
+			engine local(MPI_COMM_WORLD, map, 0, less);
+			body(local);
+		}
+
+		static engine& cached(Compare less) {
+			static MPIEXT_RANK_LOCAL engine _instance{ MPI_COMM_WORLD, mapping::identity, 0, less };
+			return _instance;
+		}
+
+		static engine& cached_mapped(Compare less) {
+			static MPIEXT_RANK_LOCAL engine _instance{ MPI_COMM_WORLD, mapping::topology, 0, less };
+			return _instance;
+		}
+
+	public:
+		range_sort() = delete;
+	};
+
+	///<summary>
+	/// Сортировка диапазона процесса 0 на месте в порядке less (коллективно).
+	/// Размер берётся с процесса 0, диапазоны остальных не используются.
+	/// std::less и std::greater на базовых типах идут векторным путём
+	///</summary>
+	template<typename T, typename Compare = std::less<T>>
+	void sort(array_view<T> range, Compare less = Compare()) {
+		range_sort<T, Compare>::root(range, less);
+	}
+
+	template<typename It, typename Compare = std::less<typename std::iterator_traits<It>::value_type>>
+	void sort(It first, It last, Compare less = Compare()) {
+		typedef typename std::iterator_traits<It>::value_type T;
+		sort(array_view<T>(first == last ? nullptr : &*first, static_cast<size_t>(last - first)), less);
+	}
+
+	template<typename T, typename A, typename Compare = std::less<T>>
+	void sort(std::vector<T, A>& values, Compare less = Compare()) {
+		sort(array_view<T>(values), less);
+	}
+
+	///<summary>
+	/// Сортировка распределённых диапазонов на месте (коллективно):
+	/// после вызова диапазоны по порядку рангов упорядочены,
+	/// у каждого процесса прежнее число элементов
+	///</summary>
+	template<typename T, typename Compare = std::less<T>>
+	void sort_slice(array_view<T> range, Compare less = Compare()) {
+		range_sort<T, Compare>::slices(range, less);
+	}
+
+	template<typename It, typename Compare = std::less<typename std::iterator_traits<It>::value_type>>
+	void sort_slice(It first, It last, Compare less = Compare()) {
+		typedef typename std::iterator_traits<It>::value_type T;
+		sort_slice(array_view<T>(first == last ? nullptr : &*first, static_cast<size_t>(last - first)), less);
+	}
+
+	template<typename T, typename A, typename Compare = std::less<T>>
+	void sort_slice(std::vector<T, A>& values, Compare less = Compare()) {
+		sort_slice(array_view<T>(values), less);
+	}
+}
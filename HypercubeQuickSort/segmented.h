@@ -0,0 +1,205 @@
+﻿#pragma once
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <numeric>
+#include <queue>
+#include <vector>
+#include "mpiext.h"
+#include "parallel.h"
+#include "shared_array.h"
+#include "simd.h"
+
+namespace mpi {
+	using std::vector;
+
+	///<summary>
+	/// Сортировка пакета независимых сегментов одним вызовом.
+	/// Сегмент i массива корневого процесса - [offsets[i], offsets[i + 1]).
+	/// Малые сегменты целиком раздаются процессам жадной упаковкой по
+	/// стоимости n log n (самый дорогой - самому свободному процессу) и
+	/// едут одним MPI_Scatterv и одним MPI_Gatherv на весь пакет.
+	/// Сегменты дороже доли процесса сортируются гиперкубом
+	///</summary>
+	template<typename T> class segmented_sorter {
+	public:
+		struct statistics {
+			unsigned long long calls = 0;
+			unsigned long long segments = 0;
+			unsigned long long parallel_segments = 0;  // Отданы гиперкубу
+			double imbalance = 0;       // Наибольшая стоимость процесса к средней, последний вызов
+			double total_seconds = 0;
+			double transfer_seconds = 0;
+			double compute_seconds = 0;
+		};
+
+		// Меньшие сегменты гиперкубу не отдаются
+		static const size_t minimum_parallel = 1 << 15;
+
+	private:
+		MPI_Comm _comm;
+		int _rank, _size;
+		sorter<T> _sorter;
+		// Сегменты: границы и владелец (-1 - гиперкуб)
+		vector<long long> _offsets;
+		vector<int> _owner, _counts;
+		shared_array<T> _packed, _slice, _segment;
+		collective_buffers _collective;
+		statistics _stats;
+
+	public:
+		///<summary>
+		/// Коллективно
+		///</summary>
+		explicit segmented_sorter(MPI_Comm comm = MPI_COMM_WORLD)
+			: _comm(comm), _rank(mpi::getRank(comm)), _size(mpi::getSize(comm)), _sorter(comm)
+		{ }
+
+		const statistics& stats() const { return _stats; }
+
+		///<summary>
+		/// Сортировка каждого сегмента data корневого процесса на месте.
+		/// offsets - границы сегментов по возрастанию, offsets.back() <= data.size();
+		/// значимы только на корне, остальные процессы получают их рассылкой
+		///</summary>
+		void run(shared_array<T>& data, const vector<size_t>& offsets) {
+			auto start = MPI_Wtime();
+			auto moved = MPI_Wtime();
+			share(offsets);
+			_stats.transfer_seconds += MPI_Wtime() - moved;
+			auto segments = _offsets.empty() ? 0 : _offsets.size() - 1;
+			plan(segments);
+
+			// Малые сегменты: упаковка по владельцам, одна рассылка
+			if (_rank == 0) {
+				_packed.fit(static_cast<size_t>(std::accumulate(_counts.begin(), _counts.end(), 0LL)));
+				auto into = _packed.get();
+				for (auto pe = 0; pe < _size; pe++)
+					for (size_t i = 0; i < segments; i++)
+						if (_owner[i] == pe)
+							into = std::copy(data.get() + _offsets[i], data.get() + _offsets[i + 1], into);
+			}
+			moved = MPI_Wtime();
+			mpi::scatter(_packed.get(), _packed.size(), _counts, _slice, 0, _collective, _comm);
+			_stats.transfer_seconds += MPI_Wtime() - moved;
+
+			auto computed = MPI_Wtime();
+			auto from = _slice.get();
+			for (size_t i = 0; i < segments; i++) {
+				if (_owner[i] != _rank)
+					continue;
+				auto length = static_cast<size_t>(_offsets[i + 1] - _offsets[i]);
+				simd::sort(from, from + length);
+				from += length;
+			}
+			_stats.compute_seconds += MPI_Wtime() - computed;
+
+			moved = MPI_Wtime();
+			mpi::gather(_slice.get(), static_cast<int>(_slice.size()), _packed, 0, _collective, _comm);
+			_stats.transfer_seconds += MPI_Wtime() - moved;
+			if (_rank == 0) {
+				auto packed = _packed.get();
+				for (auto pe = 0; pe < _size; pe++)
+					for (size_t i = 0; i < segments; i++)
+						if (_owner[i] == pe) {
+							auto length = static_cast<size_t>(_offsets[i + 1] - _offsets[i]);
+							std::copy(packed, packed + length, data.get() + _offsets[i]);
+							packed += length;
+						}
+			}
+
+			// Большие сегменты по одному через гиперкуб
+			for (size_t i = 0; i < segments; i++) {
+				if (_owner[i] >= 0)
+					continue;
+				auto length = static_cast<size_t>(_offsets[i + 1] - _offsets[i]);
+				_segment.fit(length);
+				if (_rank == 0)
+					std::copy(data.get() + _offsets[i], data.get() + _offsets[i + 1], _segment.get());
+				_sorter.run(_segment);
+				if (_rank == 0)
+					std::copy(_segment.get(), _segment.get() + length, data.get() + _offsets[i]);
+				_stats.parallel_segments++;
+			}
+			_stats.segments += segments;
+			_stats.calls++;
+			_stats.total_seconds += MPI_Wtime() - start;
+		}
+
+		///<summary>
+		/// Общий экземпляр для MPI_COMM_WORLD (коллективно при первом вызове)
+		///</summary>
+		static segmented_sorter& shared() {
+			static MPIEXT_RANK_LOCAL segmented_sorter _instance{};
+			return _instance;
+		}
+
+		static void sort(shared_array<T>& data, const vector<size_t>& offsets) {
+			shared().run(data, offsets);
+		}
+
+	private:
+		///<summary>
+		/// Границы сегментов корня на всех процессах
+		///</summary>
+		void share(const vector<size_t>& offsets) {
+			long long count = _rank == 0 ? static_cast<long long>(offsets.size()) : 0;
+			MPI_Bcast(&count, 1, MPI_LONG_LONG, 0, _comm);
+			_offsets.resize(static_cast<size_t>(count));
+			if (_rank == 0)
+				std::copy(offsets.begin(), offsets.end(), _offsets.begin());
+			MPI_Bcast(_offsets.data(), static_cast<int>(count), MPI_LONG_LONG, 0, _comm);
+		}
+
+		///<summary>
+		/// Владельцы сегментов. Все процессы считают одинаково, поэтому
+		/// план не пересылается. Сегмент дороже средней доли процесса
+		/// упаковкой не уравновесить - он идёт гиперкубу
+		///</summary>
+		void plan(size_t segments) {
+			auto cost = [this](size_t i) {
+				auto length = static_cast<double>(_offsets[i + 1] - _offsets[i]);
+				return length * std::log2(length + 2);
+			};
+			_owner.assign(segments, -1);
+			vector<size_t> order(segments);
+			std::iota(order.begin(), order.end(), 0);
+			std::stable_sort(order.begin(), order.end(), [&cost](size_t a, size_t b) { return cost(a) > cost(b); });
+			double remaining = 0;
+			for (auto i : order)
+				remaining += cost(i);
+			// Доля считается по оставшимся сегментам
+			auto first = order.begin();
+			while (_size > 1 && first != order.end()
+				&& _offsets[*first + 1] - _offsets[*first] >= static_cast<long long>(minimum_parallel)
+				&& cost(*first) > remaining / _size)
+				remaining -= cost(*first++);
+			order.erase(order.begin(), first);
+
+			// Самый дорогой из оставшихся - наименее загруженному
+			typedef std::pair<double, int> load;
+			std::priority_queue<load, vector<load>, std::greater<load>> loads{};
+			for (auto pe = 0; pe < _size; pe++)
+				loads.push({ 0.0, pe });
+			_counts.assign(_size, 0);
+			for (auto i : order) {
+				auto least = loads.top();
+				loads.pop();
+				_owner[i] = least.second;
+				_counts[least.second] += static_cast<int>(_offsets[i + 1] - _offsets[i]);
+				loads.push({ least.first + cost(i), least.second });
+			}
+			double sum = 0, worst = 0;
+			while (!loads.empty()) {
+				sum += loads.top().first;
+				worst = std::max(worst, loads.top().first);
+				loads.pop();
+			}
+			_stats.imbalance = sum > 0 ? worst * _size / sum : 1;
+		}
+
+	public:
+		segmented_sorter(const segmented_sorter&) = delete;
+		segmented_sorter& operator=(const segmented_sorter&) = delete;
+	};
+}
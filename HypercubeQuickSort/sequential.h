@@ -1,6 +1,7 @@
 ﻿#pragma once
 #include <vector>
 #include "random.h"
+#include "simd.h"
 
 namespace sequential {
 	template <typename T, typename Container = std::vector<T>>
@@ -21,12 +22,19 @@ namespace sequential {
 	template <typename T, typename Container = std::vector<T>>
 	void quicksort(Container& array, size_t left, size_t right) {
 		if (left < right) {
+			// Короткие участки - сортирующей сетью
+			if (right - left < mpi::simd::block) {
+				mpi::simd::sort_block(&array[left], right - left + 1);
+				return;
+			}
 			// Выбираем случайным образом оп. элемент
 			int pivot = mpi::random::integer(left, right);
 			// Разделяем массив на две части по опороному элементу, 
 			// а также возвращаем новый опорный элемент
 			size_t new_pivot = partition<T>(array, pivot, left, right);
-			quicksort<T>(array, left, new_pivot - 1);
+			// Опорный мог встать первым: new_pivot - 1 перевалит через ноль
+			if (new_pivot > left)
+				quicksort<T>(array, left, new_pivot - 1);
 			quicksort<T>(array, new_pivot + 1, right);
 		}
 	}
@@ -1,41 +1,325 @@
 ﻿#pragma once
 #include <vector>
 #include <memory>
+#include <cstddef>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <new>
+#include <atomic>
+#include <utility>
+#include <type_traits>
+#include "mpi_backend.h"
+#ifdef _WIN32
+	#ifndef NOMINMAX
+		#define NOMINMAX
+	#endif
+	#include <windows.h>
+	#include <malloc.h>
+#else
+	#include <sys/mman.h>
+	#include <sys/syscall.h>
+	#include <unistd.h>
+#endif
 
 namespace mpi {
 	using std::vector;
 	using std::shared_ptr;
 
+	// Размер страниц блока
+	enum class page_kind {
+		normal,            // Обычные страницы
+		transparent_huge,  // Прозрачные большие страницы (madvise), на Windows - обычные
+		explicit_huge      // Явные большие страницы (MAP_HUGETLB, MEM_LARGE_PAGES),
+		                   // при нехватке - прозрачные
+	};
+
+	///<summary>
+	/// Политика выделения памяти массива
+	///</summary>
+	struct allocation {
+		bool zeroed;       // Заполнить блок нулями
+		size_t alignment;  // Выравнивание в байтах, 0 - естественное для типа
+		page_kind pages;   // Размер страниц
+		int numa_node;     // Привязка к узлу NUMA, -1 - узел первого касания
+
+		allocation(bool zeroed = true, size_t alignment = 0, page_kind pages = page_kind::normal, int numa_node = -1)
+			: zeroed(zeroed), alignment(alignment), pages(pages), numa_node(numa_node)
+		{ }
+
+		// Без заполнения: блок всё равно сразу перезаписывается
+		static allocation uninitialized() { return allocation(false); }
+		// Выравнивание по кэш-линии для SIMD
+		static allocation cache_aligned() { return allocation(false, 64); }
+		// Выравнивание по странице для RDMA
+		static allocation page_aligned() { return allocation(false, 4096); }
+		// Большие страницы
+		static allocation huge(page_kind pages = page_kind::transparent_huge) { return allocation(false, 0, pages); }
+		// Страницы на заданном узле NUMA
+		static allocation on_node(int node) { return allocation(false, 0, page_kind::normal, node); }
+	};
+
+	///<summary>
+	/// Выделение блоков памяти по политике и статистика выделений
+	///</summary>
+	class memory {
+	public:
+		// Откуда взят блок и как его освобождать
+		enum class source { array_new, heap, aligned, mapped };
+
+		// Выделенный блок
+		struct block {
+			void* data;
+			size_t bytes;   // Реальный размер (с округлением до страниц)
+			source from;
+		};
+
+		struct statistics {
+			std::atomic<unsigned long long> allocations{ 0 };
+			std::atomic<unsigned long long> bytes{ 0 };        // Выделено всего
+			std::atomic<unsigned long long> zeroed_bytes{ 0 }; // Из них заполнено нулями
+			std::atomic<unsigned long long> huge_bytes{ 0 };   // Из них на больших страницах
+			std::atomic<unsigned long long> live_bytes{ 0 };   // Занято сейчас
+			std::atomic<unsigned long long> peak_bytes{ 0 };   // Максимум занятого
+		};
+
+	public:
+		// Статистика процесса (все массивы ранга)
+		static statistics& stats() { static MPIEXT_RANK_LOCAL statistics _stats; return _stats; }
+
+		// Размер страницы
+		static size_t page_size() {
+#ifdef _WIN32
+			SYSTEM_INFO info;
+			GetSystemInfo(&info);
+			return info.dwPageSize;
+#else
+			return static_cast<size_t>(sysconf(_SC_PAGESIZE));
+#endif
+		}
+
+		///<summary>
+		/// Выделяет bytes байт по политике. natural - выравнивание типа
+		///</summary>
+		static block allocate(size_t bytes, const allocation& policy, size_t natural) {
+			auto align = policy.alignment > natural ? policy.alignment : natural;
+			block result{ nullptr, bytes, source::heap };
+			if (bytes == 0)
+				return result;
+			auto huge = false;
+			if (policy.pages != page_kind::normal || policy.numa_node >= 0) {
+				result = map(bytes, policy, huge);
+			} else if (align > alignof(std::max_align_t)) {
+#ifdef _WIN32
+				result.data = _aligned_malloc(bytes, align);
+#else
+				if (posix_memalign(&result.data, align, bytes) != 0)
+					result.data = nullptr;
+#endif
+				result.from = source::aligned;
+				if (result.data && policy.zeroed)
+					std::memset(result.data, 0, bytes);
+			} else {
+				// calloc не трогает страницы, которые ОС и так отдаёт нулевыми
+				result.data = policy.zeroed ? std::calloc(bytes, 1) : std::malloc(bytes);
+			}
+			if (!result.data)
+				throw std::bad_alloc();
+			auto& s = stats();
+			s.allocations++;
+			s.bytes += result.bytes;
+			if (policy.zeroed)
+				s.zeroed_bytes += result.bytes;
+			if (huge)
+				s.huge_bytes += result.bytes;
+			grow(result.bytes);
+			return result;
+		}
+
+		///<summary>
+		/// Освобождает блок, выделенный allocate
+		///</summary>
+		static void release(void* data, size_t bytes, source from) {
+			if (!data)
+				return;
+			switch (from) {
+			case source::heap:
+				std::free(data);
+				break;
+			case source::aligned:
+#ifdef _WIN32
+				_aligned_free(data);
+#else
+				std::free(data);
+#endif
+				break;
+			case source::mapped:
+#ifdef _WIN32
+				VirtualFree(data, 0, MEM_RELEASE);
+#else
+				munmap(data, bytes);
+#endif
+				break;
+			default:
+				break;
+			}
+			stats().live_bytes -= bytes;
+		}
+
+		///<summary>
+		/// Учёт блока, выделенного через new[]
+		///</summary>
+		static void track(size_t bytes) {
+			auto& s = stats();
+			s.allocations++;
+			s.bytes += bytes;
+			grow(bytes);
+		}
+
+	private:
+		static void grow(size_t bytes) {
+			auto& s = stats();
+			auto live = s.live_bytes += bytes;
+			auto peak = s.peak_bytes.load();
+			while (live > peak && !s.peak_bytes.compare_exchange_weak(peak, live)) { }
+		}
+
+		static size_t round_up(size_t bytes, size_t unit) {
+			return (bytes + unit - 1) / unit * unit;
+		}
+
+		///<summary>
+		/// Блок прямо из страниц ОС. Страницы не трогаются до первой
+		/// записи и уже заполнены нулями, так что zeroed ничего не стоит
+		///</summary>
+		static block map(size_t bytes, const allocation& policy, bool& huge) {
+			block result{ nullptr, round_up(bytes, page_size()), source::mapped };
+#ifdef _WIN32
+			if (policy.pages == page_kind::explicit_huge && GetLargePageMinimum() > 0) {
+				auto large = round_up(bytes, GetLargePageMinimum());
+				result.data = VirtualAlloc(nullptr, large, MEM_RESERVE | MEM_COMMIT | MEM_LARGE_PAGES, PAGE_READWRITE);
+				if (result.data) {
+					result.bytes = large;
+					huge = true;
+					return result;
+				}
+			}
+			result.data = policy.numa_node >= 0
+				? VirtualAllocExNuma(GetCurrentProcess(), nullptr, result.bytes, MEM_RESERVE | MEM_COMMIT,
+					PAGE_READWRITE, static_cast<DWORD>(policy.numa_node))
+				: VirtualAlloc(nullptr, result.bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+			const size_t hugePage = 2 << 20;
+			if (policy.pages == page_kind::explicit_huge) {
+	#ifdef MAP_HUGETLB
+				auto large = round_up(bytes, hugePage);
+				auto data = mmap(nullptr, large, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+				if (data != MAP_FAILED) {
+					result.data = data;
+					result.bytes = large;
+					huge = true;
+				}
+	#endif
+			}
+			if (!result.data) {
+				if (policy.pages != page_kind::normal)
+					result.bytes = round_up(bytes, hugePage);
+				auto data = mmap(nullptr, result.bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+				if (data == MAP_FAILED)
+					return result;
+				result.data = data;
+	#ifdef MADV_HUGEPAGE
+				if (policy.pages != page_kind::normal)
+					huge = madvise(data, result.bytes, MADV_HUGEPAGE) == 0;
+	#endif
+			}
+	#ifdef SYS_mbind
+			// Привязка до первого касания: MPOL_BIND на один узел (номер меньше 64)
+			if (policy.numa_node >= 0 && policy.numa_node < 64) {
+				unsigned long mask = 1UL << policy.numa_node;
+				const int bind = 2;
+				syscall(SYS_mbind, result.data, result.bytes, bind, &mask, sizeof(mask) * 8 + 1, 0);
+			}
+	#endif
+#endif
+			return result;
+		}
+
+	public:
+		// Класс статический
+		memory() = delete;
+		memory(memory&) = delete;
+		memory(memory&&) = delete;
+		memory& operator=(const memory&) = delete;
+	};
+
 	template<typename T> class shared_array
 	{
 	private:
-		struct deleter { void operator()(T* p) { delete[] p; } };
+		// Блоки простых типов выделяются по политике,
+		// остальным нужны конструкторы new[]
+		static constexpr bool raw = std::is_trivially_copyable<T>::value
+			&& std::is_trivially_default_constructible<T>::value;
+
+		struct deleter {
+			size_t bytes = 0;
+			memory::source from = memory::source::array_new;
+			void operator()(T* p) {
+				if (from == memory::source::array_new) {
+					delete[] p;
+					if (p && bytes)
+						memory::stats().live_bytes -= bytes;
+				} else {
+					memory::release(p, bytes, from);
+				}
+			}
+		};
 	private:
 		shared_ptr<T> _data;
 		size_t _size;
+		size_t _capacity;
+		allocation _policy;
 	public:
-		// 
-		shared_array() :_data(nullptr, deleter{}), _size(0) { };
+		//
+		shared_array() :_data(nullptr, deleter{}), _size(0), _capacity(0), _policy(allocation::uninitialized()) { };
 		//
 		shared_array(T* ndata, size_t nsize)
-			: _data(ndata, deleter{}), _size(nsize)
+			: _data(ndata, deleter{}), _size(nsize), _capacity(nsize), _policy(allocation::uninitialized())
 		{ }
-		//
-		explicit shared_array(size_t nsize) : _size(nsize) {
-			T* block = new T[nsize];
-			std::memset(block, 0, nsize * sizeof(T));
-			_data = std::shared_ptr<T>(block, deleter{});
+		// Блок заполнен нулями
+		explicit shared_array(size_t nsize) : shared_array(nsize, allocation{}) { }
+		// Блок по политике выделения
+		shared_array(size_t nsize, const allocation& policy)
+			: _size(nsize), _capacity(nsize), _policy(policy)
+		{
+			_data = allocate(nsize, policy);
+		}
+		shared_array(const shared_array<T>&) = default;
+		// Перенос без изменения счётчика ссылок
+		shared_array(shared_array<T>&& other) noexcept
+			: _data(std::move(other._data)), _size(other._size), _capacity(other._capacity), _policy(other._policy)
+		{
+			other._size = other._capacity = 0;
 		}
 
 	public:
-		// Тип значения  
+		// Тип значения
 		typedef T value_type;
 		// Возвращает указатель на данные
 		T* get() const { return _data.get(); }
 		// Возвращает размер
 		size_t size() const { return _size; }
+		// Возвращает размер выделенного блока
+		size_t capacity() const { return _capacity; }
+		// Единственный ли владелец у блока
+		bool unique() const { return _data.use_count() <= 1; }
 		// Возвращает shared_ptr
 		shared_ptr<T> getShared() const { return _data; }
+		// Политика, по которой выделяются новые блоки массива
+		const allocation& policy() const { return _policy; }
+		// Новые блоки (resize, reallocate, fit) выделяются по policy.
+		// Заполнение нулями к ним не применяется
+		void policy(const allocation& policy) { _policy = policy; }
 	public:
 		// [Works]
 		T  operator[](size_t i) const
@@ -48,9 +332,22 @@ namespace mpi {
 			if (this == &nheap || this->_data == nheap.getShared())
 				return *this;
 			this->_size = nheap.size();
+			this->_capacity = nheap.capacity();
+			this->_policy = nheap.policy();
 			_data = nheap.getShared();
 			return *this;
 		}
+		// Перенос без изменения счётчика ссылок
+		shared_array<T>& operator=(shared_array<T>&& other) noexcept {
+			if (this == &other)
+				return *this;
+			_data = std::move(other._data);
+			_size = other._size;
+			_capacity = other._capacity;
+			_policy = other._policy;
+			other._size = other._capacity = 0;
+			return *this;
+		}
 	public:
 		// shared_array -> vector
 		static vector<T> asvector(const shared_array<T>& narr) {
@@ -58,31 +355,91 @@ namespace mpi {
 		}
 		// vector -> shared_array
 		static shared_array<T> fromvector(vector<T>& vec) {
-			auto nsize = vec.size();
-			T* ndata = new T[nsize];
-			std::memcpy(ndata, vec.data(), vec.size() * sizeof(T));
-			return shared_array<T>(ndata, nsize);
+			shared_array<T> result(vec.size(), allocation::uninitialized());
+			std::copy(vec.begin(), vec.end(), result.get());
+			return result;
 		}
 
 	public:
 		// Ресайз массива с переносом данных
 		void resize(size_t nsize) {
-			T* nblock = new T[nsize];
-			for (size_t i = 0; i < _size; i++)
-				nblock[i] = _data[i];
-			_data.reset(nblock);
-			_size = nsize;
+			auto nblock = allocate(nsize, uninitialized_policy());
+			auto kept = _size < nsize ? _size : nsize;
+			copy(_data.get(), kept, nblock.get());
+			_data = std::move(nblock);
+			_size = _capacity = nsize;
 		}
 		// Ресайз массива без переноса данных
 		void reallocate(size_t nsize) {
-			T* nblock = new T[nsize];
-			_data.reset(nblock);
-			_size = nsize;
+			_data = allocate(nsize, uninitialized_policy());
+			_size = _capacity = nsize;
+		}
+		// Ресайз без переноса данных с повторным использованием блока.
+		// Память выделяется, только если блока не хватает или он
+		// разделён с другими массивами. Возвращает true при выделении
+		bool fit(size_t nsize) {
+			if (nsize <= _capacity && unique()) {
+				_size = nsize;
+				return false;
+			}
+			reallocate(nsize);
+			return true;
+		}
+		// Укорачивание с сохранением первых nsize элементов:
+		// свой блок остаётся на месте, разделённый копируется
+		void truncate(size_t nsize) {
+			if (nsize > _size)
+				return;
+			if (unique())
+				_size = nsize;
+			else
+				resize(nsize);
+		}
+		// Обмен содержимым без копирования данных
+		void swap(shared_array<T>& other) {
+			std::swap(_data, other._data);
+			std::swap(_size, other._size);
+			std::swap(_capacity, other._capacity);
+			std::swap(_policy, other._policy);
 		}
 		// Аналог конструктора
 		void assign(T* data, size_t size) {
-			_data.reset(data);
-			_size = size;
+			_data.reset(data, deleter{});
+			_size = _capacity = size;
+		}
+
+	private:
+		allocation uninitialized_policy() const {
+			auto policy = _policy;
+			policy.zeroed = false;
+			return policy;
+		}
+
+		// Перенос элементов: для простых типов одним memcpy
+		static void copy(const T* from, size_t count, T* to) {
+			if (count == 0)
+				return;
+			if (std::is_trivially_copyable<T>::value)
+				std::memcpy(to, from, count * sizeof(T));
+			else
+				std::copy(from, from + count, to);
+		}
+
+		static shared_ptr<T> allocate(size_t nsize, const allocation& policy) {
+			return allocate(nsize, policy, std::integral_constant<bool, raw>{});
+		}
+
+		static shared_ptr<T> allocate(size_t nsize, const allocation& policy, std::true_type) {
+			auto block = memory::allocate(nsize * sizeof(T), policy, alignof(T));
+			return shared_ptr<T>(static_cast<T*>(block.data), deleter{ block.bytes, block.from });
+		}
+
+		static shared_ptr<T> allocate(size_t nsize, const allocation& policy, std::false_type) {
+			// Значения по умолчанию задают конструкторы
+			T* data = new T[nsize]();
+			memory::track(nsize * sizeof(T));
+			(void)policy;
+			return shared_ptr<T>(data, deleter{ nsize * sizeof(T), memory::source::array_new });
 		}
 	};
 };
@@ -93,4 +450,4 @@ namespace std
 	T* begin(const mpi::shared_array<T>& arr) { return arr.get(); }
 	template<typename T>
 	T* end(const mpi::shared_array<T>& arr) { return arr.get() + arr.size(); }
-}
\ No newline at end of file
+}
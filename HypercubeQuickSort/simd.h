@@ -0,0 +1,463 @@
+﻿#pragma once
+#include <algorithm>
+#include <climits>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <utility>
+
+// Векторные ядра собираются только на x86: AVX2 включается
+// атрибутом функции (GCC, Clang) или доступен сразу (MSVC),
+// выбор ядра - по процессору во время выполнения
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+	#define MPIEXT_SIMD_X86
+	#include <immintrin.h>
+	#ifdef _MSC_VER
+		#include <intrin.h>
+		#define MPIEXT_AVX2
+	#else
+		#define MPIEXT_AVX2 __attribute__((target("avx2")))
+	#endif
+#endif
+
+namespace mpi {
+
+	///<summary>
+	/// Сортирующие сети в регистрах для коротких блоков и слияние
+	/// отсортированных участков без ветвлений на элемент.
+	/// Векторный путь - int на AVX2 (8 ключей в регистре), остальные
+	/// типы и процессоры без AVX2 идут скалярным путём.
+	/// MPIEXT_SIMD=0 в окружении отключает векторный путь
+	///</summary>
+	class simd
+	{
+	public:
+		// Наибольший блок сортирующей сети
+		static const size_t max_block = 256;
+		// Базовый случай быстрой сортировки
+		static const size_t block = 128;
+
+	public:
+		///<summary>
+		/// Доступен ли векторный путь (определяется один раз)
+		///</summary>
+		static bool enabled() {
+			static const bool _enabled = detect();
+			return _enabled;
+		}
+
+		///<summary>
+		/// Сортировка [first, last): быстрая сортировка
+		/// с сортирующей сетью на блоках до block ключей
+		///</summary>
+		template<typename T>
+		static void sort(T* first, T* last) {
+			std::sort(first, last);
+		}
+
+		static void sort(int* first, int* last) {
+#ifdef MPIEXT_SIMD_X86
+			if (enabled()) {
+				auto n = static_cast<size_t>(last - first);
+				size_t depth = 0;
+				for (auto k = n; k > 1; k >>= 1)
+					depth += 2;
+				quicksort(first, last, depth);
+				return;
+			}
+#endif
+			std::sort(first, last);
+		}
+
+		///<summary>
+		/// Сортировка в порядке comp. std::less выбирает
+		/// векторный путь на этапе компиляции
+		///</summary>
+		template<typename T, typename Compare>
+		static void sort(T* first, T* last, Compare comp) {
+			std::sort(first, last, comp);
+		}
+
+		template<typename T>
+		static void sort(T* first, T* last, std::less<T>) {
+			sort(first, last);
+		}
+
+		///<summary>
+		/// Сортировка блока до max_block ключей сортирующей сетью
+		///</summary>
+		template<typename T>
+		static void sort_block(T* data, size_t n) {
+			insertion_sort(data, n);
+		}
+
+		static void sort_block(int* data, size_t n) {
+#ifdef MPIEXT_SIMD_X86
+			if (enabled() && n > 16 && n <= max_block) {
+				network_sort(data, n);
+				return;
+			}
+#endif
+			if (n <= 16)
+				insertion_sort(data, n);
+			else
+				std::sort(data, data + n);
+		}
+
+		///<summary>
+		/// Слияние a и b в out по возрастанию. out может совпадать
+		/// с памятью b, если b лежит в out со смещением size(a)
+		///</summary>
+		template<typename T>
+		static void merge(const T* a, size_t na, const T* b, size_t nb, T* out) {
+			scalar_merge(a, na, b, nb, out, std::less<T>());
+		}
+
+		static void merge(const int* a, size_t na, const int* b, size_t nb, int* out) {
+#ifdef MPIEXT_SIMD_X86
+			if (enabled() && na >= 8 && nb >= 8) {
+				vector_merge(a, na, b, nb, out);
+				return;
+			}
+#endif
+			scalar_merge(a, na, b, nb, out, std::less<int>());
+		}
+
+		///<summary>
+		/// Слияние a и b с конца: результат занимает na + nb элементов
+		/// перед out_end. out может совпадать с памятью b, если b
+		/// лежит в начале результата
+		///</summary>
+		template<typename T>
+		static void merge_backward(const T* a, size_t na, const T* b, size_t nb, T* out_end) {
+			scalar_merge_backward(a, na, b, nb, out_end, std::less<T>());
+		}
+
+		static void merge_backward(const int* a, size_t na, const int* b, size_t nb, int* out_end) {
+#ifdef MPIEXT_SIMD_X86
+			if (enabled() && na >= 8 && nb >= 8) {
+				vector_merge_backward(a, na, b, nb, out_end);
+				return;
+			}
+#endif
+			scalar_merge_backward(a, na, b, nb, out_end, std::less<int>());
+		}
+
+		///<summary>
+		/// Слияния в порядке comp
+		///</summary>
+		template<typename T, typename Compare>
+		static void merge(const T* a, size_t na, const T* b, size_t nb, T* out, Compare comp) {
+			scalar_merge(a, na, b, nb, out, comp);
+		}
+
+		template<typename T>
+		static void merge(const T* a, size_t na, const T* b, size_t nb, T* out, std::less<T>) {
+			merge(a, na, b, nb, out);
+		}
+
+		template<typename T, typename Compare>
+		static void merge_backward(const T* a, size_t na, const T* b, size_t nb, T* out_end, Compare comp) {
+			scalar_merge_backward(a, na, b, nb, out_end, comp);
+		}
+
+		template<typename T>
+		static void merge_backward(const T* a, size_t na, const T* b, size_t nb, T* out_end, std::less<T>) {
+			merge_backward(a, na, b, nb, out_end);
+		}
+
+	private:
+		static bool detect() {
+			auto setting = std::getenv("MPIEXT_SIMD");
+			if (setting && std::strcmp(setting, "0") == 0)
+				return false;
+#if !defined(MPIEXT_SIMD_X86)
+			return false;
+#elif defined(_MSC_VER)
+			// AVX2: CPUID.7.EBX[5], регистры сохраняет ОС (OSXSAVE, XCR0)
+			int info[4];
+			__cpuid(info, 1);
+			if (!(info[2] & (1 << 27)) || (_xgetbv(0) & 0x6) != 0x6)
+				return false;
+			__cpuidex(info, 7, 0);
+			return (info[1] & (1 << 5)) != 0;
+#else
+			__builtin_cpu_init();
+			return __builtin_cpu_supports("avx2") != 0;
+#endif
+		}
+
+		template<typename T>
+		static void insertion_sort(T* data, size_t n) {
+			for (size_t i = 1; i < n; i++) {
+				T value = data[i];
+				auto j = i;
+				for (; j > 0 && value < data[j - 1]; j--)
+					data[j] = data[j - 1];
+				data[j] = value;
+			}
+		}
+
+		// Выбор без условного перехода: индекс сдвигается на результат сравнения
+		template<typename T, typename Compare>
+		static void scalar_merge(const T* a, size_t na, const T* b, size_t nb, T* out, Compare comp) {
+			size_t i = 0, j = 0, k = 0;
+			while (i < na && j < nb) {
+				bool take = comp(b[j], a[i]);
+				out[k++] = take ? b[j] : a[i];
+				j += take;
+				i += !take;
+			}
+			while (i < na)
+				out[k++] = a[i++];
+			while (j < nb)
+				out[k++] = b[j++];
+		}
+
+		template<typename T, typename Compare>
+		static void scalar_merge_backward(const T* a, size_t na, const T* b, size_t nb, T* out_end, Compare comp) {
+			size_t i = na, j = nb;
+			auto k = out_end;
+			while (i > 0 && j > 0) {
+				bool take = comp(a[i - 1], b[j - 1]);
+				*--k = take ? b[j - 1] : a[i - 1];
+				j -= take;
+				i -= !take;
+			}
+			while (i > 0)
+				*--k = a[--i];
+			while (j > 0)
+				*--k = b[--j];
+		}
+
+#ifdef MPIEXT_SIMD_X86
+		///<summary>
+		/// Быстрая сортировка до блоков сети. При исчерпании
+		/// глубины - std::sort, чтобы не деградировать до n^2
+		///</summary>
+		static void quicksort(int* first, int* last, size_t depth) {
+			while (static_cast<size_t>(last - first) > block) {
+				if (depth-- == 0) {
+					std::sort(first, last);
+					return;
+				}
+				// Медиана трёх, разбиение Хоара
+				auto middle = first + (last - first) / 2;
+				int x = *first, y = *middle, z = *(last - 1);
+				int pivot = std::max(std::min(x, y), std::min(std::max(x, y), z));
+				auto i = first, j = last - 1;
+				while (true) {
+					while (*i < pivot) i++;
+					while (pivot < *j) j--;
+					if (i >= j)
+						break;
+					std::swap(*i++, *j--);
+				}
+				// [first, j] <= pivot <= (j, last); меньшая часть - рекурсией
+				auto split = j + 1;
+				if (split - first < last - split) {
+					quicksort(first, split, depth);
+					first = split;
+				} else {
+					quicksort(split, last, depth);
+					last = split;
+				}
+			}
+			sort_block(first, static_cast<size_t>(last - first));
+		}
+
+		MPIEXT_AVX2 static void minmax(__m256i& a, __m256i& b) {
+			auto low = _mm256_min_epi32(a, b);
+			b = _mm256_max_epi32(a, b);
+			a = low;
+		}
+
+		MPIEXT_AVX2 static __m256i reverse(__m256i x) {
+			return _mm256_permutevar8x32_epi32(x, _mm256_setr_epi32(7, 6, 5, 4, 3, 2, 1, 0));
+		}
+
+		///<summary>
+		/// Упорядочивание битонической последовательности в регистре:
+		/// сравнения на расстоянии 4, 2, 1
+		///</summary>
+		MPIEXT_AVX2 static __m256i clean(__m256i x) {
+			auto y = _mm256_permute2x128_si256(x, x, 0x01);
+			x = _mm256_blend_epi32(_mm256_min_epi32(x, y), _mm256_max_epi32(x, y), 0xF0);
+			y = _mm256_shuffle_epi32(x, _MM_SHUFFLE(1, 0, 3, 2));
+			x = _mm256_blend_epi32(_mm256_min_epi32(x, y), _mm256_max_epi32(x, y), 0xCC);
+			y = _mm256_shuffle_epi32(x, _MM_SHUFFLE(2, 3, 0, 1));
+			return _mm256_blend_epi32(_mm256_min_epi32(x, y), _mm256_max_epi32(x, y), 0xAA);
+		}
+
+		///<summary>
+		/// Слияние двух отсортированных регистров: low - меньшие 8, high - большие
+		///</summary>
+		MPIEXT_AVX2 static void merge8(__m256i& low, __m256i& high) {
+			high = reverse(high);
+			minmax(low, high);
+			low = clean(low);
+			high = clean(high);
+		}
+
+		///<summary>
+		/// Сеть из 19 сравнений по столбцам 8 регистров,
+		/// затем транспонирование: каждый регистр отсортирован
+		///</summary>
+		MPIEXT_AVX2 static void sort_columns(__m256i* r) {
+			minmax(r[0], r[2]); minmax(r[1], r[3]); minmax(r[4], r[6]); minmax(r[5], r[7]);
+			minmax(r[0], r[4]); minmax(r[1], r[5]); minmax(r[2], r[6]); minmax(r[3], r[7]);
+			minmax(r[0], r[1]); minmax(r[2], r[3]); minmax(r[4], r[5]); minmax(r[6], r[7]);
+			minmax(r[2], r[4]); minmax(r[3], r[5]);
+			minmax(r[1], r[4]); minmax(r[3], r[6]);
+			minmax(r[1], r[2]); minmax(r[3], r[4]); minmax(r[5], r[6]);
+
+			auto t0 = _mm256_unpacklo_epi32(r[0], r[1]), t1 = _mm256_unpackhi_epi32(r[0], r[1]),
+				 t2 = _mm256_unpacklo_epi32(r[2], r[3]), t3 = _mm256_unpackhi_epi32(r[2], r[3]),
+				 t4 = _mm256_unpacklo_epi32(r[4], r[5]), t5 = _mm256_unpackhi_epi32(r[4], r[5]),
+				 t6 = _mm256_unpacklo_epi32(r[6], r[7]), t7 = _mm256_unpackhi_epi32(r[6], r[7]);
+			auto u0 = _mm256_unpacklo_epi64(t0, t2), u1 = _mm256_unpackhi_epi64(t0, t2),
+				 u2 = _mm256_unpacklo_epi64(t1, t3), u3 = _mm256_unpackhi_epi64(t1, t3),
+				 u4 = _mm256_unpacklo_epi64(t4, t6), u5 = _mm256_unpackhi_epi64(t4, t6),
+				 u6 = _mm256_unpacklo_epi64(t5, t7), u7 = _mm256_unpackhi_epi64(t5, t7);
+			r[0] = _mm256_permute2x128_si256(u0, u4, 0x20);
+			r[1] = _mm256_permute2x128_si256(u1, u5, 0x20);
+			r[2] = _mm256_permute2x128_si256(u2, u6, 0x20);
+			r[3] = _mm256_permute2x128_si256(u3, u7, 0x20);
+			r[4] = _mm256_permute2x128_si256(u0, u4, 0x31);
+			r[5] = _mm256_permute2x128_si256(u1, u5, 0x31);
+			r[6] = _mm256_permute2x128_si256(u2, u6, 0x31);
+			r[7] = _mm256_permute2x128_si256(u3, u7, 0x31);
+		}
+
+		///<summary>
+		/// Битоническое слияние соседних отсортированных участков
+		/// r[0, width) и r[width, 2 width) регистров
+		///</summary>
+		MPIEXT_AVX2 static void merge_runs(__m256i* r, size_t width) {
+			// Второй участок в обратном порядке: вместе - битоническая последовательность
+			for (size_t i = 0; i < width / 2; i++)
+				std::swap(r[width + i], r[2 * width - 1 - i]);
+			for (size_t i = 0; i < width; i++) {
+				r[width + i] = reverse(r[width + i]);
+				minmax(r[i], r[width + i]);
+			}
+			// Половины битонические: сравнения между регистрами, затем внутри
+			for (size_t half = 0; half < 2; half++) {
+				auto run = r + half * width;
+				for (auto distance = width / 2; distance > 0; distance /= 2)
+					for (size_t i = 0; i < width; i++)
+						if (!(i & distance))
+							minmax(run[i], run[i + distance]);
+				for (size_t i = 0; i < width; i++)
+					run[i] = clean(run[i]);
+			}
+		}
+
+		///<summary>
+		/// Сортировка до max_block ключей в регистрах: хвост
+		/// дополняется INT_MAX до степени двойки регистров (не меньше 8)
+		///</summary>
+		MPIEXT_AVX2 static void network_sort(int* data, size_t n) {
+			size_t count = 8;
+			while (count * 8 < n)
+				count *= 2;
+			__m256i r[max_block / 8];
+			alignas(32) int tail[8];
+			for (size_t i = 0; i < count; i++) {
+				if ((i + 1) * 8 <= n) {
+					r[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i * 8));
+					continue;
+				}
+				for (size_t k = 0; k < 8; k++)
+					tail[k] = i * 8 + k < n ? data[i * 8 + k] : INT_MAX;
+				r[i] = _mm256_load_si256(reinterpret_cast<const __m256i*>(tail));
+			}
+			for (size_t i = 0; i < count; i += 8)
+				sort_columns(r + i);
+			for (size_t width = 1; width < count; width *= 2)
+				for (size_t i = 0; i < count; i += 2 * width)
+					merge_runs(r + i, width);
+			for (size_t i = 0; i < count && i * 8 < n; i++) {
+				if ((i + 1) * 8 <= n) {
+					_mm256_storeu_si256(reinterpret_cast<__m256i*>(data + i * 8), r[i]);
+					continue;
+				}
+				_mm256_store_si256(reinterpret_cast<__m256i*>(tail), r[i]);
+				std::copy(tail, tail + (n - i * 8), data + i * 8);
+			}
+		}
+
+		///<summary>
+		/// Слияние по 8 ключей: в регистре остаются большие 8,
+		/// следующий регистр берётся из участка с меньшей головой.
+		/// Запись отстаёт от чтения на регистр, поэтому b может лежать в out
+		///</summary>
+		MPIEXT_AVX2 static void vector_merge(const int* a, size_t na, const int* b, size_t nb, int* out) {
+			auto low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a)),
+				 high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b));
+			size_t i = 8, j = 8;
+			merge8(low, high);
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), low);
+			out += 8;
+			while (i + 8 <= na && j + 8 <= nb) {
+				bool fromB = b[j] < a[i];
+				auto next = fromB ? b + j : a + i;
+				i += fromB ? 0 : 8;
+				j += fromB ? 8 : 0;
+				low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(next));
+				merge8(low, high);
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out), low);
+				out += 8;
+			}
+			// Остаток регистра сливается с коротким хвостом, затем с длинным
+			alignas(32) int held[8];
+			int shortTail[24];
+			_mm256_store_si256(reinterpret_cast<__m256i*>(held), high);
+			if (i + 8 > na) {
+				scalar_merge(held, 8, a + i, na - i, shortTail, std::less<int>());
+				scalar_merge(shortTail, 8 + na - i, b + j, nb - j, out, std::less<int>());
+			} else {
+				scalar_merge(held, 8, b + j, nb - j, shortTail, std::less<int>());
+				scalar_merge(a + i, na - i, shortTail, 8 + nb - j, out, std::less<int>());
+			}
+		}
+
+		///<summary>
+		/// То же с конца: в регистре остаются меньшие 8
+		///</summary>
+		MPIEXT_AVX2 static void vector_merge_backward(const int* a, size_t na, const int* b, size_t nb, int* out_end) {
+			size_t i = na - 8, j = nb - 8;
+			auto low = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)),
+				 high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j));
+			merge8(low, high);
+			out_end -= 8;
+			_mm256_storeu_si256(reinterpret_cast<__m256i*>(out_end), high);
+			while (i >= 8 && j >= 8) {
+				bool fromB = a[i - 1] < b[j - 1];
+				i -= fromB ? 0 : 8;
+				j -= fromB ? 8 : 0;
+				high = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(fromB ? b + j : a + i));
+				merge8(low, high);
+				out_end -= 8;
+				_mm256_storeu_si256(reinterpret_cast<__m256i*>(out_end), high);
+			}
+			alignas(32) int held[8];
+			int shortTail[24];
+			_mm256_store_si256(reinterpret_cast<__m256i*>(held), low);
+			if (i < 8) {
+				scalar_merge(a, i, held, 8, shortTail, std::less<int>());
+				scalar_merge_backward(shortTail, i + 8, b, j, out_end, std::less<int>());
+			} else {
+				scalar_merge(held, 8, b, j, shortTail, std::less<int>());
+				scalar_merge_backward(a, i, shortTail, j + 8, out_end, std::less<int>());
+			}
+		}
+#endif
+
+	public:
+		simd() = delete;
+		simd(const simd&) = delete;
+		simd& operator=(const simd&) = delete;
+	};
+}
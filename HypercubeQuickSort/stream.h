@@ -0,0 +1,160 @@
+﻿#pragma once
+#include <algorithm>
+#include <vector>
+#include "mpiext.h"
+#include "array_view.h"
+#include "shared_array.h"
+
+namespace mpi {
+	using std::vector;
+
+	///<summary>
+	/// Потоковый сбор слайсов на корне порциями фиксированного размера.
+	/// Порции идут в порядке рангов, то есть в порядке сортировки.
+	/// Корень держит не больше двух порций: пока потребитель разбирает
+	/// одну, в другую уже принимается следующая. Остальные процессы
+	/// отправляют порции прямо из памяти слайса.
+	/// На корне порции читаются через next(), на остальных процессах
+	/// finish() (или деструктор) дожидается окончания отправки
+	///</summary>
+	template<typename T> class chunk_stream {
+	private:
+		// Порция: процесс, смещение в его слайсе, длина
+		// и номер среди принимаемых (-1 у порций корня)
+		struct piece {
+			int rank;
+			size_t from;
+			int count;
+			int ordinal;
+		};
+
+		MPI_Comm _comm;
+		int _rank, _root;
+		array_view<const T> _slice;
+		vector<piece> _pieces;
+		// Индексы принимаемых порций по порядку
+		vector<size_t> _remote;
+		size_t _next;
+		// Двойной буфер приёма на корне: порция с номером k идёт в буфер k % 2
+		shared_array<T> _buffers[2];
+		MPI_Request _requests[2];
+		// Сколько порций принято в работу и сколько буферов уже освободилось
+		size_t _posted, _released;
+		// Потребитель держит последнюю выданную принятую порцию
+		bool _held;
+		// Отправки остальных процессов
+		vector<MPI_Request> _sends;
+
+	public:
+		///<summary>
+		/// Коллективно. chunk - размер порции в элементах
+		///</summary>
+		chunk_stream(array_view<const T> slice, size_t chunk, int root = 0, MPI_Comm comm = MPI_COMM_WORLD)
+			: _comm(comm), _rank(mpi::getRank(comm)), _root(root), _slice(slice), _next(0),
+			  _requests{ MPI_REQUEST_NULL, MPI_REQUEST_NULL }, _posted(0), _released(0), _held(false)
+		{
+			auto size = mpi::getSize(comm);
+			chunk = std::max<size_t>(chunk, 1);
+			long long mine = static_cast<long long>(slice.size());
+			vector<long long> sizes(_rank == root ? size : 0);
+			MPI_Gather(&mine, 1, MPI_LONG_LONG, sizes.data(), 1, MPI_LONG_LONG, root, comm);
+			auto type = get_mpi_datatype<T>();
+			if (_rank != root) {
+				for (size_t from = 0; from < slice.size(); from += chunk) {
+					auto count = static_cast<int>(std::min(chunk, slice.size() - from));
+					_sends.push_back(MPI_REQUEST_NULL);
+					MPI_Isend(const_cast<T*>(slice.get() + from), count, type, root, 669, comm, &_sends.back());
+				}
+				return;
+			}
+			for (auto pe = 0; pe < size; pe++)
+				for (size_t from = 0; from < static_cast<size_t>(sizes[pe]); from += chunk) {
+					auto count = static_cast<int>(std::min<size_t>(chunk, sizes[pe] - from));
+					auto ordinal = pe == root ? -1 : static_cast<int>(_remote.size());
+					if (pe != root)
+						_remote.push_back(_pieces.size());
+					_pieces.push_back({ pe, from, count, ordinal });
+				}
+			if (!_remote.empty()) {
+				_buffers[0] = shared_array<T>(chunk, allocation::uninitialized());
+				_buffers[1] = shared_array<T>(chunk, allocation::uninitialized());
+			}
+			post();
+		}
+
+		~chunk_stream() {
+			finish();
+		}
+
+		///<summary>
+		/// Следующая порция на корне. Порция действительна
+		/// до следующего вызова. false - данные закончились
+		///</summary>
+		bool next(array_view<const T>& chunk) {
+			if (_rank != _root || _next >= _pieces.size())
+				return false;
+			// Предыдущая принятая порция разобрана, её буфер свободен
+			if (_held) {
+				_released++;
+				_held = false;
+			}
+			post();
+			const auto& p = _pieces[_next++];
+			if (p.ordinal < 0) {
+				chunk = _slice.subview(p.from, p.count);
+			} else {
+				auto slot = p.ordinal % 2;
+				MPI_Wait(&_requests[slot], MPI_STATUS_IGNORE);
+				chunk = array_view<const T>(_buffers[slot].get(), p.count);
+				_held = true;
+			}
+			return true;
+		}
+
+		///<summary>
+		/// Дожидается окончания отправки (не корень)
+		/// или дочитывает непрочитанные порции (корень)
+		///</summary>
+		void finish() {
+			if (!_sends.empty()) {
+				MPI_Waitall(static_cast<int>(_sends.size()), _sends.data(), MPI_STATUSES_IGNORE);
+				_sends.clear();
+			}
+			// Корень дочитывает, чтобы отправители не зависли
+			array_view<const T> rest;
+			while (next(rest)) { }
+		}
+
+	private:
+		///<summary>
+		/// Запускает приём следующих порций во все свободные буферы:
+		/// пока потребитель разбирает одну порцию, принимается следующая
+		///</summary>
+		void post() {
+			while (_posted < _remote.size() && _posted < _released + 2) {
+				const auto& p = _pieces[_remote[_posted]];
+				auto slot = _posted % 2;
+				MPI_Irecv(_buffers[slot].get(), p.count, get_mpi_datatype<T>(), p.rank, 669, _comm, &_requests[slot]);
+				_posted++;
+			}
+		}
+
+	public:
+		chunk_stream(const chunk_stream&) = delete;
+		chunk_stream& operator=(const chunk_stream&) = delete;
+	};
+
+	///<summary>
+	/// Потоковый сбор слайсов на корне: consume(array_view<const T>)
+	/// вызывается для каждой порции по порядку
+	///</summary>
+	template<typename T, typename Consumer>
+	void collect_stream(const shared_array<T>& slice, size_t chunk, Consumer&& consume,
+		int root = 0, MPI_Comm comm = MPI_COMM_WORLD)
+	{
+		chunk_stream<T> stream(array_view<const T>(slice), chunk, root, comm);
+		array_view<const T> part;
+		while (stream.next(part))
+			consume(part);
+	}
+}
@@ -0,0 +1,368 @@
+﻿#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <string>
+#include <vector>
+#include "mpiext.h"
+#include "parallel.h"
+
+namespace mpi {
+	using std::vector;
+
+	///<summary>
+	/// Ссылка на строку внутри упакованного буфера
+	///</summary>
+	struct string_ref {
+		const char* data;
+		size_t size;
+
+		// Лексикографическое сравнение байт
+		bool operator<(const string_ref& other) const {
+			auto common = size < other.size ? size : other.size;
+			auto order = std::memcmp(data, other.data, common);
+			return order != 0 ? order < 0 : size < other.size;
+		}
+	};
+
+	///<summary>
+	/// Строки переменной длины в одном непрерывном буфере:
+	/// строка i занимает chars[offsets[i], offsets[i + 1])
+	///</summary>
+	struct packed_strings {
+		vector<char> chars;
+		vector<size_t> offsets{ 0 };
+
+		size_t size() const { return offsets.size() - 1; }
+		bool empty() const { return size() == 0; }
+		string_ref operator[](size_t i) const {
+			return string_ref{ chars.data() + offsets[i], offsets[i + 1] - offsets[i] };
+		}
+		void clear() {
+			chars.clear();
+			offsets.assign(1, 0);
+		}
+		void push_back(const char* data, size_t size) {
+			chars.insert(chars.end(), data, data + size);
+			offsets.push_back(chars.size());
+		}
+		void push_back(string_ref value) { push_back(value.data, value.size); }
+
+		static packed_strings from(const vector<std::string>& values) {
+			packed_strings result{};
+			result.offsets.reserve(values.size() + 1);
+			for (const auto& value : values)
+				result.push_back(value.data(), value.size());
+			return result;
+		}
+		vector<std::string> to_strings() const {
+			vector<std::string> result{};
+			result.reserve(size());
+			for (size_t i = 0; i < size(); i++)
+				result.emplace_back(chars.data() + offsets[i], offsets[i + 1] - offsets[i]);
+			return result;
+		}
+	};
+
+	///<summary>
+	/// Параллельная сортировка строк на гиперкубе. Итерации те же,
+	/// что у sorter: опорная строка корня подкуба, разбиение с балансом
+	/// равных, обмен половинами с соседом и слияние. Строки передаются
+	/// одним буфером байт; при включенном кодировании (wire::mode)
+	/// общий с предыдущей строкой префикс не передаётся
+	///</summary>
+	class string_sorter {
+	public:
+		// Слайсы короче не сортируются многоключевой быстрой сортировкой
+		static constexpr size_t insertion_limit = 16;
+
+	private:
+		struct round {
+			int neighbor;
+			bool lower;
+			MPI_Comm subcube;
+		};
+
+		MPI_Comm _comm;
+		int _rank, _size, _dim;
+		vector<round> _rounds;
+		// Буферы обмена
+		vector<unsigned char> _outgoing, _incoming;
+
+	public:
+		explicit string_sorter(MPI_Comm comm = MPI_COMM_WORLD)
+			: _comm(comm), _rank(mpi::getRank(comm)), _size(mpi::getSize(comm)),
+			  _dim(static_cast<int>(log2(_size))), _rounds(_dim)
+		{
+			for (auto i = _dim; i > 0; i--) {
+				auto& r = _rounds[i - 1];
+				r.neighbor = _rank ^ (0x1 << (i - 1));
+				r.lower = !(_rank >> (i - 1) & 0x1);
+				r.subcube = mpi::splitComm(_comm, _rank >> i, _rank);
+			}
+		}
+
+		~string_sorter() {
+			int finalized = 0;
+			MPI_Finalized(&finalized);
+			if (finalized)
+				return;
+			for (auto& r : _rounds)
+				mpi::freeComm(r.subcube);
+		}
+
+		///<summary>
+		/// Сортировка распределенных строк.
+		/// После вызова слайсы процессов упорядочены по рангу
+		///</summary>
+		void run_slice(packed_strings& slice)
+		{
+			slice = sorted(slice);
+			for (auto i = _dim; i > 0; i--) {
+				auto& r = _rounds[i - 1];
+				auto pivot = broadcast_pivot(slice, r.subcube);
+				string_ref key{ pivot.data(), pivot.size() };
+				auto split = partition(slice, key, r.subcube);
+				auto received = exchange(r, slice, r.lower ? split : 0, r.lower ? slice.size() : split);
+				slice = r.lower ? merge(slice, 0, split, received) : merge(slice, split, slice.size(), received);
+			}
+		}
+
+		void run_slice(vector<std::string>& slice)
+		{
+			auto packed = packed_strings::from(slice);
+			run_slice(packed);
+			slice = packed.to_strings();
+		}
+
+		///<summary>
+		/// Локальная сортировка: многоключевая быстрая сортировка
+		/// по ссылкам, затем перепаковка в порядке результата
+		///</summary>
+		static packed_strings sorted(const packed_strings& values)
+		{
+			vector<string_ref> refs(values.size());
+			for (size_t i = 0; i < refs.size(); i++)
+				refs[i] = values[i];
+			multikey(refs.data(), refs.size(), 0);
+			packed_strings result{};
+			result.chars.reserve(values.chars.size());
+			result.offsets.reserve(values.size() + 1);
+			for (const auto& ref : refs)
+				result.push_back(ref);
+			return result;
+		}
+
+		///<summary>
+		/// Кодирование строк [from, to) в поток байт:
+		/// для каждой строки varint длины общего с предыдущей префикса,
+		/// varint длины остатка и сам остаток. Без сжатия префикс всегда 0
+		///</summary>
+		static void encode(const packed_strings& values, size_t from, size_t to, bool prefix, vector<unsigned char>& out)
+		{
+			out.clear();
+			for (auto i = from; i < to; i++) {
+				auto value = values[i];
+				size_t common = 0;
+				if (prefix && i > from) {
+					auto previous = values[i - 1];
+					auto limit = std::min(previous.size, value.size);
+					while (common < limit && previous.data[common] == value.data[common])
+						common++;
+				}
+				put_varint(out, common);
+				put_varint(out, value.size - common);
+				out.insert(out.end(), value.data + common, value.data + value.size);
+			}
+		}
+
+		///<summary>
+		/// Декодирование count строк
+		///</summary>
+		static packed_strings decode(const unsigned char* in, size_t count)
+		{
+			packed_strings result{};
+			result.offsets.reserve(count + 1);
+			size_t previous = 0;
+			for (size_t i = 0; i < count; i++) {
+				auto common = get_varint(in),
+					 rest   = get_varint(in);
+				// Префикс берётся из предыдущей строки
+				auto start = result.chars.size();
+				result.chars.resize(start + common + rest);
+				std::memmove(result.chars.data() + start, result.chars.data() + previous, common);
+				std::memcpy(result.chars.data() + start + common, in, rest);
+				in += rest;
+				result.offsets.push_back(result.chars.size());
+				previous = start;
+			}
+			return result;
+		}
+
+	private:
+		// Символ на глубине depth, конец строки - меньше любого символа
+		static int at(const string_ref& s, size_t depth) {
+			return depth < s.size ? static_cast<unsigned char>(s.data[depth]) + 1 : 0;
+		}
+
+		///<summary>
+		/// Многоключевая быстрая сортировка (Bentley-Sedgewick):
+		/// трёхпутевое разбиение по символу на глубине depth,
+		/// равная часть сортируется по следующему символу
+		///</summary>
+		static void multikey(string_ref* a, size_t n, size_t depth)
+		{
+			while (n > insertion_limit) {
+				// Медиана трёх символов
+				int x = at(a[0], depth), y = at(a[n / 2], depth), z = at(a[n - 1], depth);
+				int pivot = std::max(std::min(x, y), std::min(std::max(x, y), z));
+				size_t lt = 0, i = 0, gt = n;
+				while (i < gt) {
+					auto c = at(a[i], depth);
+					if (c < pivot)
+						std::swap(a[lt++], a[i++]);
+					else if (c > pivot)
+						std::swap(a[i], a[--gt]);
+					else
+						i++;
+				}
+				multikey(a, lt, depth);
+				multikey(a + gt, n - gt, depth);
+				// Равные строки, закончившиеся на этой глубине, уже упорядочены
+				if (pivot == 0)
+					return;
+				a += lt;
+				n = gt - lt;
+				depth++;
+			}
+			// Короткие участки - вставками, сравнение с глубины depth
+			for (size_t i = 1; i < n; i++) {
+				auto value = a[i];
+				auto j = i;
+				while (j > 0 && suffix_less(value, a[j - 1], depth)) {
+					a[j] = a[j - 1];
+					j--;
+				}
+				a[j] = value;
+			}
+		}
+
+		static bool suffix_less(const string_ref& x, const string_ref& y, size_t depth) {
+			return string_ref{ x.data + depth, x.size - depth } < string_ref{ y.data + depth, y.size - depth };
+		}
+
+		static void put_varint(vector<unsigned char>& out, size_t value) {
+			while (value >= 0x80) {
+				out.push_back(static_cast<unsigned char>(value | 0x80));
+				value >>= 7;
+			}
+			out.push_back(static_cast<unsigned char>(value));
+		}
+
+		static size_t get_varint(const unsigned char*& in) {
+			size_t value = 0;
+			for (unsigned shift = 0; ; shift += 7) {
+				auto byte = *in++;
+				value |= static_cast<size_t>(byte & 0x7f) << shift;
+				if (!(byte & 0x80))
+					return value;
+			}
+		}
+
+		///<summary>
+		/// Медиана слайса первого процесса подкуба всем процессам подкуба
+		///</summary>
+		static std::string broadcast_pivot(const packed_strings& slice, MPI_Comm subcube)
+		{
+			std::string pivot{};
+			long long length = 0;
+			if (mpi::getRank(subcube) == 0 && !slice.empty()) {
+				auto median = slice[slice.size() / 2];
+				pivot.assign(median.data, median.size);
+				length = static_cast<long long>(median.size);
+			}
+			MPI_Bcast(&length, 1, MPI_LONG_LONG, 0, subcube);
+			pivot.resize(static_cast<size_t>(length));
+			if (length > 0)
+				MPI_Bcast(&pivot[0], static_cast<int>(length), MPI_CHAR, 0, subcube);
+			return pivot;
+		}
+
+		///<summary>
+		/// Кол-во строк младшей части отсортированного слайса
+		/// с балансом равных опорной строке по подкубу
+		///</summary>
+		static size_t partition(const packed_strings& slice, const string_ref& pivot, MPI_Comm subcube)
+		{
+			size_t first = 0, last = slice.size();
+			// lower_bound
+			for (size_t count = last; count > 0; ) {
+				auto step = count / 2;
+				if (slice[first + step] < pivot) { first += step + 1; count -= step + 1; }
+				else count = step;
+			}
+			// upper_bound
+			size_t upper = first;
+			for (size_t count = last - first; count > 0; ) {
+				auto step = count / 2;
+				if (!(pivot < slice[upper + step])) { upper += step + 1; count -= step + 1; }
+				else count = step;
+			}
+			long long less = static_cast<long long>(first),
+					  equal = static_cast<long long>(upper - first);
+			return static_cast<size_t>(less + sorter<char>::balance_equal(less, equal, slice.size(), subcube));
+		}
+
+		///<summary>
+		/// Обмен строками [from, to) с соседом одним буфером байт
+		///</summary>
+		packed_strings exchange(const round& r, const packed_strings& slice, size_t from, size_t to)
+		{
+			auto mode = wire::mode();
+			auto prefix = mode != wire_mode::raw;
+			encode(slice, from, to, prefix, _outgoing);
+			// Без кодирования строки идут как есть: длина и байты
+			size_t rawBytes = 0;
+			for (auto i = from; i < to; i++)
+				rawBytes += slice.offsets[i + 1] - slice.offsets[i] + sizeof(int);
+			long long outHead[2] = { static_cast<long long>(to - from), static_cast<long long>(_outgoing.size()) },
+					  inHead[2]  = { 0, 0 };
+			MPI_Sendrecv(outHead, 2, MPI_LONG_LONG, r.neighbor, 670, inHead, 2, MPI_LONG_LONG, r.neighbor, 670,
+				_comm, MPI_STATUS_IGNORE);
+			_incoming.resize(static_cast<size_t>(inHead[1]));
+			MPI_Sendrecv(_outgoing.data(), static_cast<int>(outHead[1]), MPI_BYTE, r.neighbor, 671,
+				_incoming.data(), static_cast<int>(inHead[1]), MPI_BYTE, r.neighbor, 671, _comm, MPI_STATUS_IGNORE);
+			auto& stats = wire::stats();
+			stats.raw_bytes += rawBytes;
+			stats.wire_bytes += _outgoing.size();
+			(prefix ? stats.packed_messages : stats.raw_messages)++;
+			return decode(_incoming.data(), static_cast<size_t>(inHead[0]));
+		}
+
+		///<summary>
+		/// Слияние строк [from, to) слайса с принятыми
+		///</summary>
+		static packed_strings merge(const packed_strings& slice, size_t from, size_t to, const packed_strings& received)
+		{
+			packed_strings result{};
+			result.chars.reserve(slice.offsets[to] - slice.offsets[from] + received.chars.size());
+			result.offsets.reserve(to - from + received.size() + 1);
+			size_t i = from, j = 0;
+			while (i < to && j < received.size()) {
+				if (received[j] < slice[i])
+					result.push_back(received[j++]);
+				else
+					result.push_back(slice[i++]);
+			}
+			while (i < to)
+				result.push_back(slice[i++]);
+			while (j < received.size())
+				result.push_back(received[j++]);
+			return result;
+		}
+
+	public:
+		string_sorter(const string_sorter&) = delete;
+		string_sorter& operator=(const string_sorter&) = delete;
+	};
+}
@@ -0,0 +1,381 @@
+﻿#pragma once
+#include <algorithm>
+#include <vector>
+#include "mpiext.h"
+#include "shared_array.h"
+#if defined(_MSC_VER)
+#include <xmmintrin.h>
+#endif
+
+namespace mpi {
+	using std::vector;
+
+	///<summary>
+	/// Ответ на точечный запрос: первый равный ключу элемент
+	///</summary>
+	template<typename T> struct match {
+		T value;
+		int found;
+	};
+
+	namespace traits {
+		// Ответы передаются непрерывным блоком байт
+		template<typename T>
+		struct mpi_type<match<T>> : std::true_type {
+			static MPI_Datatype get() {
+				static MPI_Datatype _type = [] {
+					MPI_Datatype type;
+					MPI_Type_contiguous(sizeof(match<T>), MPI_BYTE, &type);
+					MPI_Type_commit(&type);
+					return type;
+				}();
+				return _type;
+			}
+		};
+	}
+
+	///<summary>
+	/// Распределённая отсортированная таблица поверх слайсов,
+	/// упорядоченных по рангу (результат run_slice). Индекс разделителей -
+	/// первый и последний элемент каждого процесса - есть на всех процессах,
+	/// поэтому пакет запросов уходит владельцам одним MPI_Alltoallv, ответы -
+	/// другим. Локальный поиск идёт по копии слайса в порядке Эйтцингера
+	/// (дерево поиска в массиве: узел k, потомки 2k и 2k + 1), так что
+	/// первые уровни всех поисков делят одни строки кэша
+	///</summary>
+	template<typename T> class table {
+	public:
+		struct statistics {
+			unsigned long long batches = 0;
+			unsigned long long queries = 0;
+			unsigned long long sent_bytes = 0;   // Отправлено другим процессам
+			double total_seconds = 0;
+			double transfer_seconds = 0;
+			double compute_seconds = 0;
+		};
+
+	private:
+		MPI_Comm _comm;
+		int _rank, _size;
+		shared_array<T> _slice;
+		// Дерево Эйтцингера с 1 и позиции его узлов в слайсе
+		vector<T> _tree;
+		vector<size_t> _position;
+		// Индекс: границы непустых слайсов и их процессы
+		vector<T> _firsts, _lasts;
+		vector<int> _owners;
+		size_t _total;
+		statistics _stats;
+
+	public:
+		///<summary>
+		/// Коллективно. slice - отсортированный слайс, слайсы
+		/// упорядочены по рангу comm; таблица хранит ссылку на него
+		///</summary>
+		explicit table(const shared_array<T>& slice, MPI_Comm comm = MPI_COMM_WORLD)
+			: _comm(comm), _rank(mpi::getRank(comm)), _size(mpi::getSize(comm)), _slice(slice), _total(0)
+		{
+			_tree.resize(_slice.size() + 1);
+			_position.resize(_slice.size() + 1);
+			size_t next = 0;
+			layout(1, next);
+
+			auto sizes = mpi::allgather(static_cast<long long>(_slice.size()), _comm);
+			vector<T> bounds(2);
+			if (_slice.size() != 0)
+				bounds = { _slice[0], _slice[_slice.size() - 1] };
+			auto all = mpi::allgather(bounds, _comm);
+			for (auto pe = 0; pe < _size; pe++) {
+				_total += static_cast<size_t>(sizes[pe]);
+				if (sizes[pe] == 0)
+					continue;
+				_firsts.push_back(all[2 * pe]);
+				_lasts.push_back(all[2 * pe + 1]);
+				_owners.push_back(pe);
+			}
+		}
+
+		const statistics& stats() const { return _stats; }
+		const shared_array<T>& slice() const { return _slice; }
+		// Всего элементов в таблице
+		size_t size() const { return _total; }
+
+		///<summary>
+		/// Точечные запросы (коллективно): для каждого ключа - первый
+		/// равный ему элемент таблицы. Запрос уходит первому процессу,
+		/// чей диапазон накрывает ключ; ключи вне всех диапазонов
+		/// отвечаются без обмена
+		///</summary>
+		vector<match<T>> find(const vector<T>& keys)
+		{
+			auto start = MPI_Wtime();
+			vector<match<T>> answers(keys.size(), match<T>{ T{}, 0 });
+			vector<vector<size_t>> routed(_size);
+			for (size_t i = 0; i < keys.size(); i++) {
+				auto at = owner(keys[i]);
+				if (at < _lasts.size() && !(keys[i] < _firsts[at]))
+					routed[_owners[at]].push_back(i);
+			}
+			auto replies = route<match<T>>(keys, routed, 1, [this](const T* query, vector<match<T>>& reply) {
+				auto at = lower_bound(*query);
+				auto hit = at < _slice.size() && !(*query < _slice[at]);
+				reply.push_back({ hit ? _slice[at] : T{}, hit ? 1 : 0 });
+			});
+			scatter_back(replies, routed, answers);
+			finish(keys.size(), start);
+			return answers;
+		}
+
+		///<summary>
+		/// Число элементов в диапазонах [from[i], to[i]) по всей таблице
+		/// (коллективно). Диапазон уходит всем процессам, которых касается
+		///</summary>
+		vector<long long> count(const vector<T>& from, const vector<T>& to)
+		{
+			auto start = MPI_Wtime();
+			auto ranges = pack(from, to);
+			vector<vector<size_t>> routed(_size);
+			route_ranges(from, to, routed);
+			auto replies = route<long long>(ranges, routed, 2, [this](const T* query, vector<long long>& reply) {
+				reply.push_back(static_cast<long long>(span(query[0], query[1])));
+			});
+			vector<long long> totals(from.size(), 0);
+			size_t next = 0;
+			for (auto pe = 0; pe < _size; pe++)
+				for (auto i : routed[pe])
+					totals[i] += replies[next++];
+			finish(from.size(), start);
+			return totals;
+		}
+
+		///<summary>
+		/// Элементы диапазонов [from[i], to[i]) по возрастанию (коллективно).
+		/// Элементы диапазона i - [offsets[i], offsets[i + 1]) результата
+		///</summary>
+		shared_array<T> select(const vector<T>& from, const vector<T>& to, vector<size_t>& offsets)
+		{
+			auto start = MPI_Wtime();
+			auto ranges = pack(from, to);
+			vector<vector<size_t>> routed(_size);
+			route_ranges(from, to, routed);
+			// Сначала размеры частей, затем сами элементы
+			vector<int> sendcounts, recvcounts;
+			auto received = exchange(ranges, routed, 2, sendcounts, recvcounts);
+			auto computed = MPI_Wtime();
+			vector<long long> sizes{};
+			vector<T> rows{};
+			for (size_t q = 0; q < received.size(); q += 2) {
+				auto first = lower_bound(received[q]),
+					 last = std::max(first, lower_bound(received[q + 1]));
+				sizes.push_back(static_cast<long long>(last - first));
+				rows.insert(rows.end(), _slice.get() + first, _slice.get() + last);
+			}
+			_stats.compute_seconds += MPI_Wtime() - computed;
+			auto moved = MPI_Wtime();
+			for (auto& n : recvcounts)
+				n /= 2;
+			for (auto& n : sendcounts)
+				n /= 2;
+			auto parts = mpi::alltoallv(sizes, recvcounts, static_cast<const vector<int>&>(sendcounts), _comm);
+			// Элементов от процесса - сумма размеров его частей
+			vector<int> rowsOut(_size, 0), rowsIn(_size, 0);
+			size_t next = 0;
+			for (auto pe = 0; pe < _size; pe++)
+				for (auto k = 0; k < recvcounts[pe]; k++)
+					rowsOut[pe] += static_cast<int>(sizes[next++]);
+			next = 0;
+			for (auto pe = 0; pe < _size; pe++)
+				for (auto k = 0; k < sendcounts[pe]; k++)
+					rowsIn[pe] += static_cast<int>(parts[next++]);
+			count_sent(rowsOut, sizeof(T));
+			auto pieces = mpi::alltoallv(rows, rowsOut, static_cast<const vector<int>&>(rowsIn), _comm);
+			_stats.transfer_seconds += MPI_Wtime() - moved;
+
+			// Части диапазона пришли от процессов по возрастанию ранга
+			vector<size_t> length(from.size(), 0);
+			next = 0;
+			for (auto pe = 0; pe < _size; pe++)
+				for (auto i : routed[pe])
+					length[i] += static_cast<size_t>(parts[next++]);
+			offsets.assign(from.size() + 1, 0);
+			for (size_t i = 0; i < from.size(); i++)
+				offsets[i + 1] = offsets[i] + length[i];
+			shared_array<T> result(offsets.back(), allocation::uninitialized());
+			auto cursor = offsets;
+			next = 0;
+			size_t taken = 0;
+			for (auto pe = 0; pe < _size; pe++)
+				for (auto i : routed[pe]) {
+					auto n = static_cast<size_t>(parts[next++]);
+					std::copy(pieces.begin() + taken, pieces.begin() + taken + n, result.get() + cursor[i]);
+					cursor[i] += n;
+					taken += n;
+				}
+			finish(from.size(), start);
+			return result;
+		}
+
+		///<summary>
+		/// Первая позиция слайса, не меньшая key (поиск по дереву Эйтцингера)
+		///</summary>
+		size_t lower_bound(const T& key) const {
+			size_t k = 1, n = _slice.size();
+			while (k <= n) {
+				prefetch(_tree.data() + std::min(k * prefetch_distance, n));
+				k = 2 * k + (_tree[k] < key ? 1 : 0);
+			}
+			return position(k);
+		}
+
+		///<summary>
+		/// Первая позиция слайса, большая key
+		///</summary>
+		size_t upper_bound(const T& key) const {
+			size_t k = 1, n = _slice.size();
+			while (k <= n) {
+				prefetch(_tree.data() + std::min(k * prefetch_distance, n));
+				k = 2 * k + (key < _tree[k] ? 0 : 1);
+			}
+			return position(k);
+		}
+
+	private:
+		// Узел на 4 уровня ниже: его потомки лежат подряд
+		static const size_t prefetch_distance = 16;
+
+		static void prefetch(const T* address) {
+#if defined(_MSC_VER)
+			_mm_prefetch(reinterpret_cast<const char*>(address), _MM_HINT_T0);
+#else
+			__builtin_prefetch(address);
+#endif
+		}
+
+		///<summary>
+		/// Раскладка слайса: обход дерева в симметричном порядке
+		/// раздаёт узлам элементы по возрастанию
+		///</summary>
+		void layout(size_t k, size_t& next) {
+			if (k > _slice.size())
+				return;
+			layout(2 * k, next);
+			_tree[k] = _slice[next];
+			_position[k] = next++;
+			layout(2 * k + 1, next);
+		}
+
+		///<summary>
+		/// Узел, где поиск последний раз свернул влево: снимаются
+		/// правые повороты и ещё один шаг. 0 - конец слайса
+		///</summary>
+		size_t position(size_t k) const {
+			while (k & 1)
+				k >>= 1;
+			k >>= 1;
+			return k == 0 ? _slice.size() : _position[k];
+		}
+
+		///<summary>
+		/// Первый непустой слайс индекса, чей последний элемент не меньше key
+		///</summary>
+		size_t owner(const T& key) const {
+			return static_cast<size_t>(std::lower_bound(_lasts.begin(), _lasts.end(), key) - _lasts.begin());
+		}
+
+		size_t span(const T& from, const T& to) const {
+			auto first = lower_bound(from), last = lower_bound(to);
+			return last > first ? last - first : 0;
+		}
+
+		static vector<T> pack(const vector<T>& from, const vector<T>& to) {
+			vector<T> ranges(2 * from.size());
+			for (size_t i = 0; i < from.size(); i++) {
+				ranges[2 * i] = from[i];
+				ranges[2 * i + 1] = to[i];
+			}
+			return ranges;
+		}
+
+		///<summary>
+		/// Процессы, чьи диапазоны пересекают [from, to)
+		///</summary>
+		void route_ranges(const vector<T>& from, const vector<T>& to, vector<vector<size_t>>& routed) const {
+			for (size_t i = 0; i < from.size(); i++) {
+				for (auto at = owner(from[i]); at < _lasts.size() && _firsts[at] < to[i]; at++)
+					routed[_owners[at]].push_back(i);
+			}
+		}
+
+		///<summary>
+		/// Запросы по процессам-владельцам одним MPI_Alltoallv.
+		/// Запрос i занимает width элементов с queries[width * i]
+		///</summary>
+		vector<T> exchange(const vector<T>& queries, const vector<vector<size_t>>& routed, int width,
+			vector<int>& sendcounts, vector<int>& recvcounts)
+		{
+			auto moved = MPI_Wtime();
+			vector<T> outgoing{};
+			sendcounts.assign(_size, 0);
+			for (auto pe = 0; pe < _size; pe++) {
+				for (auto i : routed[pe])
+					outgoing.insert(outgoing.end(), queries.begin() + width * i, queries.begin() + width * (i + 1));
+				sendcounts[pe] = static_cast<int>(routed[pe].size()) * width;
+			}
+			count_sent(sendcounts, sizeof(T));
+			auto received = mpi::alltoallv(outgoing, sendcounts, recvcounts, _comm);
+			_stats.transfer_seconds += MPI_Wtime() - moved;
+			return received;
+		}
+
+		///<summary>
+		/// Запросы владельцам, ответ answer на каждый принятый,
+		/// ответы обратно. Ответы лежат по процессам в порядке routed
+		///</summary>
+		template<typename R, typename F>
+		vector<R> route(const vector<T>& queries, const vector<vector<size_t>>& routed, int width, F answer)
+		{
+			vector<int> sendcounts, recvcounts;
+			auto received = exchange(queries, routed, width, sendcounts, recvcounts);
+			auto computed = MPI_Wtime();
+			vector<R> replies{};
+			replies.reserve(received.size() / width);
+			for (size_t q = 0; q < received.size(); q += width)
+				answer(received.data() + q, replies);
+			_stats.compute_seconds += MPI_Wtime() - computed;
+
+			auto moved = MPI_Wtime();
+			for (auto& n : recvcounts)
+				n /= width;
+			for (auto& n : sendcounts)
+				n /= width;
+			count_sent(recvcounts, sizeof(R));
+			auto result = mpi::alltoallv(replies, recvcounts, static_cast<const vector<int>&>(sendcounts), _comm);
+			_stats.transfer_seconds += MPI_Wtime() - moved;
+			return result;
+		}
+
+		template<typename R>
+		static void scatter_back(const vector<R>& replies, const vector<vector<size_t>>& routed, vector<R>& answers) {
+			size_t next = 0;
+			for (size_t pe = 0; pe < routed.size(); pe++)
+				for (auto i : routed[pe])
+					answers[i] = replies[next++];
+		}
+
+		void count_sent(const vector<int>& counts, size_t bytes) {
+			for (auto pe = 0; pe < _size; pe++)
+				if (pe != _rank)
+					_stats.sent_bytes += counts[pe] * bytes;
+		}
+
+		void finish(size_t queries, double start) {
+			_stats.queries += queries;
+			_stats.batches++;
+			_stats.total_seconds += MPI_Wtime() - start;
+		}
+
+	public:
+		table(const table&) = delete;
+		table& operator=(const table&) = delete;
+	};
+}
@@ -0,0 +1,910 @@
+﻿// Проверки поведения сортировки и сопутствующих модулей.
+// Отдельная программа со своим main, в основной сборке не участвует.
+// Сборка и запуск (любое число процессов, степень двойки):
+//   mpicxx -std=c++14 -O2 tests.cpp random.cpp -o tests
+//   mpiexec -n 4 ./tests
+// Без MPI, ранги - потоки (число задаёт MPIEXT_RANKS):
+//   g++ -std=c++14 -O2 -pthread -DMPIEXT_THREADS tests.cpp random.cpp -o tests
+//   MPIEXT_RANKS=4 ./tests
+// Код возврата отличен от нуля, если хотя бы одна проверка не прошла
+
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <iostream>
+#include "parallel.h"
+#include "aggregate.h"
+#include "argsort.h"
+#include "async.h"
+#include "hierarchical.h"
+#include "join.h"
+#include "multiway.h"
+#include "codec.h"
+#include "random.h"
+#include "ranges.h"
+#include "segmented.h"
+#include "sequential.h"
+#include "simd.h"
+#include "stream.h"
+#include "table.h"
+#include "string_sort.h"
+
+using std::cout;
+using std::endl;
+
+namespace {
+	MPIEXT_RANK_LOCAL int failures = 0;
+
+	///<summary>
+	/// Фиксирует результат проверки на текущем процессе
+	///</summary>
+	void check(bool condition, const char* name)
+	{
+		if (!condition) {
+			failures++;
+			std::cerr << "[FAIL] rank " << mpi::getRank(MPI_COMM_WORLD) << ": " << name << endl;
+		}
+	}
+
+	///<summary>
+	/// Кодирование и декодирование возвращают исходные данные
+	///</summary>
+	template<typename T>
+	bool roundtrip(const std::vector<T>& values)
+	{
+		typedef mpi::codec::delta_codec<T> codec_t;
+		auto packed = codec_t::encode(values.data(), values.size());
+		std::vector<T> decoded(values.size());
+		codec_t::decode(packed.data(), values.size(), decoded.data());
+		if (packed.size() != codec_t::encoded_size(values.data(), values.size()))
+			return false;
+		return std::memcmp(decoded.data(), values.data(), values.size() * sizeof(T)) == 0;
+	}
+
+	template<typename T>
+	void test_codec_type(const char* name)
+	{
+		for (size_t n : { 0, 1, 2, 127, 128, 129, 1000 }) {
+			std::vector<T> values(n);
+			for (size_t i = 0; i < n; i++)
+				values[i] = static_cast<T>(mpi::random::integer(-100000, 100000));
+			check(roundtrip(values), name);
+			std::sort(values.begin(), values.end());
+			check(roundtrip(values), name);
+		}
+		// Крайние значения типа
+		std::vector<T> edges{ std::numeric_limits<T>::lowest(), std::numeric_limits<T>::max(),
+			T{}, std::numeric_limits<T>::lowest(), std::numeric_limits<T>::max() };
+		check(roundtrip(edges), name);
+	}
+
+	void test_codec()
+	{
+		test_codec_type<int>("codec int");
+		test_codec_type<short>("codec short");
+		test_codec_type<char>("codec char");
+		test_codec_type<long long>("codec long long");
+		test_codec_type<unsigned long long>("codec unsigned long long");
+		test_codec_type<float>("codec float");
+		test_codec_type<double>("codec double");
+		auto inf = std::numeric_limits<double>::infinity();
+		check(roundtrip(std::vector<double>{ -inf, -0.0, 0.0, 1.5, inf }), "codec double signed zero/inf");
+		// Отсортированные ключи малого диапазона сжимаются
+		std::vector<int> dense(100000);
+		for (auto& v : dense)
+			v = mpi::random::integer(-1000, 1000);
+		std::sort(dense.begin(), dense.end());
+		check(mpi::codec::delta_codec<int>::encode(dense.data(), dense.size()).size() < dense.size(),
+			"codec compresses dense sorted keys");
+	}
+
+	///<summary>
+	/// Обмен с принудительным кодированием доставляет те же данные
+	///</summary>
+	void test_packed_exchange()
+	{
+		auto rank = mpi::getRank(MPI_COMM_WORLD),
+			 size = mpi::getSize(MPI_COMM_WORLD);
+		auto partner = rank ^ 1;
+		if (partner >= size)
+			return;
+		mpi::shared_array<int> mine(5000 + rank);
+		for (size_t i = 0; i < mine.size(); i++)
+			mine[i] = static_cast<int>(i) * 3 + rank;
+		auto theirs = mpi::sendreceive(mine, partner, partner, 7, mpi::wire_mode::packed);
+		auto ok = theirs.size() == static_cast<size_t>(5000 + partner);
+		for (size_t i = 0; ok && i < theirs.size(); i++)
+			ok = theirs[i] == static_cast<int>(i) * 3 + partner;
+		check(ok, "packed sendreceive delivers payload");
+	}
+
+	///<summary>
+	/// Сортировка данных корневого процесса
+	///</summary>
+	void test_sort()
+	{
+		auto rank = mpi::getRank(MPI_COMM_WORLD);
+		mpi::shared_array<int> data(20000), reference{};
+		if (rank == 0) {
+			mpi::random::generate(std::begin(data), std::end(data), -1000, 1000);
+			reference = mpi::shared_array<int>(data.size());
+			std::copy(std::begin(data), std::end(data), std::begin(reference));
+			std::sort(std::begin(reference), std::end(reference));
+		}
+		mpi::sorter<int>::sort(data);
+		if (rank == 0)
+			check(std::equal(std::begin(data), std::end(data), std::begin(reference)) && data.size() == reference.size(),
+				"sorter matches std::sort");
+	}
+
+	///<summary>
+	/// Одинаковые ключи делятся между процессами поровну
+	///</summary>
+	void test_ranges()
+	{
+		auto rank = mpi::getRank(MPI_COMM_WORLD),
+			 size = mpi::getSize(MPI_COMM_WORLD);
+		{
+			// Вектор процесса 0 по убыванию, диапазон итераторов
+			auto values = mpi::random::integers(rank == 0 ? 20000 : 0, -1000000, 1000000);
+			auto reference = values;
+			std::sort(reference.begin(), reference.end(), std::greater<int>());
+			mpi::sort(values, std::greater<int>());
+			if (rank == 0)
+				check(values == reference, "root vector sorted descending");
+			mpi::sort(values.begin(), values.end());
+			if (rank == 0) {
+				std::reverse(reference.begin(), reference.end());
+				check(values == reference, "root iterator range sorted ascending");
+			}
+		}
+		{
+			// Записи по проекции, сравнение с состоянием
+			typedef mpi::keyed<int, long long> record;
+			auto keys = mpi::random::integers(3000 + 100 * rank, 0, 500);
+			std::vector<record> records(keys.size());
+			for (size_t i = 0; i < keys.size(); i++)
+				records[i] = { keys[i], rank * 1000000LL + static_cast<long long>(i) };
+			auto modulo = 97;
+			auto remainder = [modulo](const record& r) { return static_cast<int>(r.value % modulo); };
+			mpi::sort_slice(records, mpi::by(remainder, std::greater<int>()));
+			check(records.size() == keys.size(), "distributed range keeps its size");
+			auto sorted = std::is_sorted(records.begin(), records.end(), mpi::by(remainder, std::greater<int>()));
+			check(sorted, "projected records sorted within range");
+			auto edges = mpi::allgather(std::vector<int>{ records.empty() ? -1 : remainder(records.front()),
+				records.empty() ? -1 : remainder(records.back()) }, MPI_COMM_WORLD);
+			auto ordered = true;
+			for (auto pe = 1; pe < size; pe++)
+				ordered = ordered && edges[2 * pe] <= edges[2 * pe - 1];
+			check(ordered, "projected records ordered across ranks");
+			long long sum = 0;
+			for (const auto& r : records)
+				sum += r.value;
+			auto sums = mpi::gather(sum, 0);
+			if (rank == 0) {
+				long long expected = 0, total = 0;
+				for (auto pe = 0; pe < size; pe++) {
+					auto count = 3000LL + 100 * pe;
+					expected += pe * 1000000LL * count + count * (count - 1) / 2;
+					total += sums[pe];
+				}
+				check(total == expected, "projected records preserved");
+			}
+		}
+		{
+			// Распределённые вещественные по убыванию на месте
+			auto integers = mpi::random::integers(5000 - 200 * (rank % 2), -1000000, 1000000);
+			std::vector<double> values(integers.begin(), integers.end());
+			for (auto& v : values)
+				v /= 1000000;
+			auto before = values.size();
+			mpi::sort_slice(values.begin(), values.end(), std::greater<double>());
+			check(values.size() == before && std::is_sorted(values.begin(), values.end(), std::greater<double>()),
+				"distributed doubles sorted descending");
+			auto edges = mpi::allgather(std::vector<double>{ values.front(), values.back() }, MPI_COMM_WORLD);
+			auto ordered = true;
+			for (auto pe = 1; pe < size; pe++)
+				ordered = ordered && edges[2 * pe] <= edges[2 * pe - 1];
+			check(ordered, "distributed doubles ordered across ranks");
+		}
+	}
+
+	void test_segmented()
+	{
+		auto rank = mpi::getRank(MPI_COMM_WORLD),
+			 size = mpi::getSize(MPI_COMM_WORLD);
+		// Много малых сегментов (в том числе пустых) и два больших
+		std::vector<size_t> offsets{ 0 };
+		auto lengths = mpi::random::integers(1500, 0, 200);
+		lengths[100] = 160000;
+		lengths[900] = 50000;
+		for (auto length : lengths)
+			offsets.push_back(offsets.back() + length);
+		auto values = mpi::random::integers(static_cast<int>(offsets.back()), -100000, 100000);
+		mpi::shared_array<int> data(values.size());
+		std::copy(values.begin(), values.end(), std::begin(data));
+
+		mpi::segmented_sorter<int> segments{};
+		segments.run(data, rank == 0 ? offsets : std::vector<size_t>{});
+		if (rank == 0) {
+			for (size_t i = 0; i + 1 < offsets.size(); i++)
+				std::sort(values.begin() + offsets[i], values.begin() + offsets[i + 1]);
+			check(std::equal(values.begin(), values.end(), std::begin(data)), "segments sorted independently");
+		}
+		const auto& stats = segments.stats();
+		check(stats.segments == lengths.size(), "segments counted");
+		check(size > 1 ? stats.parallel_segments >= 1 : stats.parallel_segments == 0,
+			"large segments go to the hypercube");
+		check(stats.imbalance < 1.1, "small segments packed evenly");
+	}
+
+	void test_table()
+	{
+		auto rank = mpi::getRank(MPI_COMM_WORLD);
+		// Повторы ключей переходят через границы слайсов
+		auto values = mpi::random::integers(4000 + 300 * rank, 0, 3000);
+		auto slice = mpi::shared_array<int>::fromvector(values);
+		mpi::sorter<int>::sort_slice(slice);
+		mpi::table<int> index{ slice };
+
+		auto probes = mpi::random::integers(500, -100, 3100);
+		auto local = true;
+		for (auto key : probes)
+			local = local
+				&& index.lower_bound(key) == static_cast<size_t>(std::lower_bound(std::begin(slice), std::end(slice), key) - std::begin(slice))
+				&& index.upper_bound(key) == static_cast<size_t>(std::upper_bound(std::begin(slice), std::end(slice), key) - std::begin(slice));
+		check(local, "eytzinger search matches binary search");
+
+		auto keys = mpi::random::integers(300 + 10 * rank, -100, 3100);
+		auto found = index.find(keys);
+		auto from = mpi::random::integers(200, -100, 3100), to = from;
+		for (auto& v : to)
+			v += mpi::random::integer(0, 400);
+		auto counts = index.count(from, to);
+		std::vector<size_t> offsets{};
+		auto rows = index.select(from, to, offsets);
+		auto selected = true;
+		for (size_t i = 0; i < from.size(); i++)
+			selected = selected && static_cast<long long>(offsets[i + 1] - offsets[i]) == counts[i]
+				&& std::is_sorted(rows.get() + offsets[i], rows.get() + offsets[i + 1])
+				&& std::all_of(rows.get() + offsets[i], rows.get() + offsets[i + 1],
+					[&](int v) { return from[i] <= v && v < to[i]; });
+		check(selected, "range select agrees with count");
+
+		std::vector<int> hits(found.size()), hitValues(found.size());
+		for (size_t i = 0; i < found.size(); i++) {
+			hits[i] = found[i].found;
+			hitValues[i] = found[i].value;
+		}
+		auto all = mpi::gather(values, 0);
+		auto allKeys = mpi::gather(keys, 0), allHits = mpi::gather(hits, 0), allValues = mpi::gather(hitValues, 0);
+		auto allFrom = mpi::gather(from, 0), allTo = mpi::gather(to, 0);
+		auto allCounts = mpi::gather(counts, 0);
+		if (rank == 0) {
+			std::sort(all.begin(), all.end());
+			auto points = true;
+			for (size_t i = 0; i < allKeys.size(); i++) {
+				auto present = std::binary_search(all.begin(), all.end(), allKeys[i]);
+				points = points && allHits[i] == (present ? 1 : 0) && (!present || allValues[i] == allKeys[i]);
+			}
+			check(points, "point lookups routed to owners");
+			auto ranges = true;
+			for (size_t i = 0; i < allFrom.size(); i++)
+				ranges = ranges && allCounts[i] == std::lower_bound(all.begin(), all.end(), allTo[i])
+					- std::lower_bound(all.begin(), all.end(), allFrom[i]);
+			check(ranges, "range counts span ranks");
+			check(index.size() == all.size(), "table size");
+		}
+	}
+
+	void test_equal_keys_balance()
+	{
+		auto size = mpi::getSize(MPI_COMM_WORLD);
+		mpi::shared_array<int> slice(1000);
+		for (size_t i = 0; i < slice.size(); i++)
+			slice[i] = 42;
+		mpi::sorter<int>::sort_slice(slice);
+		check(slice.size() == 1000 || size == 1, "equal keys stay balanced");
+	}
+
+	///<summary>
+	/// Стабильная сортировка и перестановка столбцов
+	///</summary>
+	void test_argsort()
+	{
+		auto rank = mpi::getRank(MPI_COMM_WORLD);
+		// Стабильная сортировка совпадает с эталоном
+		mpi::shared_array<int> data(5000), reference{};
+		if (rank == 0) {
+			mpi::random::generate(std::begin(data), std::end(data), -50, 50);
+			reference = mpi::shared_array<int>(data.size());
+			std::copy(std::begin(data), std::end(data), std::begin(reference));
+			std::sort(std::begin(reference), std::end(reference));
+		}
+		mpi::argsorter<int>::sort(data);
+		if (rank == 0)
+			check(std::equal(std::begin(data), std::end(data), std::begin(reference)), "stable sort values");
+
+		// Ключ зависит от места в исходных данных, столбец хранит это место
+		const long long base = 1000000;
+		auto n = 700 + 31 * rank;
+		mpi::shared_array<int> keys(n);
+		mpi::shared_array<long long> column(n);
+		for (auto i = 0; i < n; i++) {
+			keys[i] = (i * 7919 + rank * 13) % 20;
+			column[i] = rank * base + i;
+		}
+		auto perm = mpi::argsorter<int>::argsort(keys);
+		auto permuted = mpi::argsorter<int>::permute(column, perm);
+		auto offset = mpi::exscan(static_cast<long long>(keys.size()), MPI_SUM);
+
+		auto sorted = true, matches = permuted.size() == keys.size(), stable = true;
+		for (size_t j = 0; j < keys.size(); j++) {
+			if (j > 0 && keys[j] < keys[j - 1])
+				sorted = false;
+			if (!matches)
+				break;
+			auto origin = permuted[j] / base, index = permuted[j] % base;
+			if (static_cast<int>((index * 7919 + origin * 13) % 20) != keys[j])
+				matches = false;
+			if (j > 0 && keys[j] == keys[j - 1] && permuted[j - 1] > permuted[j])
+				stable = false;
+		}
+		check(sorted, "argsort keys sorted");
+		check(matches, "permuted column follows keys");
+		check(stable, "equal keys keep input order");
+
+		// Переставленный столбец destination даёт на позиции j
+		// глобальный номер j: элемент пришёл ровно туда, куда указано
+		auto landed = mpi::argsorter<int>::permute(perm.destination, perm);
+		auto ok = landed.size() == keys.size();
+		for (size_t j = 0; ok && j < landed.size(); j++)
+			ok = landed[j] == offset + static_cast<long long>(j);
+		check(ok, "destination is the global sorted position");
+	}
+
+	///<summary>
+	/// Иерархическая сортировка на виртуальных узлах по два процесса
+	///</summary>
+	void test_hierarchical()
+	{
+		auto rank = mpi::getRank(MPI_COMM_WORLD);
+		mpi::hierarchical_sorter<int> hs(MPI_COMM_WORLD, 2);
+		mpi::shared_array<int> slice(3000 + 17 * rank);
+		mpi::random::generate(std::begin(slice), std::end(slice), -5000, 5000);
+		long long before = slice.size(), after = 0;
+		MPI_Allreduce(MPI_IN_PLACE, &before, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+		hs.run_slice(slice);
+		long long mine = slice.size();
+		MPI_Allreduce(&mine, &after, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+		check(before == after, "hierarchical keeps element count");
+		check(std::is_sorted(std::begin(slice), std::end(slice)), "hierarchical slice sorted");
+		// Порядок между процессами: последний элемент не больше первого у следующего
+		int last = slice.size() ? slice[slice.size() - 1] : std::numeric_limits<int>::min();
+		auto lasts = mpi::allgather(last);
+		auto empty = mpi::allgather(static_cast<int>(slice.size() == 0));
+		auto ordered = true;
+		for (auto pe = 0, prev = std::numeric_limits<int>::min(); pe < static_cast<int>(lasts.size()); pe++) {
+			if (pe == rank && slice.size() && slice[0] < prev)
+				ordered = false;
+			if (!empty[pe])
+				prev = lasts[pe];
+		}
+		check(ordered, "hierarchical slices ordered across ranks");
+	}
+
+	///<summary>
+	/// Отображение измерений на топологию: на виртуальных узлах
+	/// по два процесса первая итерация идёт внутри узла
+	///</summary>
+	void test_topology()
+	{
+		auto rank = mpi::getRank(MPI_COMM_WORLD),
+			 size = mpi::getSize(MPI_COMM_WORLD);
+		mpi::sorter<int> mapped(MPI_COMM_WORLD, mpi::mapping::topology, 2);
+		mpi::shared_array<int> data(10000), reference{};
+		if (rank == 0) {
+			mpi::random::generate(std::begin(data), std::end(data), -1000, 1000);
+			reference = mpi::shared_array<int>(data.size());
+			std::copy(std::begin(data), std::end(data), std::begin(reference));
+			std::sort(std::begin(reference), std::end(reference));
+		}
+		mapped.run(data);
+		if (rank == 0)
+			check(std::equal(std::begin(data), std::end(data), std::begin(reference)), "mapped sorter matches std::sort");
+		const auto& stats = mapped.stats();
+		if (size >= 4) {
+			auto rounds = std::accumulate(stats.round_bytes.begin(), stats.round_bytes.end(), 0ULL);
+			check(rounds == stats.locality_bytes[0] + stats.locality_bytes[1] + stats.locality_bytes[2],
+				"round bytes split by locality");
+			auto ranks = mpi::topology::virtual_ranks(MPI_COMM_WORLD, 2);
+			// Сосед первой итерации - процесс того же виртуального узла
+			auto partner = std::find(ranks.begin(), ranks.end(), ranks[rank] ^ (size / 2)) - ranks.begin();
+			check(partner / 2 == rank / 2, "first round stays inside the node");
+		}
+	}
+
+	///<summary>
+	/// Политики выделения памяти массива
+	///</summary>
+	void test_allocation()
+	{
+		auto& stats = mpi::memory::stats();
+		auto before = stats.allocations.load();
+		mpi::shared_array<int> zeroed(1000);
+		check(std::all_of(std::begin(zeroed), std::end(zeroed), [](int v) { return v == 0; }), "default array is zeroed");
+		mpi::shared_array<double> aligned(1000, mpi::allocation::cache_aligned());
+		check(reinterpret_cast<uintptr_t>(aligned.get()) % 64 == 0, "cache aligned block");
+		mpi::shared_array<double> page(1000, mpi::allocation::page_aligned());
+		check(reinterpret_cast<uintptr_t>(page.get()) % 4096 == 0, "page aligned block");
+		mpi::shared_array<long long> huge(1 << 20, mpi::allocation::huge());
+		huge[huge.size() - 1] = 7;
+		check(reinterpret_cast<uintptr_t>(huge.get()) % mpi::memory::page_size() == 0 && huge[huge.size() - 1] == 7,
+			"huge page block usable");
+		check(stats.allocations.load() - before == 4, "allocations counted");
+		check(stats.peak_bytes.load() >= stats.live_bytes.load(), "peak covers live bytes");
+
+		// resize сохраняет данные и политику
+		for (size_t i = 0; i < aligned.size(); i++)
+			aligned[i] = i * 0.5;
+		aligned.resize(5000);
+		auto kept = true;
+		for (size_t i = 0; i < 1000; i++)
+			kept = kept && aligned[i] == i * 0.5;
+		check(kept && reinterpret_cast<uintptr_t>(aligned.get()) % 64 == 0, "resize keeps data and alignment");
+
+		// Перенос не копирует блок
+		auto raw = aligned.get();
+		mpi::shared_array<double> moved(std::move(aligned));
+		check(moved.get() == raw && moved.unique() && aligned.size() == 0, "move keeps the block");
+	}
+
+	///<summary>
+	/// Отправка и приём участков массива без копирования
+	///</summary>
+	void test_views()
+	{
+		auto rank = mpi::getRank(MPI_COMM_WORLD),
+			 size = mpi::getSize(MPI_COMM_WORLD);
+		auto partner = rank ^ 1;
+		if (partner >= size)
+			return;
+		mpi::shared_array<int> data(100, mpi::allocation::uninitialized());
+		for (size_t i = 0; i < data.size(); i++)
+			data[i] = rank * 1000 + static_cast<int>(i);
+		// Младший отправляет середину массива, старший принимает в его конец
+		if (rank < partner) {
+			mpi::send(mpi::view(data, 10, 30), partner, 8, MPI_COMM_WORLD);
+		} else {
+			auto received = mpi::receive(mpi::view(data, 60, 40), partner, 8, MPI_COMM_WORLD);
+			auto ok = received == 30;
+			for (auto i = 0; ok && i < 30; i++)
+				ok = data[60 + i] == partner * 1000 + 10 + i && data[i] == rank * 1000 + i;
+			check(ok, "view receive lands in place");
+		}
+		// Обмен с приёмом прямо в указанное место
+		mpi::exchange_buffers buffers{};
+		std::vector<int> target(50, -1);
+		auto got = mpi::sendreceive(mpi::array_view<const int>(data.get(), 20 + rank % 2), [&](int count) {
+			return target.data() + 50 - count;
+		}, partner, partner, 9, mpi::wire_mode::raw, buffers);
+		check(got == 20 + partner % 2 && target[50 - got] == partner * 1000 && target[49 - got] == -1,
+			"view sendreceive receives where asked");
+	}
+
+	///<summary>
+	/// Асинхронная сортировка, продвигаемая вызовами test()
+	///</summary>
+	void test_async()
+	{
+		auto rank = mpi::getRank(MPI_COMM_WORLD);
+		mpi::sorter<int> owner{};
+		for (auto mode : { mpi::progress::caller, mpi::progress::thread }) {
+			mpi::shared_array<int> data(30000), reference{};
+			if (rank == 0) {
+				mpi::random::generate(std::begin(data), std::end(data), -3000, 3000);
+				reference = mpi::shared_array<int>(data.size());
+				std::copy(std::begin(data), std::end(data), std::begin(reference));
+				std::sort(std::begin(reference), std::end(reference));
+			}
+			auto handle = mpi::sort_async(owner, data, mode);
+			// Независимая работа вперемешку с продвижением сортировки
+			long long work = 0;
+			while (!handle.test())
+				work++;
+			handle.wait();
+			if (rank == 0)
+				check(std::equal(std::begin(data), std::end(data), std::begin(reference)) && data.size() == reference.size(),
+					"async sort matches std::sort");
+		}
+	}
+
+	///<summary>
+	/// Потоковый сбор на корне: порции по порядку и не больше заданного
+	///</summary>
+	void test_stream()
+	{
+		auto rank = mpi::getRank(MPI_COMM_WORLD),
+			 size = mpi::getSize(MPI_COMM_WORLD);
+		// Слайс процесса rank: числа [base, base + n), где n у всех разное
+		auto n = 1000 + 333 * rank;
+		long long base = 0;
+		for (auto pe = 0; pe < rank; pe++)
+			base += 1000 + 333 * pe;
+		mpi::shared_array<long long> slice(n);
+		for (auto i = 0; i < n; i++)
+			slice[i] = base + i;
+		long long expected = 0, total = 0;
+		auto ordered = true, bounded = true;
+		mpi::collect_stream(slice, 256, [&](mpi::array_view<const long long> chunk) {
+			bounded = bounded && chunk.size() <= 256 && !chunk.empty();
+			for (auto v : chunk)
+				ordered = ordered && v == expected++;
+			total += chunk.size();
+		});
+		if (rank == 0) {
+			long long all = 0;
+			for (auto pe = 0; pe < size; pe++)
+				all += 1000 + 333 * pe;
+			check(ordered && total == all, "stream delivers slices in rank order");
+			check(bounded, "stream chunks are bounded");
+		}
+	}
+	///<summary>
+	/// Сортировка строк: порядок внутри слайсов и между ними,
+	/// сохранение набора строк, кодирование общих префиксов
+	///</summary>
+	void test_strings()
+	{
+		auto rank = mpi::getRank(MPI_COMM_WORLD),
+			 size = mpi::getSize(MPI_COMM_WORLD);
+		// Общие префиксы, повторы, пустые строки и разная длина
+		const char* prefixes[] = { "", "a", "ab", "abc", "http://example.org/", "zz" };
+		std::vector<std::string> slice{};
+		unsigned seed = 12345u + 7919u * rank;
+		for (auto i = 0; i < 500 + 100 * rank; i++) {
+			seed = seed * 1103515245u + 12345u;
+			std::string value = prefixes[(seed >> 16) % 6];
+			auto tail = (seed >> 8) % 5;
+			for (unsigned k = 0; k < tail; k++) {
+				seed = seed * 1103515245u + 12345u;
+				value += static_cast<char>('a' + (seed >> 16) % 3);
+			}
+			slice.push_back(value);
+		}
+		// Кол-во строк и сумма байт по всем процессам
+		long long local[2] = { static_cast<long long>(slice.size()), 0 }, before[2] = { 0, 0 };
+		for (const auto& value : slice)
+			for (auto c : value)
+				local[1] += static_cast<unsigned char>(c);
+		MPI_Allreduce(local, before, 2, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+
+		// Кодирование с префиксами восстанавливает строки
+		auto packed = mpi::string_sorter::sorted(mpi::packed_strings::from(slice));
+		std::vector<unsigned char> bytes{};
+		mpi::string_sorter::encode(packed, 0, packed.size(), true, bytes);
+		auto decoded = mpi::string_sorter::decode(bytes.data(), packed.size());
+		check(decoded.to_strings() == packed.to_strings(), "string prefix coding round trip");
+		check(bytes.size() < packed.chars.size() + 2 * packed.size(), "string prefix coding shrinks sorted data");
+
+		for (auto mode : { mpi::wire_mode::raw, mpi::wire_mode::packed }) {
+			mpi::wire::mode() = mode;
+			auto data = slice;
+			mpi::string_sorter sorter(MPI_COMM_WORLD);
+			sorter.run_slice(data);
+			check(std::is_sorted(data.begin(), data.end()), "strings sorted within slice");
+			long long after[2] = { 0, 0 };
+			local[0] = static_cast<long long>(data.size());
+			local[1] = 0;
+			for (const auto& value : data)
+				for (auto c : value)
+					local[1] += static_cast<unsigned char>(c);
+			MPI_Allreduce(local, after, 2, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+			check(after[0] == before[0] && after[1] == before[1], "strings preserved by sort");
+			// Последняя строка слайса не больше первой строки следующего
+			std::string last = data.empty() ? std::string() : data.back();
+			int length = static_cast<int>(last.size()), nonempty = data.empty() ? 0 : 1;
+			if (rank + 1 < size) {
+				MPI_Send(&nonempty, 1, MPI_INT, rank + 1, 90, MPI_COMM_WORLD);
+				MPI_Send(&length, 1, MPI_INT, rank + 1, 91, MPI_COMM_WORLD);
+				MPI_Send(&last[0], length, MPI_CHAR, rank + 1, 92, MPI_COMM_WORLD);
+			}
+			if (rank > 0) {
+				int has = 0, got = 0;
+				MPI_Recv(&has, 1, MPI_INT, rank - 1, 90, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+				MPI_Recv(&got, 1, MPI_INT, rank - 1, 91, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+				std::string previous(got, '\0');
+				MPI_Recv(&previous[0], got, MPI_CHAR, rank - 1, 92, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+				check(!has || data.empty() || !(data.front() < previous), "strings ordered across ranks");
+			}
+		}
+		mpi::wire::mode() = mpi::wire_mode::automatic;
+	}
+	///<summary>
+	/// k-арная сортировка совпадает с std::sort при разных k,
+	/// равные ключи не сваливаются в одну корзину
+	///</summary>
+	void test_multiway()
+	{
+		auto rank = mpi::getRank(MPI_COMM_WORLD),
+			 size = mpi::getSize(MPI_COMM_WORLD);
+		for (auto ways : { 2, 4, 8 }) {
+			mpi::multiway_sorter<int> sorter(MPI_COMM_WORLD, ways);
+			mpi::shared_array<int> data(30000), reference{};
+			if (rank == 0) {
+				mpi::random::generate(std::begin(data), std::end(data), -2000, 2000);
+				reference = mpi::shared_array<int>(data.size());
+				std::copy(std::begin(data), std::end(data), std::begin(reference));
+				std::sort(std::begin(reference), std::end(reference));
+			}
+			sorter.run(data);
+			if (rank == 0)
+				check(std::equal(std::begin(data), std::end(data), std::begin(reference)), "multiway matches std::sort");
+
+			// Одни равные ключи делятся поровну
+			mpi::shared_array<int> same(1000);
+			for (size_t i = 0; i < same.size(); i++)
+				same[i] = 7;
+			sorter.run_slice(same);
+			check(same.size() == 1000, "multiway splits equal keys evenly");
+		}
+		mpi::multiway_sorter<int> binary(MPI_COMM_WORLD, 2), quaternary(MPI_COMM_WORLD, 4);
+		check(binary.rounds() == static_cast<int>(log2(size)), "multiway k=2 is binary");
+		check(quaternary.rounds() == (static_cast<int>(log2(size)) + 1) / 2, "multiway k=4 halves rounds");
+	}
+
+	///<summary>
+	/// Сортирующая сеть и векторное слияние совпадают с std::sort
+	/// на блоках всех длин, включая крайние значения и слияние на месте
+	///</summary>
+	void test_simd()
+	{
+		bool blocks = true, sorts = true, merges = true;
+		for (size_t n = 0; n <= mpi::simd::max_block; n++) {
+			auto values = mpi::random::integers(static_cast<int>(n), -20, 20);
+			if (n % 3 == 0 && n > 0)
+				values[n / 2] = std::numeric_limits<int>::max(), values[0] = std::numeric_limits<int>::min();
+			auto reference = values;
+			std::sort(reference.begin(), reference.end());
+			auto block = values;
+			mpi::simd::sort_block(block.data(), n);
+			blocks = blocks && block == reference;
+
+			// Слияние: принятое лежит в выходном массиве после или перед своим
+			auto m = n / 3;
+			std::vector<int> kept(reference.begin(), reference.begin() + m), forward(n), backward(n);
+			for (size_t i = m; i < n; i++)
+				forward[i] = backward[i - m] = reference[i];
+			mpi::simd::merge(kept.data(), m, forward.data() + m, n - m, forward.data());
+			mpi::simd::merge_backward(kept.data(), m, backward.data(), n - m, backward.data() + n);
+			merges = merges && forward == reference && backward == reference;
+		}
+		for (auto n : { 1000, 100000 }) {
+			auto values = mpi::random::integers(n);
+			auto reference = values;
+			std::sort(reference.begin(), reference.end());
+			auto fast = values;
+			mpi::simd::sort(fast.data(), fast.data() + fast.size());
+			sequential::quicksort<int>(values, 0, values.size() - 1);
+			sorts = sorts && fast == reference && values == reference;
+		}
+		check(blocks, "simd network sorts every block length");
+		check(merges, "simd merge in place both directions");
+		check(sorts, "simd sort and sequential quicksort match std::sort");
+	}
+
+	template<typename T>
+	std::vector<T> to_vector(const mpi::shared_array<T>& array) {
+		return std::vector<T>(array.get(), array.get() + array.size());
+	}
+
+	///<summary>
+	/// Различные ключи и их число после сортировки совпадают
+	/// с подсчётом на корне, в том числе для серий через все процессы
+	///</summary>
+	void test_aggregate()
+	{
+		auto rank = mpi::getRank(MPI_COMM_WORLD);
+		for (auto range : { 5, 1000 }) {
+			auto values = mpi::random::integers(500 + 37 * rank, 0, range);
+			auto all = mpi::gather(values, 0);
+			mpi::shared_array<int> keys(values.size()), collapsed(values.size());
+			std::copy(values.begin(), values.end(), std::begin(keys));
+			std::copy(values.begin(), values.end(), std::begin(collapsed));
+
+			mpi::sorter<int>::sort_slice(keys);
+			mpi::shared_array<int> distinct(keys.size());
+			std::copy(std::begin(keys), std::end(keys), std::begin(distinct));
+			mpi::aggregate<int>::unique(distinct);
+			auto counts = mpi::aggregate<int>::count_by_key(keys);
+			auto fast = mpi::aggregate<int>::sort_count(collapsed);
+
+			auto gotKeys = mpi::gather(to_vector(keys), 0),
+				 gotDistinct = mpi::gather(to_vector(distinct), 0),
+				 gotCollapsed = mpi::gather(to_vector(collapsed), 0);
+			auto gotCounts = mpi::gather(to_vector(counts), 0),
+				 gotFast = mpi::gather(to_vector(fast), 0);
+			if (rank == 0) {
+				std::sort(all.begin(), all.end());
+				std::vector<int> expectKeys{};
+				std::vector<long long> expectCounts{};
+				for (size_t i = 0; i < all.size(); i++) {
+					if (i == 0 || all[i] != all[i - 1]) {
+						expectKeys.push_back(all[i]);
+						expectCounts.push_back(0);
+					}
+					expectCounts.back()++;
+				}
+				check(gotDistinct == expectKeys, "unique keys across ranks");
+				check(gotKeys == expectKeys && gotCounts == expectCounts, "count_by_key matches root count");
+				check(gotCollapsed == expectKeys && gotFast == expectCounts, "sort_count collapses before exchange");
+			}
+		}
+
+		// Один ключ на всех процессах: серия целиком у первого
+		mpi::shared_array<int> same(100);
+		mpi::shared_array<double> weights(100);
+		for (size_t i = 0; i < same.size(); i++) {
+			same[i] = 9;
+			weights[i] = rank * 100.0 + i;
+		}
+		mpi::aggregate<int>::reduce_by_key(same, weights, [](double a, double b) { return std::max(a, b); });
+		auto size = mpi::getSize(MPI_COMM_WORLD);
+		check(rank == 0 ? same.size() == 1 && weights[0] == (size - 1) * 100.0 + 99 : same.size() == 0,
+			"reduce_by_key run spans every rank");
+	}
+
+	///<summary>
+	/// Соединение совпадает с соединением на корне, равные ключи
+	/// не расходятся по процессам, тяжёлый ключ делится
+	///</summary>
+	void test_join()
+	{
+		typedef mpi::joiner<int, long long, long long> joiner;
+		auto rank = mpi::getRank(MPI_COMM_WORLD),
+			 size = mpi::getSize(MPI_COMM_WORLD);
+		// Слева ключ 7 - большая часть записей
+		auto leftKeys = mpi::random::integers(2000 + 50 * rank, 0, 300),
+			 rightKeys = mpi::random::integers(1500, 0, 300);
+		for (size_t i = 0; i < leftKeys.size(); i += 10)
+			for (size_t k = i; k < i + 9 && k < leftKeys.size(); k++)
+				leftKeys[k] = 7;
+		mpi::shared_array<joiner::left_type> left(leftKeys.size());
+		mpi::shared_array<joiner::right_type> right(rightKeys.size());
+		std::vector<long long> leftValues{}, rightValues{};
+		for (size_t i = 0; i < left.size(); i++) {
+			left[i] = { leftKeys[i], rank * 1000000LL + static_cast<long long>(i) };
+			leftValues.push_back(left[i].value);
+		}
+		for (size_t i = 0; i < right.size(); i++) {
+			right[i] = { rightKeys[i], -(rank * 1000000LL + static_cast<long long>(i)) };
+			rightValues.push_back(right[i].value);
+		}
+		auto allLeftKeys = mpi::gather(leftKeys, 0), allRightKeys = mpi::gather(rightKeys, 0);
+		auto allLeft = mpi::gather(leftValues, 0), allRight = mpi::gather(rightValues, 0);
+
+		joiner join{};
+		auto rows = join.run(left, right);
+		// Сумма хешей строк и их число, ключи по возрастанию
+		unsigned long long hash = 0;
+		bool ordered = true;
+		for (size_t i = 0; i < rows.size(); i++) {
+			hash += static_cast<unsigned long long>(rows[i].key) * 1000003ULL
+				^ static_cast<unsigned long long>(rows[i].left) * 31ULL
+				^ static_cast<unsigned long long>(rows[i].right);
+			ordered = ordered && (i == 0 || !(rows[i].key < rows[i - 1].key));
+		}
+		check(ordered, "join rows ordered by key");
+		// Беззнаковых типов MPI в обёртках нет: хеш идёт как long long
+		auto hashes = mpi::gather(static_cast<long long>(hash), 0);
+		auto counts = mpi::gather(static_cast<long long>(rows.size()), 0);
+		if (rank == 0) {
+			std::multimap<int, long long> byKey{};
+			for (size_t i = 0; i < allRightKeys.size(); i++)
+				byKey.emplace(allRightKeys[i], allRight[i]);
+			unsigned long long expectHash = 0;
+			long long expectCount = 0;
+			for (size_t i = 0; i < allLeftKeys.size(); i++) {
+				auto range = byKey.equal_range(allLeftKeys[i]);
+				for (auto it = range.first; it != range.second; ++it, expectCount++)
+					expectHash += static_cast<unsigned long long>(allLeftKeys[i]) * 1000003ULL
+						^ static_cast<unsigned long long>(allLeft[i]) * 31ULL
+						^ static_cast<unsigned long long>(it->second);
+			}
+			check(std::accumulate(counts.begin(), counts.end(), 0LL) == expectCount, "join row count matches root join");
+			unsigned long long total = 0;
+			for (auto h : hashes)
+				total += static_cast<unsigned long long>(h);
+			check(total == expectHash, "join rows match root join");
+		}
+		if (size >= 4)
+			check(join.stats().heavy_keys > 0, "join spreads the heavy key");
+	}
+
+	///<summary>
+	/// Доли процессов после сортировки следуют их производительности
+	///</summary>
+	void test_capacity()
+	{
+		auto rank = mpi::getRank(MPI_COMM_WORLD),
+			 size = mpi::getSize(MPI_COMM_WORLD);
+		mpi::sorter<int> sorter(MPI_COMM_WORLD);
+		sorter.capacities(rank + 1.0);
+		auto weight = size * (size + 1) / 2.0,
+			 target = (rank + 1) / weight;
+		mpi::shared_array<int> data(20000 * size), reference{};
+		if (rank == 0) {
+			mpi::random::generate(std::begin(data), std::end(data), -1000000, 1000000);
+			reference = mpi::shared_array<int>(data.size());
+			std::copy(std::begin(data), std::end(data), std::begin(reference));
+			std::sort(std::begin(reference), std::end(reference));
+		}
+		sorter.run(data);
+		if (rank == 0)
+			check(std::equal(std::begin(data), std::end(data), std::begin(reference)), "weighted sort matches std::sort");
+		auto share = static_cast<double>(sorter.stats().last_slice) / data.size();
+		check(std::abs(share / target - 1) < 0.15, "weighted slice follows capacity");
+
+		// Равные ключи делятся точно по производительности
+		mpi::shared_array<int> same(1000);
+		for (size_t i = 0; i < same.size(); i++)
+			same[i] = 3;
+		sorter.run_slice(same);
+		check(std::abs(same.size() - 1000.0 * size * target) <= size, "weighted equal keys split by capacity");
+
+		// Равная производительность возвращает прежнее деление
+		sorter.capacities(0);
+		sorter.run_slice(same);
+		auto all = mpi::allreduce(std::vector<long long>{ static_cast<long long>(same.size()) }, MPI_SUM);
+		check(all[0] == 1000LL * size && same.size() == 1000, "equal capacities split evenly again");
+	}
+}
+
+int run(int argc, char** argv)
+{
+	mpi::init(&argc, &argv);
+	auto rank = mpi::getRank(MPI_COMM_WORLD);
+
+	test_codec();
+	test_simd();
+	test_allocation();
+	test_packed_exchange();
+	test_views();
+	test_sort();
+	test_async();
+	test_stream();
+	test_strings();
+	test_multiway();
+	test_capacity();
+	test_aggregate();
+	test_join();
+	test_ranges();
+	test_segmented();
+	test_table();
+	test_equal_keys_balance();
+	test_argsort();
+	test_hierarchical();
+	test_topology();
+
+	int total = 0;
+	MPI_Allreduce(&failures, &total, 1, MPI_INT, MPI_SUM, MPI_COMM_WORLD);
+	if (rank == 0)
+		cout << (total == 0 ? "[OK] all checks passed" : "[FAILED] checks failed: ")
+			 << (total == 0 ? "" : std::to_string(total)) << endl;
+
+	mpi::finalize();
+	return total == 0 ? 0 : 1;
+}
+
+int main(int argc, char** argv)
+{
+#ifdef MPIEXT_THREADS
+	// Ранги - потоки одного процесса
+	return mpi::threads::launch(argc, argv, run);
+#else
+	return run(argc, argv);
+#endif
+}
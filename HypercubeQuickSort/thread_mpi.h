@@ -0,0 +1,963 @@
+﻿#pragma once
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Реализация используемого подмножества MPI на потоках одного процесса:
+// ранг - поток, сообщения - копирование из памяти отправителя прямо
+// в память получателя, коллективные операции - чтение из буферов
+// участников между двумя барьерами. Подключается вместо <mpi.h>
+// макросом MPIEXT_THREADS (см. mpi_backend.h), программа запускается
+// через mpi::threads::launch. Неблокирующие коллективные операции
+// выполняются сразу при вызове
+
+namespace mpi {
+	namespace threads {
+		struct datatype;
+		struct communicator;
+		struct request;
+		struct group;
+		struct window;
+	}
+}
+
+typedef mpi::threads::datatype*     MPI_Datatype;
+typedef mpi::threads::communicator* MPI_Comm;
+typedef mpi::threads::request*      MPI_Request;
+typedef mpi::threads::group*        MPI_Group;
+typedef mpi::threads::window*       MPI_Win;
+typedef int                         MPI_Op;
+typedef int                         MPI_Info;
+typedef std::ptrdiff_t              MPI_Aint;
+
+struct MPI_Status {
+	int MPI_SOURCE;
+	int MPI_TAG;
+	int MPI_ERROR;
+	size_t bytes;
+};
+
+#define MPI_SUCCESS             0
+#define MPI_ANY_SOURCE          (-1)
+#define MPI_ANY_TAG             (-1)
+#define MPI_UNDEFINED           (-32766)
+#define MPI_MAX_PROCESSOR_NAME  256
+#define MPI_THREAD_SINGLE       0
+#define MPI_THREAD_FUNNELED     1
+#define MPI_THREAD_SERIALIZED   2
+#define MPI_THREAD_MULTIPLE     3
+#define MPI_MODE_NOCHECK        1024
+#define MPI_COMM_TYPE_SHARED    1
+#define MPI_INFO_NULL           0
+#define MPI_SUM                 1
+#define MPI_MIN                 2
+#define MPI_MAX                 3
+#define MPI_PROD                4
+#define MPI_IN_PLACE            (reinterpret_cast<void*>(1))
+#define MPI_STATUS_IGNORE       (static_cast<MPI_Status*>(nullptr))
+#define MPI_STATUSES_IGNORE     (static_cast<MPI_Status*>(nullptr))
+#define MPI_COMM_NULL           (static_cast<MPI_Comm>(nullptr))
+#define MPI_REQUEST_NULL        (static_cast<MPI_Request>(nullptr))
+#define MPI_DATATYPE_NULL       (static_cast<MPI_Datatype>(nullptr))
+#define MPI_COMM_WORLD          (::mpi::threads::world_comm())
+
+#define MPI_BYTE                (::mpi::threads::builtin(::mpi::threads::kind::byte))
+#define MPI_CHAR                (::mpi::threads::builtin(::mpi::threads::kind::character))
+#define MPI_SHORT               (::mpi::threads::builtin(::mpi::threads::kind::short_int))
+#define MPI_SHORT_INT           (::mpi::threads::builtin(::mpi::threads::kind::short_int_pair))
+#define MPI_INT                 (::mpi::threads::builtin(::mpi::threads::kind::integer))
+#define MPI_INTEGER             (::mpi::threads::builtin(::mpi::threads::kind::integer))
+#define MPI_LONG                (::mpi::threads::builtin(::mpi::threads::kind::long_int))
+#define MPI_LONG_LONG           (::mpi::threads::builtin(::mpi::threads::kind::long_long))
+#define MPI_UNSIGNED_LONG_LONG  (::mpi::threads::builtin(::mpi::threads::kind::unsigned_long_long))
+#define MPI_FLOAT               (::mpi::threads::builtin(::mpi::threads::kind::single))
+#define MPI_DOUBLE              (::mpi::threads::builtin(::mpi::threads::kind::double_precision))
+
+namespace mpi {
+	namespace threads {
+		// Вид элементов типа: нужен для редукций
+		enum class kind {
+			byte, character, short_int, short_int_pair, integer, long_int, long_long,
+			unsigned_long_long, single, double_precision, opaque
+		};
+
+		struct datatype {
+			size_t size;
+			kind of;
+			bool builtin;
+		};
+
+		inline MPI_Datatype builtin(kind of) {
+			struct short_int_pair { short value; int index; };
+			static datatype _types[] = {
+				{ 1, kind::byte, true },
+				{ sizeof(char), kind::character, true },
+				{ sizeof(short), kind::short_int, true },
+				{ sizeof(short_int_pair), kind::short_int_pair, true },
+				{ sizeof(int), kind::integer, true },
+				{ sizeof(long), kind::long_int, true },
+				{ sizeof(long long), kind::long_long, true },
+				{ sizeof(unsigned long long), kind::unsigned_long_long, true },
+				{ sizeof(float), kind::single, true },
+				{ sizeof(double), kind::double_precision, true },
+			};
+			return &_types[static_cast<int>(of)];
+		}
+
+		// Ранг текущего потока в мире, -1 вне программы
+		inline int& self() { static thread_local int _rank = -1; return _rank; }
+		inline bool& finalized() { static thread_local bool _finalized = false; return _finalized; }
+
+		///<summary>
+		/// Барьер для фиксированного числа участников
+		///</summary>
+		struct barrier_point {
+			std::mutex lock;
+			std::condition_variable wake;
+			int size, arrived;
+			unsigned long long generation;
+
+			explicit barrier_point(int size) : size(size), arrived(0), generation(0) { }
+
+			void arrive() {
+				if (size == 1)
+					return;
+				std::unique_lock<std::mutex> guard(lock);
+				auto current = generation;
+				if (++arrived == size) {
+					arrived = 0;
+					generation++;
+					wake.notify_all();
+					return;
+				}
+				wake.wait(guard, [&] { return generation != current; });
+			}
+		};
+
+		///<summary>
+		/// Аргументы участника коллективной операции
+		///</summary>
+		struct slot {
+			const void* send;
+			void* recv;
+			int sendcount, recvcount;
+			const int* sendcounts;
+			const int* sdispls;
+			const int* recvcounts;
+			const int* rdispls;
+			MPI_Datatype sendtype, recvtype;
+			int color, key;
+			long long size;
+			void* result;
+		};
+
+		struct communicator {
+			unsigned long long context;
+			std::vector<int> members;  // Ранги в мире по рангу в коммуникаторе
+			std::vector<int> local;    // Ранг в коммуникаторе по рангу в мире, -1 - не участник
+			std::vector<slot> slots;
+			barrier_point barrier;
+			std::atomic<int> refs;
+
+			communicator(const std::vector<int>& members, int worldSize)
+				: context(next_context()), members(members), local(worldSize, -1),
+				  slots(members.size()), barrier(static_cast<int>(members.size())),
+				  refs(static_cast<int>(members.size()))
+			{
+				for (size_t i = 0; i < members.size(); i++)
+					local[members[i]] = static_cast<int>(i);
+			}
+
+			int rank() const { return local[self()]; }
+			int size() const { return static_cast<int>(members.size()); }
+
+			///<summary>
+			/// Коллективная операция: участники публикуют аргументы,
+			/// после барьера каждый читает нужное из чужих буферов,
+			/// второй барьер сохраняет буферы до конца чтения
+			///</summary>
+			template<typename Read>
+			void collective(const slot& mine, Read&& read) {
+				auto r = rank();
+				slots[r] = mine;
+				barrier.arrive();
+				read(r);
+				barrier.arrive();
+			}
+
+			static unsigned long long next_context() {
+				static std::atomic<unsigned long long> _next{ 0 };
+				return _next++;
+			}
+		};
+
+		struct group {
+			std::vector<int> members;  // Ранги в мире
+		};
+
+		struct window {
+			std::vector<char*> bases;
+			std::vector<MPI_Aint> sizes;
+			std::vector<int> units;
+			std::unique_ptr<char[]> memory;
+			barrier_point barrier;
+			std::atomic<int> refs;
+
+			explicit window(int size) : bases(size), sizes(size), units(size), barrier(size), refs(size) { }
+		};
+
+		///<summary>
+		/// Запрос обмена. Отправка до совпадения с приёмом лежит в ящике
+		/// получателя, приём - в ящике своего потока. Данные копирует
+		/// тот поток, который нашёл пару, второй в это время ждёт
+		///</summary>
+		struct request {
+			bool send;
+			bool persistent;
+			void* buf;
+			size_t bytes;
+			int peer, tag;          // Ранги в коммуникаторе
+			int source;             // Ранг отправителя в коммуникаторе
+			MPI_Comm comm;
+			int owner;              // Ранг владельца в мире
+			std::atomic<bool> complete;
+			MPI_Status status;
+
+			request() : send(false), persistent(false), buf(nullptr), bytes(0), peer(0), tag(0), source(0),
+				comm(nullptr), owner(-1), complete(true), status{} { }
+		};
+
+		struct mailbox {
+			std::mutex lock;
+			std::condition_variable wake;
+			std::deque<request*> sends;     // Отправки этому потоку без пары
+			std::deque<request*> receives;  // Приёмы этого потока без пары
+		};
+
+		struct world {
+			int size;
+			std::vector<std::unique_ptr<mailbox>> boxes;
+			std::unique_ptr<communicator> comm;
+
+			explicit world(int size) : size(size), boxes(size) {
+				std::vector<int> members(size);
+				for (auto pe = 0; pe < size; pe++) {
+					members[pe] = pe;
+					boxes[pe].reset(new mailbox());
+				}
+				comm.reset(new communicator(members, size));
+			}
+		};
+
+		inline world*& current() { static world* _world = nullptr; return _world; }
+		inline MPI_Comm world_comm() { return current() ? current()->comm.get() : nullptr; }
+		inline mailbox& box(int rank) { return *current()->boxes[rank]; }
+
+		inline void fail(const char* message) {
+			std::cerr << "THREAD MPI FATAL ERROR: " << message << std::endl;
+			std::_Exit(1);
+		}
+
+		inline bool matches(const request& send, const request& recv) {
+			return send.comm->context == recv.comm->context
+				&& (recv.peer == MPI_ANY_SOURCE || recv.peer == send.source)
+				&& (recv.tag == MPI_ANY_TAG || recv.tag == send.tag);
+		}
+
+		///<summary>
+		/// Копирование пары; завершение приёма отмечает вызывающий
+		///</summary>
+		inline void deliver(const request& send, request& recv) {
+			if (send.bytes > recv.bytes)
+				fail("Message truncated");
+			if (send.bytes > 0)
+				std::memcpy(recv.buf, send.buf, send.bytes);
+			recv.status.MPI_SOURCE = send.source;
+			recv.status.MPI_TAG = send.tag;
+			recv.status.MPI_ERROR = MPI_SUCCESS;
+			recv.status.bytes = send.bytes;
+		}
+
+		// Отмечает завершение запроса и будит его владельца
+		inline void finish(request& r) {
+			if (r.owner == self()) {
+				r.complete = true;
+				return;
+			}
+			auto& b = box(r.owner);
+			std::lock_guard<std::mutex> guard(b.lock);
+			r.complete = true;
+			b.wake.notify_all();
+		}
+
+		inline void post(request& r) {
+			r.complete = false;
+			r.owner = self();
+			if (r.send) {
+				r.source = r.comm->rank();
+				auto& b = box(r.comm->members[r.peer]);
+				request* pair = nullptr;
+				{
+					std::lock_guard<std::mutex> guard(b.lock);
+					for (auto it = b.receives.begin(); it != b.receives.end(); ++it)
+						if (matches(r, **it)) {
+							pair = *it;
+							b.receives.erase(it);
+							break;
+						}
+					if (!pair)
+						b.sends.push_back(&r);
+				}
+				if (pair) {
+					deliver(r, *pair);
+					finish(*pair);
+					r.complete = true;
+				}
+			} else {
+				auto& b = box(self());
+				request* pair = nullptr;
+				{
+					std::lock_guard<std::mutex> guard(b.lock);
+					for (auto it = b.sends.begin(); it != b.sends.end(); ++it)
+						if (matches(**it, r)) {
+							pair = *it;
+							b.sends.erase(it);
+							break;
+						}
+					if (!pair)
+						b.receives.push_back(&r);
+				}
+				if (pair) {
+					deliver(*pair, r);
+					r.complete = true;
+					finish(*pair);
+				}
+			}
+		}
+
+		inline void wait(request& r) {
+			if (r.complete)
+				return;
+			auto& b = box(self());
+			std::unique_lock<std::mutex> guard(b.lock);
+			b.wake.wait(guard, [&] { return r.complete.load(); });
+		}
+
+		// Завершённый запрос: разовый удаляется, постоянный остаётся
+		inline void release(MPI_Request* handle, MPI_Status* status) {
+			if (status)
+				*status = (*handle)->status;
+			if (!(*handle)->persistent) {
+				delete *handle;
+				*handle = MPI_REQUEST_NULL;
+			}
+		}
+
+		inline MPI_Request make(bool send, const void* buf, int count, MPI_Datatype type,
+			int peer, int tag, MPI_Comm comm, bool persistent)
+		{
+			auto r = new request();
+			r->send = send;
+			r->persistent = persistent;
+			r->buf = const_cast<void*>(buf);
+			r->bytes = static_cast<size_t>(count) * type->size;
+			r->peer = peer;
+			r->tag = tag;
+			r->comm = comm;
+			return r;
+		}
+
+		template<typename V>
+		void combine(MPI_Op op, V* into, const V* from, int count) {
+			for (auto i = 0; i < count; i++) {
+				switch (op) {
+				case MPI_SUM:  into[i] = into[i] + from[i]; break;
+				case MPI_PROD: into[i] = into[i] * from[i]; break;
+				case MPI_MIN:  into[i] = std::min(into[i], from[i]); break;
+				case MPI_MAX:  into[i] = std::max(into[i], from[i]); break;
+				default: fail("Unsupported reduction");
+				}
+			}
+		}
+
+		inline void combine(MPI_Op op, MPI_Datatype type, void* into, const void* from, int count) {
+			switch (type->of) {
+			case kind::byte:               combine(op, static_cast<unsigned char*>(into), static_cast<const unsigned char*>(from), count); break;
+			case kind::character:          combine(op, static_cast<char*>(into), static_cast<const char*>(from), count); break;
+			case kind::short_int:          combine(op, static_cast<short*>(into), static_cast<const short*>(from), count); break;
+			case kind::integer:            combine(op, static_cast<int*>(into), static_cast<const int*>(from), count); break;
+			case kind::long_int:           combine(op, static_cast<long*>(into), static_cast<const long*>(from), count); break;
+			case kind::long_long:          combine(op, static_cast<long long*>(into), static_cast<const long long*>(from), count); break;
+			case kind::unsigned_long_long: combine(op, static_cast<unsigned long long*>(into), static_cast<const unsigned long long*>(from), count); break;
+			case kind::single:             combine(op, static_cast<float*>(into), static_cast<const float*>(from), count); break;
+			case kind::double_precision:   combine(op, static_cast<double*>(into), static_cast<const double*>(from), count); break;
+			default: fail("Unsupported reduction type");
+			}
+		}
+
+		inline slot arguments() { return slot{}; }
+
+		inline const char* bytes(const void* base, int displ, MPI_Datatype type) {
+			return static_cast<const char*>(base) + static_cast<size_t>(displ) * type->size;
+		}
+		inline char* bytes(void* base, int displ, MPI_Datatype type) {
+			return static_cast<char*>(base) + static_cast<size_t>(displ) * type->size;
+		}
+
+		///<summary>
+		/// Редукция публикаций участников [0, upto) в result
+		///</summary>
+		inline void reduce_slots(MPI_Comm comm, int upto, int count, MPI_Datatype type, MPI_Op op, std::vector<char>& result) {
+			result.assign(static_cast<size_t>(count) * type->size, 0);
+			for (auto pe = 0; pe < upto; pe++) {
+				const auto& s = comm->slots[pe];
+				auto from = s.send == MPI_IN_PLACE ? s.recv : s.send;
+				if (pe == 0)
+					std::memcpy(result.data(), from, result.size());
+				else
+					combine(op, type, result.data(), from, count);
+			}
+		}
+
+		// Вызов тела программы с кодом возврата или без
+		template<typename Body>
+		int invoke(Body& body, int argc, char** argv, std::true_type) { body(argc, argv); return 0; }
+		template<typename Body>
+		int invoke(Body& body, int argc, char** argv, std::false_type) { return static_cast<int>(body(argc, argv)); }
+
+		///<summary>
+		/// Запуск программы: body(argc, argv) выполняется в ranks потоках,
+		/// каждый поток - отдельный ранг MPI_COMM_WORLD. По умолчанию
+		/// число рангов берётся из MPIEXT_RANKS или по числу ядер
+		/// (наибольшая степень двойки). Возвращает наибольший код возврата
+		///</summary>
+		template<typename Body>
+		int launch(int argc, char** argv, Body body, int ranks = 0)
+		{
+			if (ranks <= 0) {
+				auto env = std::getenv("MPIEXT_RANKS");
+				ranks = env ? std::atoi(env) : 0;
+			}
+			if (ranks <= 0) {
+				auto cores = std::max(1u, std::thread::hardware_concurrency());
+				ranks = 1;
+				while (2u * ranks <= cores)
+					ranks *= 2;
+			}
+			world w(ranks);
+			current() = &w;
+			std::vector<int> codes(ranks, 0);
+			std::vector<std::thread> workers{};
+			for (auto pe = 0; pe < ranks; pe++)
+				workers.emplace_back([&, pe] {
+					self() = pe;
+					codes[pe] = invoke(body, argc, argv, std::is_void<decltype(body(argc, argv))>());
+				});
+			for (auto& worker : workers)
+				worker.join();
+			current() = nullptr;
+			return *std::max_element(codes.begin(), codes.end());
+		}
+	}
+}
+
+// Инициализация и окружение
+
+inline int MPI_Init(int*, char***) {
+	if (mpi::threads::self() < 0)
+		mpi::threads::fail("MPI_Init outside of mpi::threads::launch");
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Init_thread(int* argc, char*** argv, int, int* provided) {
+	*provided = MPI_THREAD_SINGLE;
+	return MPI_Init(argc, argv);
+}
+
+// Поток прогресса не является рангом, поэтому только MPI_THREAD_SINGLE
+inline int MPI_Query_thread(int* provided) { *provided = MPI_THREAD_SINGLE; return MPI_SUCCESS; }
+inline int MPI_Initialized(int* flag) { *flag = mpi::threads::self() >= 0; return MPI_SUCCESS; }
+inline int MPI_Finalized(int* flag) { *flag = mpi::threads::finalized(); return MPI_SUCCESS; }
+
+inline int MPI_Finalize() {
+	mpi::threads::finalized() = true;
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Abort(MPI_Comm, int) {
+	mpi::threads::fail("MPI_Abort");
+	return MPI_SUCCESS;
+}
+
+inline double MPI_Wtime() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// Все ранги на одном узле
+inline int MPI_Get_processor_name(char* name, int* length) {
+	std::strcpy(name, "localhost");
+	*length = static_cast<int>(std::strlen(name));
+	return MPI_SUCCESS;
+}
+
+// Коммуникаторы и группы
+
+inline int MPI_Comm_rank(MPI_Comm comm, int* rank) { *rank = comm->rank(); return MPI_SUCCESS; }
+inline int MPI_Comm_size(MPI_Comm comm, int* size) { *size = comm->size(); return MPI_SUCCESS; }
+
+inline int MPI_Comm_split(MPI_Comm comm, int color, int key, MPI_Comm* newcomm) {
+	auto mine = mpi::threads::arguments();
+	mine.color = color;
+	mine.key = key;
+	auto r = comm->rank();
+	std::vector<int> peers{};
+	// Группа упорядочена по ключу, затем по старому рангу; первый создаёт коммуникатор
+	comm->slots[r] = mine;
+	comm->barrier.arrive();
+	if (color != MPI_UNDEFINED) {
+		for (auto pe = 0; pe < comm->size(); pe++)
+			if (comm->slots[pe].color == color)
+				peers.push_back(pe);
+		std::stable_sort(peers.begin(), peers.end(), [comm](int a, int b) {
+			return comm->slots[a].key < comm->slots[b].key;
+		});
+		if (peers[0] == r) {
+			std::vector<int> members(peers.size());
+			for (size_t i = 0; i < peers.size(); i++)
+				members[i] = comm->members[peers[i]];
+			comm->slots[r].result = new mpi::threads::communicator(members, mpi::threads::current()->size);
+		}
+	}
+	comm->barrier.arrive();
+	*newcomm = color == MPI_UNDEFINED ? MPI_COMM_NULL
+		: static_cast<MPI_Comm>(comm->slots[peers[0]].result);
+	comm->barrier.arrive();
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Comm_split_type(MPI_Comm comm, int type, int key, MPI_Info, MPI_Comm* newcomm) {
+	return MPI_Comm_split(comm, type == MPI_COMM_TYPE_SHARED ? 0 : MPI_UNDEFINED, key, newcomm);
+}
+
+inline int MPI_Comm_free(MPI_Comm* comm) {
+	if (*comm != MPI_COMM_WORLD && --(*comm)->refs == 0)
+		delete *comm;
+	*comm = MPI_COMM_NULL;
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Comm_group(MPI_Comm comm, MPI_Group* group) {
+	*group = new mpi::threads::group{ comm->members };
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Group_translate_ranks(MPI_Group from, int n, const int* ranks, MPI_Group to, int* result) {
+	for (auto i = 0; i < n; i++) {
+		auto it = std::find(to->members.begin(), to->members.end(), from->members[ranks[i]]);
+		result[i] = it == to->members.end() ? MPI_UNDEFINED : static_cast<int>(it - to->members.begin());
+	}
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Group_free(MPI_Group* group) {
+	delete *group;
+	*group = nullptr;
+	return MPI_SUCCESS;
+}
+
+// Типы
+
+inline int MPI_Type_contiguous(int count, MPI_Datatype old, MPI_Datatype* type) {
+	*type = new mpi::threads::datatype{ count * old->size, mpi::threads::kind::opaque, false };
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Type_commit(MPI_Datatype*) { return MPI_SUCCESS; }
+
+inline int MPI_Type_free(MPI_Datatype* type) {
+	if (!(*type)->builtin)
+		delete *type;
+	*type = MPI_DATATYPE_NULL;
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Type_size(MPI_Datatype type, int* size) { *size = static_cast<int>(type->size); return MPI_SUCCESS; }
+
+// Обмен точка-точка
+
+inline int MPI_Isend(const void* buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm, MPI_Request* request) {
+	*request = mpi::threads::make(true, buf, count, type, dest, tag, comm, false);
+	mpi::threads::post(**request);
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Irecv(void* buf, int count, MPI_Datatype type, int source, int tag, MPI_Comm comm, MPI_Request* request) {
+	*request = mpi::threads::make(false, buf, count, type, source, tag, comm, false);
+	mpi::threads::post(**request);
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Send_init(const void* buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm, MPI_Request* request) {
+	*request = mpi::threads::make(true, buf, count, type, dest, tag, comm, true);
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Recv_init(void* buf, int count, MPI_Datatype type, int source, int tag, MPI_Comm comm, MPI_Request* request) {
+	*request = mpi::threads::make(false, buf, count, type, source, tag, comm, true);
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Start(MPI_Request* request) {
+	mpi::threads::post(**request);
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Startall(int count, MPI_Request* requests) {
+	for (auto i = 0; i < count; i++)
+		MPI_Start(&requests[i]);
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Request_free(MPI_Request* request) {
+	delete *request;
+	*request = MPI_REQUEST_NULL;
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Wait(MPI_Request* request, MPI_Status* status) {
+	if (*request == MPI_REQUEST_NULL)
+		return MPI_SUCCESS;
+	mpi::threads::wait(**request);
+	mpi::threads::release(request, status);
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Waitall(int count, MPI_Request* requests, MPI_Status* statuses) {
+	for (auto i = 0; i < count; i++)
+		MPI_Wait(&requests[i], statuses ? &statuses[i] : MPI_STATUS_IGNORE);
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Test(MPI_Request* request, int* flag, MPI_Status* status) {
+	*flag = *request == MPI_REQUEST_NULL || (*request)->complete;
+	if (*flag && *request != MPI_REQUEST_NULL)
+		mpi::threads::release(request, status);
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Testall(int count, MPI_Request* requests, int* flag, MPI_Status* statuses) {
+	*flag = 1;
+	for (auto i = 0; i < count; i++)
+		if (requests[i] != MPI_REQUEST_NULL && !requests[i]->complete)
+			*flag = 0;
+	if (*flag)
+		MPI_Waitall(count, requests, statuses);
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Send(const void* buf, int count, MPI_Datatype type, int dest, int tag, MPI_Comm comm) {
+	MPI_Request request;
+	MPI_Isend(buf, count, type, dest, tag, comm, &request);
+	return MPI_Wait(&request, MPI_STATUS_IGNORE);
+}
+
+inline int MPI_Recv(void* buf, int count, MPI_Datatype type, int source, int tag, MPI_Comm comm, MPI_Status* status) {
+	MPI_Request request;
+	MPI_Irecv(buf, count, type, source, tag, comm, &request);
+	return MPI_Wait(&request, status);
+}
+
+inline int MPI_Sendrecv(const void* sendbuf, int sendcount, MPI_Datatype sendtype, int dest, int sendtag,
+	void* recvbuf, int recvcount, MPI_Datatype recvtype, int source, int recvtag, MPI_Comm comm, MPI_Status* status)
+{
+	MPI_Request requests[2];
+	MPI_Isend(sendbuf, sendcount, sendtype, dest, sendtag, comm, &requests[0]);
+	MPI_Irecv(recvbuf, recvcount, recvtype, source, recvtag, comm, &requests[1]);
+	MPI_Wait(&requests[1], status);
+	return MPI_Wait(&requests[0], MPI_STATUS_IGNORE);
+}
+
+// Коллективные операции
+
+inline int MPI_Barrier(MPI_Comm comm) {
+	comm->barrier.arrive();
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Bcast(void* buffer, int count, MPI_Datatype type, int root, MPI_Comm comm) {
+	auto mine = mpi::threads::arguments();
+	mine.recv = buffer;
+	comm->collective(mine, [&](int r) {
+		if (r != root)
+			std::memcpy(buffer, comm->slots[root].recv, count * type->size);
+	});
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Reduce(const void* sendbuf, void* recvbuf, int count, MPI_Datatype type, MPI_Op op, int root, MPI_Comm comm) {
+	auto mine = mpi::threads::arguments();
+	mine.send = sendbuf;
+	mine.recv = recvbuf;
+	std::vector<char> result{};
+	comm->collective(mine, [&](int r) {
+		if (r == root)
+			mpi::threads::reduce_slots(comm, comm->size(), count, type, op, result);
+	});
+	if (comm->rank() == root)
+		std::memcpy(recvbuf, result.data(), result.size());
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Allreduce(const void* sendbuf, void* recvbuf, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm) {
+	auto mine = mpi::threads::arguments();
+	mine.send = sendbuf;
+	mine.recv = recvbuf;
+	std::vector<char> result{};
+	comm->collective(mine, [&](int) {
+		mpi::threads::reduce_slots(comm, comm->size(), count, type, op, result);
+	});
+	std::memcpy(recvbuf, result.data(), result.size());
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Exscan(const void* sendbuf, void* recvbuf, int count, MPI_Datatype type, MPI_Op op, MPI_Comm comm) {
+	auto mine = mpi::threads::arguments();
+	mine.send = sendbuf;
+	mine.recv = recvbuf;
+	std::vector<char> result{};
+	comm->collective(mine, [&](int r) {
+		if (r > 0)
+			mpi::threads::reduce_slots(comm, r, count, type, op, result);
+	});
+	if (!result.empty())
+		std::memcpy(recvbuf, result.data(), result.size());
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Gatherv(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+	void* recvbuf, const int* recvcounts, const int* displs, MPI_Datatype recvtype, int root, MPI_Comm comm)
+{
+	auto mine = mpi::threads::arguments();
+	mine.send = sendbuf;
+	mine.sendcount = sendcount;
+	mine.sendtype = sendtype;
+	comm->collective(mine, [&](int r) {
+		if (r != root)
+			return;
+		for (auto pe = 0; pe < comm->size(); pe++) {
+			const auto& s = comm->slots[pe];
+			if (s.send != MPI_IN_PLACE && s.sendcount > 0)
+				std::memcpy(mpi::threads::bytes(recvbuf, displs[pe], recvtype), s.send, s.sendcount * s.sendtype->size);
+		}
+	});
+	(void)recvcounts;
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Gather(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+	void* recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm)
+{
+	std::vector<int> counts(comm->size(), recvcount), displs(comm->size());
+	for (auto pe = 0; pe < comm->size(); pe++)
+		displs[pe] = pe * recvcount;
+	return MPI_Gatherv(sendbuf, sendcount, sendtype, recvbuf, counts.data(), displs.data(), recvtype, root, comm);
+}
+
+inline int MPI_Scatterv(const void* sendbuf, const int* sendcounts, const int* displs, MPI_Datatype sendtype,
+	void* recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm)
+{
+	auto mine = mpi::threads::arguments();
+	mine.send = sendbuf;
+	mine.sendcounts = sendcounts;
+	mine.sdispls = displs;
+	mine.sendtype = sendtype;
+	comm->collective(mine, [&](int r) {
+		const auto& s = comm->slots[root];
+		if (recvbuf != MPI_IN_PLACE && s.sendcounts[r] > 0)
+			std::memcpy(recvbuf, mpi::threads::bytes(s.send, s.sdispls[r], s.sendtype), s.sendcounts[r] * s.sendtype->size);
+	});
+	(void)recvcount;
+	(void)recvtype;
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Scatter(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+	void* recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm)
+{
+	std::vector<int> counts(comm->size(), sendcount), displs(comm->size());
+	for (auto pe = 0; pe < comm->size(); pe++)
+		displs[pe] = pe * sendcount;
+	return MPI_Scatterv(sendbuf, counts.data(), displs.data(), sendtype, recvbuf, recvcount, recvtype, root, comm);
+}
+
+inline int MPI_Allgather(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+	void* recvbuf, int recvcount, MPI_Datatype recvtype, MPI_Comm comm)
+{
+	auto mine = mpi::threads::arguments();
+	mine.send = sendbuf;
+	mine.recv = recvbuf;
+	mine.sendcount = sendcount;
+	mine.sendtype = sendtype;
+	comm->collective(mine, [&](int r) {
+		for (auto pe = 0; pe < comm->size(); pe++) {
+			const auto& s = comm->slots[pe];
+			auto into = mpi::threads::bytes(recvbuf, pe * recvcount, recvtype);
+			if (s.send == MPI_IN_PLACE) {
+				if (pe != r)
+					std::memcpy(into, mpi::threads::bytes(s.recv, pe * recvcount, recvtype), recvcount * recvtype->size);
+			} else if (s.sendcount > 0) {
+				std::memcpy(into, s.send, s.sendcount * s.sendtype->size);
+			}
+		}
+	});
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Alltoallv(const void* sendbuf, const int* sendcounts, const int* sdispls, MPI_Datatype sendtype,
+	void* recvbuf, const int* recvcounts, const int* rdispls, MPI_Datatype recvtype, MPI_Comm comm)
+{
+	auto mine = mpi::threads::arguments();
+	mine.send = sendbuf;
+	mine.sendcounts = sendcounts;
+	mine.sdispls = sdispls;
+	mine.sendtype = sendtype;
+	comm->collective(mine, [&](int r) {
+		for (auto pe = 0; pe < comm->size(); pe++) {
+			const auto& s = comm->slots[pe];
+			if (s.sendcounts[r] > 0)
+				std::memcpy(mpi::threads::bytes(recvbuf, rdispls[pe], recvtype),
+					mpi::threads::bytes(s.send, s.sdispls[r], s.sendtype), s.sendcounts[r] * s.sendtype->size);
+		}
+	});
+	(void)recvcounts;
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Alltoall(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+	void* recvbuf, int recvcount, MPI_Datatype recvtype, MPI_Comm comm)
+{
+	std::vector<int> scounts(comm->size(), sendcount), rcounts(comm->size(), recvcount),
+					 sdispls(comm->size()), rdispls(comm->size());
+	for (auto pe = 0; pe < comm->size(); pe++) {
+		sdispls[pe] = pe * sendcount;
+		rdispls[pe] = pe * recvcount;
+	}
+	return MPI_Alltoallv(sendbuf, scounts.data(), sdispls.data(), sendtype,
+		recvbuf, rcounts.data(), rdispls.data(), recvtype, comm);
+}
+
+// Неблокирующие коллективные операции выполняются при вызове
+
+inline int MPI_Ibcast(void* buffer, int count, MPI_Datatype type, int root, MPI_Comm comm, MPI_Request* request) {
+	*request = MPI_REQUEST_NULL;
+	return MPI_Bcast(buffer, count, type, root, comm);
+}
+
+inline int MPI_Iallgather(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+	void* recvbuf, int recvcount, MPI_Datatype recvtype, MPI_Comm comm, MPI_Request* request)
+{
+	*request = MPI_REQUEST_NULL;
+	return MPI_Allgather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, comm);
+}
+
+inline int MPI_Igather(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+	void* recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm, MPI_Request* request)
+{
+	*request = MPI_REQUEST_NULL;
+	return MPI_Gather(sendbuf, sendcount, sendtype, recvbuf, recvcount, recvtype, root, comm);
+}
+
+inline int MPI_Igatherv(const void* sendbuf, int sendcount, MPI_Datatype sendtype,
+	void* recvbuf, const int* recvcounts, const int* displs, MPI_Datatype recvtype, int root, MPI_Comm comm,
+	MPI_Request* request)
+{
+	*request = MPI_REQUEST_NULL;
+	return MPI_Gatherv(sendbuf, sendcount, sendtype, recvbuf, recvcounts, displs, recvtype, root, comm);
+}
+
+inline int MPI_Iscatterv(const void* sendbuf, const int* sendcounts, const int* displs, MPI_Datatype sendtype,
+	void* recvbuf, int recvcount, MPI_Datatype recvtype, int root, MPI_Comm comm, MPI_Request* request)
+{
+	*request = MPI_REQUEST_NULL;
+	return MPI_Scatterv(sendbuf, sendcounts, displs, sendtype, recvbuf, recvcount, recvtype, root, comm);
+}
+
+// Окна разделяемой памяти: все ранги и так в одной памяти
+
+inline int MPI_Win_allocate_shared(MPI_Aint size, int unit, MPI_Info, MPI_Comm comm, void* baseptr, MPI_Win* win) {
+	auto mine = mpi::threads::arguments();
+	mine.size = size;
+	mine.key = unit;
+	auto r = comm->rank();
+	comm->slots[r] = mine;
+	comm->barrier.arrive();
+	if (r == 0) {
+		auto w = new mpi::threads::window(comm->size());
+		// Сегменты подряд, каждый выровнен по строке кэша
+		std::vector<size_t> offsets(comm->size() + 1, 0);
+		for (auto pe = 0; pe < comm->size(); pe++)
+			offsets[pe + 1] = offsets[pe] + ((static_cast<size_t>(comm->slots[pe].size) + 63) & ~size_t(63));
+		w->memory.reset(new char[offsets.back() + 64]);
+		auto base = reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(w->memory.get()) + 63) & ~std::uintptr_t(63));
+		for (auto pe = 0; pe < comm->size(); pe++) {
+			w->bases[pe] = base + offsets[pe];
+			w->sizes[pe] = comm->slots[pe].size;
+			w->units[pe] = comm->slots[pe].key;
+		}
+		comm->slots[0].result = w;
+	}
+	comm->barrier.arrive();
+	*win = static_cast<MPI_Win>(comm->slots[0].result);
+	*static_cast<void**>(baseptr) = (*win)->bases[r];
+	comm->barrier.arrive();
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Win_shared_query(MPI_Win win, int rank, MPI_Aint* size, int* unit, void* baseptr) {
+	*size = win->sizes[rank];
+	*unit = win->units[rank];
+	*static_cast<void**>(baseptr) = win->bases[rank];
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Win_lock_all(int, MPI_Win) { return MPI_SUCCESS; }
+inline int MPI_Win_unlock_all(MPI_Win) { return MPI_SUCCESS; }
+
+inline int MPI_Win_sync(MPI_Win) {
+	std::atomic_thread_fence(std::memory_order_seq_cst);
+	return MPI_SUCCESS;
+}
+
+inline int MPI_Win_free(MPI_Win* win) {
+	(*win)->barrier.arrive();
+	if (--(*win)->refs == 0)
+		delete *win;
+	*win = nullptr;
+	return MPI_SUCCESS;
+}
+
+// Профилирующие имена совпадают с основными
+#define PMPI_Wtime                MPI_Wtime
+#define PMPI_Initialized          MPI_Initialized
+#define PMPI_Comm_rank            MPI_Comm_rank
+#define PMPI_Comm_size            MPI_Comm_size
+#define PMPI_Comm_group           MPI_Comm_group
+#define PMPI_Group_translate_ranks MPI_Group_translate_ranks
+#define PMPI_Group_free           MPI_Group_free
+#define PMPI_Send                 MPI_Send
+#define PMPI_Recv                 MPI_Recv
+#define PMPI_Gather               MPI_Gather
+#define PMPI_Gatherv              MPI_Gatherv
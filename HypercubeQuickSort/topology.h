@@ -0,0 +1,211 @@
+﻿#pragma once
+#include <algorithm>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "mpiext.h"
+
+namespace mpi {
+	using std::vector;
+
+	// Насколько близок процесс-партнёр
+	enum class locality { socket, node, network };
+
+	///<summary>
+	/// Расположение процессов по узлам и сокетам. Узлы определяются
+	/// через MPI_Comm_split_type, имена хостов задают порядок узлов,
+	/// чтобы отображение не зависело от порядка запуска
+	///</summary>
+	class topology {
+	public:
+		// Кол-во классов близости
+		static constexpr int classes = 3;
+
+	private:
+		// Положение одного процесса
+		struct place {
+			int node;    // Номер узла
+			int socket;  // Номер сокета внутри узла
+			int local;   // Номер внутри сокета
+		};
+
+	public:
+		///<summary>
+		/// Процессы одного узла. ranksPerNode > 0 делит узел
+		/// на виртуальные узлы по ranksPerNode процессов
+		///</summary>
+		static MPI_Comm node_comm(MPI_Comm comm, int ranksPerNode = 0)
+		{
+			auto node = mpi::splitShared(comm, mpi::getRank(comm));
+			if (ranksPerNode > 0) {
+				auto nodeRank = mpi::getRank(node);
+				auto virtualNode = mpi::splitComm(node, nodeRank / ranksPerNode, nodeRank);
+				mpi::freeComm(node);
+				node = virtualNode;
+			}
+			return node;
+		}
+
+		///<summary>
+		/// Процессы одного сокета внутри узла. Если MPI не умеет
+		/// различать сокеты, весь узел считается одним сокетом
+		///</summary>
+		static MPI_Comm socket_comm(MPI_Comm node)
+		{
+			auto rank = mpi::getRank(node);
+#ifdef OMPI_COMM_TYPE_SOCKET
+			MPI_Comm socket;
+			MPI_Comm_split_type(node, OMPI_COMM_TYPE_SOCKET, rank, MPI_INFO_NULL, &socket);
+			return socket;
+#else
+			return mpi::splitComm(node, 0, rank);
+#endif
+		}
+
+		///<summary>
+		/// Виртуальная координата гиперкуба каждого процесса comm.
+		/// Старшие биты - номер внутри сокета, затем сокет, младшие - узел:
+		/// первые итерации (старшие измерения) идут внутри сокета,
+		/// последние - между узлами. При неравных или не кратных двум
+		/// узлах и сокетах возвращается тождественное отображение
+		///</summary>
+		static vector<int> virtual_ranks(MPI_Comm comm, int ranksPerNode = 0)
+		{
+			auto places = discover(comm, ranksPerNode);
+			auto size = static_cast<int>(places.size());
+			vector<int> identity(size);
+			for (auto pe = 0; pe < size; pe++)
+				identity[pe] = pe;
+
+			int nodes = 0, sockets = 0, perSocket = 0;
+			for (const auto& p : places) {
+				nodes = std::max(nodes, p.node + 1);
+				sockets = std::max(sockets, p.socket + 1);
+				perSocket = std::max(perSocket, p.local + 1);
+			}
+			// Каждая комбинация (узел, сокет, номер) должна встречаться ровно раз
+			if (!power_of_two(nodes) || !power_of_two(sockets) || !power_of_two(perSocket)
+				|| nodes * sockets * perSocket != size)
+				return identity;
+			vector<int> result(size), seen(size, 0);
+			for (auto pe = 0; pe < size; pe++) {
+				const auto& p = places[pe];
+				result[pe] = (p.local * sockets + p.socket) * nodes + p.node;
+				if (seen[result[pe]]++)
+					return identity;
+			}
+			return result;
+		}
+
+		///<summary>
+		/// Коммуникатор с рангами, переставленными по virtual_ranks.
+		/// Процесс 0 comm остаётся процессом 0
+		///</summary>
+		static MPI_Comm hypercube_comm(MPI_Comm comm, int ranksPerNode = 0)
+		{
+			auto ranks = virtual_ranks(comm, ranksPerNode);
+			return mpi::splitComm(comm, 0, ranks[mpi::getRank(comm)]);
+		}
+
+		///<summary>
+		/// Близость каждого из партнёров peers (ранги comm) к текущему процессу
+		///</summary>
+		static vector<locality> classify(MPI_Comm comm, const vector<int>& peers, int ranksPerNode = 0)
+		{
+			auto places = discover(comm, ranksPerNode);
+			const auto& me = places[mpi::getRank(comm)];
+			vector<locality> result{};
+			result.reserve(peers.size());
+			for (auto peer : peers) {
+				const auto& p = places[peer];
+				result.push_back(p.node != me.node ? locality::network
+					: p.socket != me.socket ? locality::node : locality::socket);
+			}
+			return result;
+		}
+
+		///<summary>
+		/// Ранги процессов ranks коммуникатора from в коммуникаторе to
+		///</summary>
+		static vector<int> translate(MPI_Comm from, const vector<int>& ranks, MPI_Comm to)
+		{
+			MPI_Group fromGroup, toGroup;
+			MPI_Comm_group(from, &fromGroup);
+			MPI_Comm_group(to, &toGroup);
+			vector<int> result(ranks.size());
+			MPI_Group_translate_ranks(fromGroup, static_cast<int>(ranks.size()), ranks.data(), toGroup, result.data());
+			MPI_Group_free(&fromGroup);
+			MPI_Group_free(&toGroup);
+			return result;
+		}
+
+		// Название класса близости
+		static const char* name(locality where)
+		{
+			switch (where) {
+			case locality::socket: return "socket";
+			case locality::node:   return "node";
+			default:               return "network";
+			}
+		}
+
+	private:
+		static bool power_of_two(int value) { return value > 0 && (value & (value - 1)) == 0; }
+
+		///<summary>
+		/// Положение всех процессов comm (коллективно)
+		///</summary>
+		static vector<place> discover(MPI_Comm comm, int ranksPerNode)
+		{
+			auto rank = mpi::getRank(comm),
+				 size = mpi::getSize(comm);
+			auto node = node_comm(comm, ranksPerNode);
+			auto socket = socket_comm(node);
+			// Узел определяется первым процессом, сокет - первым процессом сокета
+			auto nodeLeader = rank, socketLeader = rank;
+			MPI_Allreduce(MPI_IN_PLACE, &nodeLeader, 1, MPI_INT, MPI_MIN, node);
+			MPI_Allreduce(MPI_IN_PLACE, &socketLeader, 1, MPI_INT, MPI_MIN, socket);
+			auto local = mpi::getRank(socket);
+			mpi::freeComm(socket);
+			mpi::freeComm(node);
+
+			char host[MPI_MAX_PROCESSOR_NAME] = { 0 };
+			int length = 0;
+			MPI_Get_processor_name(host, &length);
+			vector<char> hosts(static_cast<size_t>(size) * MPI_MAX_PROCESSOR_NAME);
+			MPI_Allgather(host, MPI_MAX_PROCESSOR_NAME, MPI_CHAR, hosts.data(), MPI_MAX_PROCESSOR_NAME, MPI_CHAR, comm);
+			auto leaders = mpi::allgather(vector<int>{ nodeLeader, socketLeader, local }, comm);
+
+			// Узел процесса 0 первый, остальные упорядочены
+			// по имени хоста, затем по первому процессу
+			vector<int> nodeLeaders{};
+			for (auto pe = 0; pe < size; pe++)
+				if (leaders[3 * pe] == pe)
+					nodeLeaders.push_back(pe);
+			std::sort(nodeLeaders.begin() + 1, nodeLeaders.end(), [&hosts](int a, int b) {
+				auto order = std::string(&hosts[a * MPI_MAX_PROCESSOR_NAME]).compare(&hosts[b * MPI_MAX_PROCESSOR_NAME]);
+				return order != 0 ? order < 0 : a < b;
+			});
+			vector<place> places(size);
+			for (auto pe = 0; pe < size; pe++) {
+				auto& p = places[pe];
+				p.node = static_cast<int>(std::find(nodeLeaders.begin(), nodeLeaders.end(), leaders[3 * pe]) - nodeLeaders.begin());
+				p.local = leaders[3 * pe + 2];
+				// Сокеты узла нумеруются по первому процессу
+				p.socket = 0;
+				for (auto other = 0; other < size; other++)
+					if (leaders[3 * other] == leaders[3 * pe] && leaders[3 * other + 1] == other
+						&& other < leaders[3 * pe + 1])
+						p.socket++;
+			}
+			return places;
+		}
+
+	public:
+		// Класс статический
+		topology() = delete;
+		topology(topology&) = delete;
+		topology(topology&&) = delete;
+		topology& operator=(const topology&) = delete;
+	};
+}
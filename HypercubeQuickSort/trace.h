@@ -0,0 +1,212 @@
+﻿#pragma once
+#include "mpi_backend.h"
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// Трассировка вызовов MPI. Включается макросом MPIEXT_TRACE
+// при сборке, без него точки трассировки ничего не делают.
+// Внутри блока допустима одна точка: MPIEXT_TRACE_SCOPE объявляет
+// замер до конца блока, MPIEXT_TRACE_BYTES уточняет его объём
+#ifdef MPIEXT_TRACE
+#define MPIEXT_TRACE_SCOPE(name, peer, tag, amount, comm) \
+		::mpi::trace_scope mpiext_trace_scope_("mpiext", name, peer, tag, amount, comm)
+#define MPIEXT_TRACE_BYTES(amount) mpiext_trace_scope_.bytes = (amount)
+#else
+#define MPIEXT_TRACE_SCOPE(name, peer, tag, amount, comm) do { } while (0)
+#define MPIEXT_TRACE_BYTES(amount) do { } while (0)
+#endif
+
+namespace mpi {
+
+	///<summary>
+	/// Журнал вызовов MPI текущего процесса: начало и конец
+	/// по часам процесса 0, партнёр (ранг в MPI_COMM_WORLD), тег и объём.
+	/// Собирается на корне в формат Chrome trace (chrome://tracing, Perfetto).
+	/// Собственные обмены журнала идут через PMPI_* и в него не попадают
+	///</summary>
+	class trace
+	{
+	public:
+		struct event {
+			const char* category;
+			const char* name;
+			double start, end;
+			int peer, tag;
+			long long bytes;
+		};
+
+		// Тег обменов выравнивания часов
+		static const int align_tag = 32000;
+
+	public:
+		// Запись включена (можно выключать на время прогрева)
+		static bool& enabled() { static bool _on = true; return _on; }
+		// Поправка к MPI_Wtime до часов процесса 0, с
+		static double& offset() { static double _offset = 0; return _offset; }
+		static std::vector<event>& events() { static std::vector<event> _events; return _events; }
+
+		// Текущее время по часам процесса 0
+		static double now() { return PMPI_Wtime() + offset(); }
+
+		///<summary>
+		/// Добавляет событие. Безопасно из потока прогресса
+		///</summary>
+		static void record(const char* category, const char* name, double start, double end,
+			int peer, int tag, long long bytes)
+		{
+			if (!enabled())
+				return;
+			std::lock_guard<std::mutex> guard(lock());
+			events().push_back({ category, name, start, end, peer, tag, bytes });
+		}
+
+		///<summary>
+		/// Ранг партнёра в MPI_COMM_WORLD
+		///</summary>
+		static int world_rank(int peer, MPI_Comm comm)
+		{
+			if (peer < 0 || comm == MPI_COMM_WORLD || comm == MPI_COMM_NULL)
+				return peer;
+			MPI_Group group, world;
+			int translated = peer;
+			PMPI_Comm_group(comm, &group);
+			PMPI_Comm_group(MPI_COMM_WORLD, &world);
+			PMPI_Group_translate_ranks(group, 1, &peer, world, &translated);
+			PMPI_Group_free(&group);
+			PMPI_Group_free(&world);
+			return translated;
+		}
+
+		///<summary>
+		/// Выравнивание часов по процессу 0 (коллективно, после MPI_Init).
+		/// Каждый процесс по очереди обменивается с 0 несколькими
+		/// сообщениями; поправка берётся по обмену с наименьшей задержкой
+		///</summary>
+		static void align(int rounds = 16)
+		{
+			int initialized = 0;
+			PMPI_Initialized(&initialized);
+			if (!initialized || aligned())
+				return;
+			aligned() = true;
+			int rank, size;
+			PMPI_Comm_rank(MPI_COMM_WORLD, &rank);
+			PMPI_Comm_size(MPI_COMM_WORLD, &size);
+			for (auto pe = 1; pe < size; pe++) {
+				for (auto k = 0; k < rounds; k++) {
+					if (rank == 0) {
+						double stamp = 0;
+						PMPI_Recv(&stamp, 1, MPI_DOUBLE, pe, align_tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+						stamp = PMPI_Wtime();
+						PMPI_Send(&stamp, 1, MPI_DOUBLE, pe, align_tag, MPI_COMM_WORLD);
+					} else if (rank == pe) {
+						double sent = PMPI_Wtime(), remote = 0;
+						PMPI_Send(&sent, 1, MPI_DOUBLE, 0, align_tag, MPI_COMM_WORLD);
+						PMPI_Recv(&remote, 1, MPI_DOUBLE, 0, align_tag, MPI_COMM_WORLD, MPI_STATUS_IGNORE);
+						double received = PMPI_Wtime(), delay = received - sent;
+						// Ответ снят примерно в середине обмена
+						if (k == 0 || delay < best()) {
+							best() = delay;
+							offset() = remote - (sent + received) / 2;
+						}
+					}
+				}
+			}
+		}
+
+		///<summary>
+		/// Сбор журналов всех процессов в файл path на корне (коллективно).
+		/// Процесс - отдельная дорожка (pid = ранг)
+		///</summary>
+		static void write(const std::string& path, int root = 0, MPI_Comm comm = MPI_COMM_WORLD)
+		{
+			int rank, size;
+			PMPI_Comm_rank(comm, &rank);
+			PMPI_Comm_size(comm, &size);
+			std::string text{};
+			{
+				std::lock_guard<std::mutex> guard(lock());
+				char line[512];
+				std::snprintf(line, sizeof(line),
+					"{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"rank %d\"}},\n", rank, rank);
+				text += line;
+				for (const auto& e : events()) {
+					std::snprintf(line, sizeof(line),
+						"{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"pid\":%d,\"tid\":0,\"ts\":%.3f,\"dur\":%.3f,"
+						"\"args\":{\"peer\":%d,\"tag\":%d,\"bytes\":%lld}},\n",
+						e.name, e.category, rank, e.start * 1e6, (e.end - e.start) * 1e6, e.peer, e.tag, e.bytes);
+					text += line;
+				}
+			}
+			int length = static_cast<int>(text.size());
+			std::vector<int> lengths(rank == root ? size : 0), displs(rank == root ? size : 0);
+			PMPI_Gather(&length, 1, MPI_INT, lengths.data(), 1, MPI_INT, root, comm);
+			std::string all{};
+			if (rank == root) {
+				for (auto pe = 1; pe < size; pe++)
+					displs[pe] = displs[pe - 1] + lengths[pe - 1];
+				all.resize(displs[size - 1] + lengths[size - 1]);
+			}
+			PMPI_Gatherv(&text[0], length, MPI_CHAR, rank == root ? &all[0] : nullptr,
+				lengths.data(), displs.data(), MPI_CHAR, root, comm);
+			if (rank != root)
+				return;
+			// Последняя запятая лишняя
+			if (all.size() >= 2)
+				all.resize(all.size() - 2);
+			std::ofstream out(path);
+			out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n" << all << "\n]}\n";
+		}
+
+		///<summary>
+		/// Запись журнала в файл из MPIEXT_TRACE_FILE (по умолчанию
+		/// trace.json) один раз, перед MPI_Finalize
+		///</summary>
+		static void flush()
+		{
+			if (written())
+				return;
+			written() = true;
+			auto path = std::getenv("MPIEXT_TRACE_FILE");
+			write(path ? path : "trace.json");
+		}
+
+	private:
+		static std::mutex& lock() { static std::mutex _lock; return _lock; }
+		static bool& aligned() { static bool _aligned = false; return _aligned; }
+		static bool& written() { static bool _written = false; return _written; }
+		static double& best() { static double _best = 0; return _best; }
+
+	public:
+		trace() = delete;
+		trace(const trace&) = delete;
+	};
+
+	///<summary>
+	/// Замер от объявления до конца блока
+	///</summary>
+	struct trace_scope {
+		const char* category;
+		const char* name;
+		int peer, tag;
+		long long bytes;
+		MPI_Comm comm;
+		double start;
+
+		trace_scope(const char* category, const char* name, int peer, int tag, long long bytes, MPI_Comm comm)
+			: category(category), name(name), peer(peer), tag(tag), bytes(bytes), comm(comm), start(trace::now())
+		{ }
+
+		~trace_scope() {
+			auto end = trace::now();
+			trace::record(category, name, start, end, trace::world_rank(peer, comm), tag, bytes);
+		}
+
+		trace_scope(const trace_scope&) = delete;
+		trace_scope& operator=(const trace_scope&) = delete;
+	};
+}